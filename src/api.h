@@ -4,6 +4,7 @@
 #ifndef MPRIS_SCROBBLER_API_H
 #define MPRIS_SCROBBLER_API_H
 
+#include "json_writer.h"
 #include "md5.h"
 
 #include <inttypes.h>
@@ -11,7 +12,10 @@
 #include <stdbool.h>
 
 #define MIN_TRACK_LENGTH                30.0L // seconds
-#define NOW_PLAYING_DELAY               65.0L //seconds
+// NOTE(marius): the services show a track as playing for the duration sent with it, but we don't trust
+//  them to do it for longer than this
+#define NOW_PLAYING_MAX_TTL             600.0L // seconds
+#define NOW_PLAYING_REFRESH_MARGIN      5.0L // seconds
 
 #define CONTENT_TYPE_XML            "application/xml"
 #define CONTENT_TYPE_JSON           "application/json"
@@ -411,6 +415,7 @@ static void http_request_init(struct http_request *req)
     req->body_length = 0;
     req->end_point   = NULL;
     req->headers     = NULL;
+    req->shared_headers = NULL;
     time(&req->time);
 }
 
@@ -556,38 +561,55 @@ static void api_build_request_get_session(struct http_request *req, const struct
     }
 }
 
-static void api_build_request_now_playing(struct http_request *req, const struct scrobble *tracks[], const unsigned track_count,
-    const struct api_credentials *auth, CURL *handle)
+static bool api_build_request_now_playing(struct http_request *req, const struct scrobble *tracks[], const unsigned track_count,
+    const struct api_credentials *auth, const struct api_request_template *template, struct track_cache *cache, struct arena *arena)
 {
     switch (auth->end_point) {
         case api_listenbrainz:
-            listenbrainz_api_build_request_now_playing(req, tracks, track_count, auth);
-            break;
+            return listenbrainz_api_build_request_now_playing(req, tracks, track_count, auth, template, cache, arena);
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_build_request_now_playing(req, tracks, track_count, auth, handle);
-            break;
+            return audioscrobbler_api_build_request_now_playing(req, tracks, track_count, auth, template, cache, arena);
         case api_unknown:
         default:
             break;
     }
+    return false;
 }
 
-static void api_build_request_scrobble(struct http_request *req, const struct scrobble *tracks[MAX_QUEUE_LENGTH],
-    const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+static bool api_build_request_scrobble(struct http_request *req, const struct scrobble *tracks[MAX_QUEUE_LENGTH],
+    const unsigned track_count, const struct api_credentials *auth, const struct api_request_template *template, struct track_cache *cache, struct arena *arena)
 {
     switch (auth->end_point) {
         case api_listenbrainz:
-            listenbrainz_api_build_request_scrobble(req, tracks, track_count, auth);
-            break;
+            return listenbrainz_api_build_request_scrobble(req, tracks, track_count, auth, template, cache, arena);
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_build_request_scrobble(req, tracks, track_count, auth, handle);
-            break;
+            return audioscrobbler_api_build_request_scrobble(req, tracks, track_count, auth, template, cache, arena);
         case api_unknown:
         default:
             break;
     }
+    return false;
+}
+
+/*
+ * Builds req from the request built for another account of the same service, when the payload doesn't
+ * depend on the account. The audioscrobbler payloads contain the session key and are signed with it,
+ * so they need to be built for each account.
+ */
+static bool api_build_request_from(struct http_request *req, const struct http_request *source, const struct api_credentials *auth, const struct api_request_template *template)
+{
+    switch (auth->end_point) {
+        case api_listenbrainz:
+            listenbrainz_api_build_request_from(req, source, auth, template);
+            return true;
+        case api_lastfm:
+        case api_librefm:
+        case api_unknown:
+        default:
+            return false;
+    }
 }
 
 static struct http_header *http_header_new(void)
@@ -614,6 +636,69 @@ struct http_header *http_authorization_header_new (const char *token)
     return header;
 }
 
+static struct curl_slist *http_header_append(struct curl_slist *list, struct http_header *header)
+{
+    char full_header[MAX_URL_LENGTH] = {0};
+    snprintf(full_header, MAX_URL_LENGTH, "%s: %s", header->name, header->value);
+    http_header_free(header);
+
+    return curl_slist_append(list, full_header);
+}
+
+static void api_request_template_clean(struct api_request_template *template)
+{
+    if (NULL == template) { return; }
+
+    if (NULL != template->url) { curl_url_cleanup(template->url); }
+    if (NULL != template->headers) { curl_slist_free_all(template->headers); }
+    memset(template, 0x0, sizeof(*template));
+}
+
+/*
+ * Builds the parts of the requests that don't change between the tracks: the endpoint URL, the headers
+ * and the escaped keys. It needs to be rebuilt when the credentials change.
+ */
+static bool api_request_template_init(struct api_request_template *template, const struct api_credentials *creds)
+{
+    if (NULL == template || NULL == creds) { return false; }
+
+    api_request_template_clean(template);
+    struct api_endpoint *end_point = api_endpoint_new(creds);
+    template->url = curl_url();
+    api_get_url(template->url, end_point);
+    api_endpoint_free(end_point);
+
+    switch (creds->end_point) {
+        case api_lastfm:
+        case api_librefm:
+            curl_url_set(template->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
+            escape_url(template->api_key, creds->api_key, strnlen(creds->api_key, MAX_SECRET_LENGTH));
+            escape_url(template->session_key, creds->session_key, strnlen(creds->session_key, MAX_SECRET_LENGTH));
+            break;
+        case api_listenbrainz:
+            template->headers = http_header_append(template->headers, http_authorization_header_new(creds->token));
+            template->headers = http_header_append(template->headers, http_content_type_header_new());
+            break;
+        case api_unknown:
+        default:
+            break;
+    }
+    return true;
+}
+
+/*
+ * The request gets its own copy of the URL, as the track information can be added to it, but the headers
+ * are shared with the template, which needs to outlive the request.
+ */
+static void api_request_template_apply(struct http_request *req, const struct api_request_template *template)
+{
+    if (NULL == req || NULL == template || NULL == template->url) { return; }
+
+    if (NULL != req->url) { curl_url_cleanup(req->url); }
+    req->url = curl_url_dup(template->url);
+    req->shared_headers = template->headers;
+}
+
 static void http_response_clean(struct http_response *res)
 {
     if (NULL == res) { return; }
@@ -642,14 +727,15 @@ static void http_request_print(const struct http_request *req, const enum log_le
     if (log != log_tracing2) { return; }
 
     const size_t headers_count = arrlen(req->headers);
-    if (headers_count == 0 || NULL == req->headers) {
-        return;
-    }
     for (size_t i = 0; i < headers_count; i++) {
         struct http_header *h = req->headers[i];
         if (NULL == h) { continue; }
         _log(log, "    request::headers[%zd]: %s: %s", i, h->name, h->value);
     }
+    size_t i = headers_count;
+    for (const struct curl_slist *h = req->shared_headers; NULL != h; h = h->next) {
+        _log(log, "    request::headers[%zd]: %s", i++, h->data);
+    }
 }
 
 static void http_response_print(const struct http_response *res, const enum log_levels log)
@@ -726,6 +812,26 @@ static bool json_document_is_error(const char *buffer, const size_t length, enum
     return false;
 }
 
+static void api_response_get_scrobble_acks(const struct http_response *res, const enum api_type type, struct scrobble_ack acks[], const unsigned count)
+{
+    switch (type) {
+        case api_lastfm:
+        case api_librefm:
+            audioscrobbler_api_response_get_scrobble_acks(res->body, res->body_length, res->code, acks, count);
+            break;
+        case api_listenbrainz:
+            listenbrainz_api_response_get_scrobble_acks(res->code, acks, count);
+            break;
+        case api_unknown:
+        default:
+            for (unsigned i = 0; i < count; i++) {
+                acks[i].status = scrobble_ack_retry;
+                acks[i].code = 0;
+            }
+            break;
+    }
+}
+
 static void api_response_get_token_json(const char *buffer, const size_t length, struct api_credentials *credentials)
 {
     switch (credentials->end_point) {
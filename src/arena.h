@@ -0,0 +1,122 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_ARENA_H
+#define MPRIS_SCROBBLER_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "escape.h"
+
+/*
+ * Bump allocator for the data that lives only as long as a request: the escaped fields, the signature
+ * base, etc. The memory is taken from blocks of ARENA_BLOCK_SIZE bytes, and nothing is freed on its own,
+ * everything is released at once with arena_reset or arena_free.
+ */
+
+#define ARENA_BLOCK_SIZE            4096
+#define ARENA_ALIGNMENT             sizeof(void*)
+
+struct arena_block {
+    struct arena_block *next;
+    size_t capacity;
+    size_t used;
+    char data[];
+};
+
+struct arena {
+    struct arena_block *head; // the block we allocate from, the full ones are linked after it
+    size_t allocated;         // bytes handed out since the last reset
+    unsigned allocations;     // allocations served since the last reset
+    unsigned blocks;          // blocks requested from the heap since the arena was initialized
+};
+
+static void arena_init(struct arena *arena)
+{
+    memset(arena, 0x0, sizeof(*arena));
+}
+
+static struct arena_block *arena_block_new(const size_t capacity)
+{
+    struct arena_block *block = malloc(sizeof(struct arena_block) + capacity);
+    if (NULL == block) { return NULL; }
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+static void *arena_alloc(struct arena *arena, const size_t size)
+{
+    const size_t aligned = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    struct arena_block *block = arena->head;
+    if (NULL == block || block->capacity - block->used < aligned) {
+        block = arena_block_new(aligned > ARENA_BLOCK_SIZE ? aligned : ARENA_BLOCK_SIZE);
+        if (NULL == block) { return NULL; }
+        block->next = arena->head;
+        arena->head = block;
+        arena->blocks++;
+    }
+    void *result = block->data + block->used;
+    block->used += aligned;
+    arena->allocated += size;
+    arena->allocations++;
+    return result;
+}
+
+/*
+ * URL encodes str the same as curl_easy_escape, everything but the RFC 3986 unreserved characters is
+ * percent encoded, but the result is allocated in the arena.
+ */
+static char *arena_url_escape(struct arena *arena, const char *str, const size_t len)
+{
+    char *result = arena_alloc(arena, ESCAPE_URL_MAX_LENGTH(len));
+    if (NULL == result) { return NULL; }
+
+    escape_url(result, str, len);
+    return result;
+}
+
+/*
+ * Copies the first len bytes of str in the arena, the result is always zero terminated.
+ */
+static char *arena_strndup(struct arena *arena, const char *str, const size_t len)
+{
+    char *result = arena_alloc(arena, len + 1);
+    if (NULL == result) { return NULL; }
+
+    memcpy(result, str, len);
+    result[len] = '\0';
+    return result;
+}
+
+/*
+ * Releases everything allocated so far, but keeps the first block to be reused.
+ */
+static void arena_reset(struct arena *arena)
+{
+    struct arena_block *block = arena->head;
+    while (NULL != block && NULL != block->next) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    if (NULL != block) { block->used = 0; }
+    arena->head = block;
+    arena->allocated = 0;
+    arena->allocations = 0;
+}
+
+static void arena_free(struct arena *arena)
+{
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+#endif // MPRIS_SCROBBLER_ARENA_H
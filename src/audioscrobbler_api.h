@@ -11,7 +11,7 @@
 #include "credentials_librefm.h"
 #endif
 
-#define MIN_SCROBBLE_DELAY_SECONDS        4.0L*60.0L
+#include <stdarg.h>
 
 #define LASTFM_AUTH_URL            "www.last.fm"
 #define LASTFM_AUTH_PATH           "api/auth/"
@@ -38,6 +38,7 @@
 #define API_ALBUMARTIST_NODE_NAME       "albumArtist"
 #define API_IGNORED_NODE_NAME           "ignoredMessage"
 #define API_MUSICBRAINZ_MBID_NODE_NAME  "mbid"
+#define API_DURATION_NODE_NAME          "duration"
 #define API_STATUS_ATTR_NAME            "status"
 #define API_STATUS_VALUE_OK             "ok"
 #define API_STATUS_VALUE_FAILED         "failed"
@@ -264,6 +265,113 @@ _exit:
     return result;
 }
 
+#define API_ATTRIBUTES_NODE_NAME        "@attr"
+#define API_IGNORED_DAILY_LIMIT         5
+
+static bool audioscrobbler_error_is_transient(const int code)
+{
+    switch (code) {
+        // NOTE(marius): these are problems with the service or with our credentials, the tracks themselves are fine
+        case unavaliable:
+        case authentication_failed:
+        case operation_failed:
+        case invalid_session_key:
+        case invalid_apy_key:
+        case service_offline:
+        case temporary_error:
+        case suspended_api_key:
+        case rate_limit_exceeded:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * {"scrobbles":{"scrobble":[{"ignoredMessage":{"code":"0","#text":""}, ...}],"@attr":{"ignored":0,"accepted":1}}}
+ * The "scrobble" node is an object instead of an array when a single track was submitted.
+ */
+static void audioscrobbler_api_response_get_scrobble_acks(const char *buffer, const size_t length, const long http_code, struct scrobble_ack acks[], const unsigned count)
+{
+    for (unsigned i = 0; i < count; i++) {
+        acks[i].status = scrobble_ack_retry;
+        acks[i].code = 0;
+    }
+    if (NULL == buffer || length == 0) { return; }
+    if (http_code <= 0 || http_code >= 500) { return; }
+
+    struct json_tokener *tokener = json_tokener_new();
+    if (NULL == tokener) { return; }
+    json_object *root = json_tokener_parse_ex(tokener, buffer, (int)length);
+    if (NULL == root || !json_object_is_type(root, json_type_object)) {
+        if (http_code == 200) {
+            // NOTE(marius): we can't tell which tracks failed, and resending risks duplicates
+            _warn("json::invalid_json_message: assuming all tracks were accepted");
+            for (unsigned i = 0; i < count; i++) {
+                acks[i].status = scrobble_ack_accepted;
+            }
+        }
+        goto _exit;
+    }
+
+    json_object *err_object = NULL;
+    if (json_object_object_get_ex(root, API_ERROR_NODE_NAME, &err_object) && NULL != err_object) {
+        const int code = json_object_get_int(err_object);
+        const bool transient = audioscrobbler_error_is_transient(code);
+        for (unsigned i = 0; i < count; i++) {
+            acks[i].status = transient ? scrobble_ack_retry : scrobble_ack_rejected;
+            acks[i].code = code;
+        }
+        goto _exit;
+    }
+
+    json_object *scrobbles_object = NULL;
+    if (!json_object_object_get_ex(root, API_SCROBBLES_NODE_NAME, &scrobbles_object) || NULL == scrobbles_object) {
+        _warn("json:missing_scrobbles_object");
+        goto _exit;
+    }
+    json_object *scrobble_object = NULL;
+    json_object_object_get_ex(scrobbles_object, API_SCROBBLE_NODE_NAME, &scrobble_object);
+
+    for (unsigned i = 0; i < count; i++) {
+        json_object *track_object = NULL;
+        if (NULL != scrobble_object && json_object_is_type(scrobble_object, json_type_array)) {
+            if (i < json_object_array_length(scrobble_object)) {
+                track_object = json_object_array_get_idx(scrobble_object, i);
+            }
+        } else if (i == 0) {
+            track_object = scrobble_object;
+        }
+        if (NULL == track_object) {
+            // NOTE(marius): the service answered with success, but didn't return the track status
+            acks[i].status = scrobble_ack_accepted;
+            continue;
+        }
+        json_object *ignored_object = NULL;
+        json_object *code_object = NULL;
+        if (
+            !json_object_object_get_ex(track_object, API_IGNORED_NODE_NAME, &ignored_object) || NULL == ignored_object ||
+            !json_object_object_get_ex(ignored_object, API_ERROR_CODE_ATTR_NAME, &code_object) || NULL == code_object
+        ) {
+            acks[i].status = scrobble_ack_accepted;
+            continue;
+        }
+        const int code = json_object_get_int(code_object);
+        acks[i].code = code;
+        if (code == 0) {
+            acks[i].status = scrobble_ack_accepted;
+        } else if (code == API_IGNORED_DAILY_LIMIT) {
+            acks[i].status = scrobble_ack_retry;
+        } else {
+            acks[i].status = scrobble_ack_ignored;
+        }
+    }
+
+_exit:
+    if (NULL != root) { json_object_put(root); }
+    json_tokener_free(tokener);
+}
+
 static bool audioscrobbler_valid_api_credentials(const struct api_credentials *auth)
 {
     if (NULL == auth) { return false; }
@@ -286,18 +394,15 @@ static void api_get_signature(const char *string, const char *secret, char *resu
     if (NULL == string) { return; }
     if (NULL == secret) { return; }
     if (NULL == result) { return; }
-    const size_t string_len = strlen(string);
-    const size_t secret_len = strlen(secret);
-    const size_t len = string_len + secret_len;
-    char sig[MAX_BODY_SIZE+1] = {0};
 
-    // TODO(marius): this needs to change to memcpy or strncpy
-    strncat(sig, string, MAX_BODY_SIZE);
-    strncat(sig, secret, MAX_PROPERTY_LENGTH/2);
+    // NOTE(marius): the secret is hashed after the parameters, without copying them to a new buffer
+    struct md5_context ctx;
+    md5_init(&ctx);
+    md5_update(&ctx, (const uint8_t*)string, strlen(string));
+    md5_update(&ctx, (const uint8_t*)secret, strnlen(secret, MAX_PROPERTY_LENGTH/2));
 
     unsigned char sig_hash[MD5_DIGEST_LENGTH] = {0};
-
-    md5((uint8_t*)sig, len, sig_hash);
+    md5_final(&ctx, sig_hash);
 
     for (size_t n = 0; n < MD5_DIGEST_LENGTH; n++) {
         snprintf(result + 2 * n, 3, "%02x", sig_hash[n]);
@@ -344,6 +449,7 @@ static void append_signature_query_param(CURL *url, const char *sig_base, const
 static void api_get_url(CURLU*, const struct api_endpoint*);
 struct api_endpoint *api_endpoint_new(const struct api_credentials*);
 struct http_request *http_request_new(void);
+static void api_request_template_apply(struct http_request*, const struct api_request_template*);
 /*
  * api_key (Required) : A Last.fm API key.
  * api_sig (Required) : A Last.fm method signature. See [authentication](https://www.last.fm/api/authentication) for more information.
@@ -418,6 +524,58 @@ static void audioscrobbler_api_build_request_get_session(struct http_request *re
     curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
 }
 
+/*
+ * The form bodies and the signature bases are written in fixed size buffers, and a builder stops appending
+ * once one of them is full. A truncated body would not match its signature, so it's never sent.
+ */
+struct form_buffer {
+    char *data;
+    size_t capacity; // including the terminating zero
+    size_t length;
+    bool overflow;
+};
+
+static void form_buffer_init(struct form_buffer *b, char *data, const size_t capacity)
+{
+    b->data = data;
+    b->capacity = capacity;
+    b->length = 0;
+    b->overflow = false;
+    data[0] = '\0';
+}
+
+static void form_buffer_appendf(struct form_buffer *b, const char *fmt, ...)
+{
+    if (b->overflow) { return; }
+
+    const size_t available = b->capacity - b->length;
+    va_list args;
+    va_start(args, fmt);
+    const int written = vsnprintf(b->data + b->length, available, fmt, args);
+    va_end(args);
+    if (written < 0 || (size_t)written >= available) {
+        b->overflow = true;
+        b->data[b->length] = '\0';
+        return;
+    }
+    b->length += (size_t)written;
+}
+
+static bool audioscrobbler_api_request_set_body(struct http_request *request, const struct form_buffer *body, const struct form_buffer *sig_base)
+{
+    request->request_type = http_post;
+    if (body->overflow || sig_base->overflow) {
+        _warn("audioscrobbler::payload_too_large: over %zu bytes", body->capacity - 1);
+        request->body[0] = '\0';
+        request->body_length = 0;
+        return false;
+    }
+    request->body_length = body->length;
+    return true;
+}
+
+static const struct scrobble_details *scrobble_details_get(struct track_cache*, const struct scrobble*, struct arena*);
+
 /*
  * artist (Required) : The artist name.
  * track (Required) : The track name.
@@ -431,9 +589,9 @@ static void audioscrobbler_api_build_request_get_session(struct http_request *re
  * api_sig (Required) : A Last.fm method signature. See authentication for more information.
  * sk (Required) : A session key generated by authenticating a user via the authentication protocol.
  */
-static void audioscrobbler_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+static bool audioscrobbler_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth, const struct api_request_template *template, struct track_cache *cache, struct arena *arena)
 {
-    if (!audioscrobbler_valid_credentials(auth)) { return; }
+    if (!audioscrobbler_valid_credentials(auth)) { return false; }
 
     (void)track_count; // quiet -Wunused-parameter
     assert(track_count == 1);
@@ -443,125 +601,96 @@ static void audioscrobbler_api_build_request_now_playing(struct http_request *re
     const char *secret = auth->secret;
     const char *sk = auth->session_key;
 
-    char sig_base[MAX_BODY_SIZE+1] = {0};
-    char body[MAX_BODY_SIZE+1] = {0};
-
-    assert(track->album);
-    const size_t album_len = strlen(track->album);
-    char *esc_album = curl_easy_escape(handle, track->album, (int)album_len);
+    const struct scrobble_details *details = scrobble_details_get(cache, track, arena);
+    if (NULL == details) { return false; }
 
-    strncat(body, "album=", 7);
-    strncat(body, esc_album, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
+    char sig_base_data[MAX_BODY_SIZE+1];
+    struct form_buffer sig_base, body;
+    form_buffer_init(&sig_base, sig_base_data, sizeof(sig_base_data));
+    form_buffer_init(&body, request->body, sizeof(request->body));
 
-    strncat(sig_base, "album", 6);
-    strncat(sig_base, track->album, MAX_BODY_SIZE);
-    curl_free(esc_album);
+    assert(track->album);
+    form_buffer_appendf(&body, "album=%s&", details->esc_album);
+    form_buffer_appendf(&sig_base, "album%s", track->album);
 
     assert(api_key);
-    const size_t api_key_len = strlen(api_key);
-    char *esc_api_key = curl_easy_escape(handle, api_key, (int)api_key_len);
-
-    strncat(body, "api_key=", 9);
-    strncat(body, esc_api_key, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "api_key", 8);
-    strncat(sig_base, api_key, MAX_BODY_SIZE);
-    curl_free(esc_api_key);
-
-    char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 1] = {0};
-    size_t full_artist_len = 0;
-    for (size_t i = 0; i < array_count(track->artist); i++) {
-        const char *artist = track->artist[i];
-        const size_t artist_len = strlen(artist);
-        if (NULL == artist || artist_len == 0) { continue; }
-
-        if (full_artist_len > 0) {
-            size_t l_val_sep = strlen(VALUE_SEPARATOR);
-            strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
-            full_artist_len += l_val_sep;
-        }
-        strncat(full_artist, artist, artist_len + 1);
-        full_artist_len += artist_len;
-    }
-    if (full_artist_len > 0) {
-        char *esc_full_artist = curl_easy_escape(handle, full_artist, (int)full_artist_len);
-        const size_t artist_label_len = strlen(API_ARTIST_NODE_NAME);
+    form_buffer_appendf(&body, "api_key=%s&", template->api_key);
+    form_buffer_appendf(&sig_base, "api_key%s", api_key);
 
-        strncat(body, API_ARTIST_NODE_NAME "=", artist_label_len + 2);
-        strncat(body, esc_full_artist, MAX_BODY_SIZE);
-        strncat(body, "&", 2);
+    if (details->full_artist_len > 0) {
+        form_buffer_appendf(&body, API_ARTIST_NODE_NAME "=%s&", details->esc_full_artist);
+        form_buffer_appendf(&sig_base, API_ARTIST_NODE_NAME "%s", details->full_artist);
+    }
 
-        strncat(sig_base, API_ARTIST_NODE_NAME, artist_label_len + 1);
-        strncat(sig_base, full_artist, MAX_BODY_SIZE);
-        curl_free(esc_full_artist);
+    // NOTE(marius): the services show the track as playing for this long, so we don't need to refresh it
+    if (track->length > 0) {
+        form_buffer_appendf(&body, API_DURATION_NODE_NAME "=%ld&", (long)track->length);
+        form_buffer_appendf(&sig_base, API_DURATION_NODE_NAME "%ld", (long)track->length);
     }
 
     const char *mb_track_id = (char *) track->mb_track_id[0];
     const size_t mbid_len = strlen(mb_track_id);
     if (mbid_len > 0) {
-        char *esc_mbid = curl_easy_escape(handle, mb_track_id, (int)mbid_len);
-
-        const size_t mbid_label_len = strlen(API_MUSICBRAINZ_MBID_NODE_NAME);
-
-        strncat(body, API_MUSICBRAINZ_MBID_NODE_NAME "=", mbid_label_len + 2);
-        strncat(body, esc_mbid, MAX_BODY_SIZE);
-        strncat(body, "&", 2);
+        char *esc_mbid = arena_url_escape(arena, mb_track_id, mbid_len);
 
-        strncat(sig_base, API_MUSICBRAINZ_MBID_NODE_NAME, mbid_label_len + 1);
-        strncat(sig_base, mb_track_id, MAX_BODY_SIZE);
-        curl_free(esc_mbid);
+        form_buffer_appendf(&body, API_MUSICBRAINZ_MBID_NODE_NAME "=%s&", esc_mbid);
+        form_buffer_appendf(&sig_base, API_MUSICBRAINZ_MBID_NODE_NAME "%s", mb_track_id);
     }
 
     const char *method = API_METHOD_NOW_PLAYING;
 
     assert(method);
-    const size_t method_len = strlen(method);
-    strncat(body, "method=", 8);
-    strncat(body, method, method_len + 1);
-    strncat(body, "&", 2);
+    form_buffer_appendf(&body, "method=%s&", method);
+    form_buffer_appendf(&sig_base, "method%s", method);
 
-    strncat(sig_base, "method", 7);
-    strncat(sig_base, method, method_len + 1);
-
-    strncat(body, "sk=", 4);
-    strncat(body, sk, MAX_PROPERTY_LENGTH);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "sk", 3);
-    strncat(sig_base, sk, MAX_SECRET_LENGTH);
+    form_buffer_appendf(&body, "sk=%s&", template->session_key);
+    form_buffer_appendf(&sig_base, "sk%s", sk);
 
     assert(track->title);
-    const size_t title_len = strlen(track->title);
-    char *esc_title = curl_easy_escape(handle, track->title, (int)title_len);
-
-    strncat(body, "track=", 7);
-    strncat(body, esc_title, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "track", 6);
-    strncat(sig_base, track->title, title_len + 1);
-    curl_free(esc_title);
+    form_buffer_appendf(&body, "track=%s&", details->esc_title);
+    form_buffer_appendf(&sig_base, "track%s", track->title);
 
     char sig[MD5_HEX_LENGTH] = {0};
-    api_get_signature(sig_base, secret, sig);
-    strncat(body, "api_sig=", 9);
-    strncat(body, sig, MAX_PROPERTY_LENGTH);
+    if (!sig_base.overflow) {
+        api_get_signature(sig_base.data, secret, sig);
+    }
+    form_buffer_appendf(&body, "api_sig=%s", sig);
 
-    curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
+    if (!audioscrobbler_api_request_set_body(request, &body, &sig_base)) { return false; }
+    api_request_template_apply(request, template);
+    return true;
+}
 
-    request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
-    api_get_url(request->url, request->end_point);
+/*
+ * The values of a track the scrobble payload uses more than once.
+ */
+struct audioscrobbler_track_values {
+    const char *esc_album;
+    const char *esc_full_artist;
+    const char *full_artist;
+    const char *esc_title;
+};
+
+/*
+ * A batch can hold more tracks than the cache, so loading the details of a track can evict the ones of an
+ * earlier track. The values are copied in the arena before the next track's details are loaded.
+ */
+static bool audioscrobbler_track_values_load(struct audioscrobbler_track_values *values, const struct scrobble *track, struct track_cache *cache, struct arena *arena)
+{
+    const struct scrobble_details *details = scrobble_details_get(cache, track, arena);
+    if (NULL == details) { return false; }
+
+    values->esc_album = arena_strndup(arena, details->esc_album, details->esc_album_len);
+    values->esc_full_artist = arena_strndup(arena, details->esc_full_artist, details->esc_full_artist_len);
+    values->full_artist = arena_strndup(arena, details->full_artist, details->full_artist_len);
+    values->esc_title = arena_strndup(arena, details->esc_title, details->esc_title_len);
+    return NULL != values->esc_album && NULL != values->esc_full_artist && NULL != values->full_artist && NULL != values->esc_title;
 }
 
 static bool scrobble_is_empty(const struct scrobble*);
-static void audioscrobbler_api_build_request_scrobble(struct http_request *request, const struct scrobble *tracks[MAX_QUEUE_LENGTH], const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+static bool audioscrobbler_api_build_request_scrobble(struct http_request *request, const struct scrobble *tracks[MAX_QUEUE_LENGTH], const unsigned track_count, const struct api_credentials *auth, const struct api_request_template *template, struct track_cache *cache, struct arena *arena)
 {
-    if (!audioscrobbler_valid_credentials(auth)) { return; }
+    if (!audioscrobbler_valid_credentials(auth)) { return false; }
 
     const char *api_key = auth->api_key;
     const char *secret = auth->secret;
@@ -569,8 +698,16 @@ static void audioscrobbler_api_build_request_scrobble(struct http_request *reque
 
     const char *method = API_METHOD_SCROBBLE;
 
-    char sig_base[MAX_BODY_SIZE+1] = {0};
-    char body[MAX_BODY_SIZE+1] = {0};
+    struct audioscrobbler_track_values values[MAX_QUEUE_LENGTH] = {0};
+    for (size_t i = 0; i < track_count; i++) {
+        if (!audioscrobbler_track_values_load(&values[i], tracks[i], cache, arena)) { return false; }
+    }
+
+    // NOTE(marius): the values are written straight into the checked buffers, so none of them is truncated on its own
+    char sig_base_data[MAX_BODY_SIZE+1];
+    struct form_buffer sig_base, body;
+    form_buffer_init(&sig_base, sig_base_data, sizeof(sig_base_data));
+    form_buffer_init(&body, request->body, sizeof(request->body));
 
     for (size_t i = 0; i < track_count; i++) {
         const struct scrobble *track = tracks[i];
@@ -578,69 +715,18 @@ static void audioscrobbler_api_build_request_scrobble(struct http_request *reque
         if (scrobble_is_empty(track)) {
             continue;
         }
-        const size_t album_len = strlen(track->album);
-
-        char *esc_album = curl_easy_escape(handle, track->album, (int)album_len);
-        char album_body[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(album_body, MAX_PROPERTY_LENGTH, API_ALBUM_NODE_NAME "[%lu]=%s&", i, esc_album);
-        strncat(body, album_body, MAX_PROPERTY_LENGTH);
-
-        char album_sig[MAX_PROPERTY_LENGTH + 19] = {0};
-        snprintf(album_sig, MAX_PROPERTY_LENGTH + 18, API_ALBUM_NODE_NAME "[%lu]%s", i, track->album);
-
-        assert(strlen(sig_base) + strlen(album_sig)<MAX_BODY_SIZE);
-        strncat(sig_base, album_sig, MAX_PROPERTY_LENGTH + 19);
-
-        curl_free(esc_album);
+        form_buffer_appendf(&body, API_ALBUM_NODE_NAME "[%zu]=%s&", i, values[i].esc_album);
+        form_buffer_appendf(&sig_base, API_ALBUM_NODE_NAME "[%zu]%s", i, track->album);
     }
 
     assert(api_key);
-    const size_t api_key_len = strlen(api_key);
-    char *esc_api_key = curl_easy_escape(handle, api_key, (int)api_key_len);
-
-    strncat(body, "api_key=", 9);
-    strncat(body, esc_api_key, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "api_key", 8);
-    strncat(sig_base, api_key, MAX_BODY_SIZE);
-    curl_free(esc_api_key);
+    form_buffer_appendf(&body, "api_key=%s&", template->api_key);
+    form_buffer_appendf(&sig_base, "api_key%s", api_key);
 
     for (size_t i = 0; i < track_count; i++) {
-        const struct scrobble *track = tracks[i];
-
-        char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT] = {0};
-        size_t full_artist_len = 0;
-        for (unsigned j = 0; j < array_count(track->artist); j++) {
-            const char *artist = track->artist[j];
-            const size_t artist_len = strlen(artist);
-            if (NULL == artist || artist_len == 0) { continue; }
-
-            if (full_artist_len > 0) {
-                const size_t l_val_sep = strlen(VALUE_SEPARATOR);
-                strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
-                full_artist_len += l_val_sep;
-            }
-            strncat(full_artist, artist, artist_len + 1);
-            full_artist_len += artist_len;
-        }
-        if (full_artist_len > 0) {
-            char *esc_full_artist = curl_easy_escape(handle, full_artist, (int)full_artist_len);
-
-            const char fmt_full_artist[] = API_ARTIST_NODE_NAME "[%zu]=%s&";
-
-            char artist_body[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11] = {0};
-            snprintf(artist_body, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11, fmt_full_artist, i, esc_full_artist);
-
-            strncat(body, artist_body, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11);
-
-            const char fmt_artist_sig[] = API_ARTIST_NODE_NAME "[%zu]%s";
-            char artist_sig[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9] = {0};
-            snprintf(artist_sig, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9, fmt_artist_sig, i, full_artist);
-
-            assert(strlen(sig_base) + strlen(artist_sig) < MAX_BODY_SIZE);
-            strncat(sig_base, artist_sig, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9);
-            curl_free(esc_full_artist);
+        if (values[i].full_artist[0] != '\0') {
+            form_buffer_appendf(&body, API_ARTIST_NODE_NAME "[%zu]=%s&", i, values[i].esc_full_artist);
+            form_buffer_appendf(&sig_base, API_ARTIST_NODE_NAME "[%zu]%s", i, values[i].full_artist);
         }
     }
 
@@ -650,87 +736,44 @@ static void audioscrobbler_api_build_request_scrobble(struct http_request *reque
         char *mb_track_id = (char*)track->mb_track_id[0];
         const size_t mbid_len = strlen(mb_track_id);
         if (mbid_len > 0) {
-            char *esc_mbid = curl_easy_escape(handle, mb_track_id, (int)mbid_len);
-
-            char mbid_body[MAX_PROPERTY_LENGTH] = {0};
-            snprintf(mbid_body, MAX_PROPERTY_LENGTH, API_MUSICBRAINZ_MBID_NODE_NAME "[%lu]=%s&", i, esc_mbid);
-            strncat(body, mbid_body, MAX_PROPERTY_LENGTH);
+            char *esc_mbid = arena_url_escape(arena, mb_track_id, mbid_len);
 
-            char mbid_sig[MAX_PROPERTY_LENGTH + 18] = {0};
-            snprintf(mbid_sig, MAX_PROPERTY_LENGTH + 17, API_MUSICBRAINZ_MBID_NODE_NAME "[%lu]%s", i, mb_track_id);
-
-            assert(strlen(sig_base) + strlen(mbid_sig) < MAX_BODY_SIZE);
-            strncat(sig_base, mbid_sig, MAX_PROPERTY_LENGTH + 18);
-
-            curl_free(esc_mbid);
+            form_buffer_appendf(&body, API_MUSICBRAINZ_MBID_NODE_NAME "[%zu]=%s&", i, esc_mbid);
+            form_buffer_appendf(&sig_base, API_MUSICBRAINZ_MBID_NODE_NAME "[%zu]%s", i, mb_track_id);
         }
     }
 
     assert(method);
-    const size_t method_len = strlen(method);
-    strncat(body, "method=", 8);
-    strncat(body, method, method_len + 1);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "method", 7);
-    assert(strlen(sig_base) + strlen(method) < MAX_BODY_SIZE);
-    strncat(sig_base, method, method_len + 1);
+    form_buffer_appendf(&body, "method=%s&", method);
+    form_buffer_appendf(&sig_base, "method%s", method);
 
     assert(sk);
-    strncat(body, "sk=", 4);
-    strncat(body, sk, MAX_SECRET_LENGTH+1);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "sk", 3);
-    assert(strlen(sig_base) + strlen(sk) < MAX_BODY_SIZE);
-    strncat(sig_base, sk, MAX_SECRET_LENGTH+1);
+    form_buffer_appendf(&body, "sk=%s&", template->session_key);
+    form_buffer_appendf(&sig_base, "sk%s", sk);
 
     for (int i = (int)track_count - 1; i >= 0; i--) {
         const struct scrobble *track = tracks[i];
 
-        char tstamp_body[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(tstamp_body, MAX_PROPERTY_LENGTH, API_TIMESTAMP_NODE_NAME "[%d]=%ld&", i, track->start_time);
-        strncat(body, tstamp_body, MAX_PROPERTY_LENGTH);
-
-        char tstamp_sig[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(tstamp_sig, MAX_PROPERTY_LENGTH, API_TIMESTAMP_NODE_NAME "[%d]%ld", i, track->start_time);
-
-        assert(strlen(sig_base) + strlen(tstamp_sig) < MAX_BODY_SIZE);
-        strncat(sig_base, tstamp_sig, MAX_PROPERTY_LENGTH);
+        form_buffer_appendf(&body, API_TIMESTAMP_NODE_NAME "[%d]=%ld&", i, (long)track->start_time);
+        form_buffer_appendf(&sig_base, API_TIMESTAMP_NODE_NAME "[%d]%ld", i, (long)track->start_time);
     }
 
     for (int i = (int)track_count - 1; i >= 0; i--) {
         const struct scrobble *track = tracks[i];
 
-        const size_t title_len = strlen(track->title);
-
-        char *esc_title = curl_easy_escape(handle, track->title, (int)title_len);
-
-        char title_body[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(title_body, MAX_PROPERTY_LENGTH, API_TRACK_NODE_NAME "[%d]=%s&", i, esc_title);
-        strncat(body, title_body, MAX_PROPERTY_LENGTH);
-
-        char title_sig[MAX_PROPERTY_LENGTH + 19] = {0};
-        snprintf(title_sig, MAX_PROPERTY_LENGTH + 18, API_TRACK_NODE_NAME "[%d]%s", i, track->title);
-
-        assert(strlen(sig_base) + strlen(title_sig) < MAX_BODY_SIZE);
-        strncat(sig_base, title_sig, MAX_PROPERTY_LENGTH + 19);
-
-        curl_free(esc_title);
+        form_buffer_appendf(&body, API_TRACK_NODE_NAME "[%d]=%s&", i, values[i].esc_title);
+        form_buffer_appendf(&sig_base, API_TRACK_NODE_NAME "[%d]%s", i, track->title);
     }
 
     char sig[MD5_HEX_LENGTH] = {0};
-    api_get_signature(sig_base, secret, sig);
-    strncat(body, "api_sig=", 9);
-    strncat(body, sig, MAX_PROPERTY_LENGTH);
-
-    curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
+    if (!sig_base.overflow) {
+        api_get_signature(sig_base.data, secret, sig);
+    }
+    form_buffer_appendf(&body, "api_sig=%s", sig);
 
-    request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
-    api_get_url(request->url, request->end_point);
+    if (!audioscrobbler_api_request_set_body(request, &body, &sig_base)) { return false; }
+    api_request_template_apply(request, template);
+    return true;
 }
 
 #endif // MPRIS_SCROBBLER_AUDIOSCROBBLER_API_H
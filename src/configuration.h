@@ -16,6 +16,8 @@
 #define PID_SUFFIX                  ".pid"
 #define CREDENTIALS_FILE_NAME       "credentials"
 #define CACHE_FILE_NAME             "queue"
+#define DEAD_LETTER_FILE_NAME       "deadletter"
+#define FINGERPRINTS_FILE_NAME      "fingerprints"
 #define CONFIG_FILE_NAME            "config"
 #define CONFIG_DIR_NAME             ".config"
 #define CACHE_DIR_NAME              ".cache"
@@ -51,6 +53,11 @@
 #define SERVICE_LABEL_LIBREFM       "librefm"
 #define SERVICE_LABEL_LISTENBRAINZ  "listenbrainz"
 #define CONFIG_KEY_IGNORE           "ignore"
+#define CONFIG_KEY_HTTP2            "http2"
+#define CONFIG_KEY_HTTP2_STREAMS    "http2_streams"
+#define HTTP2_DEFAULT_STREAMS       8L
+#define HTTP2_MAX_STREAMS           100L
+#define SERVICE_ACCOUNT_SEPARATOR   ':'
 
 static const char *get_api_type_group(enum api_type end_point)
 {
@@ -74,7 +81,7 @@ static const char *get_api_type_group(enum api_type end_point)
     return api_label;
 }
 
-static struct ini_config *get_ini_from_credentials(struct api_credentials credentials[MAX_CREDENTIALS], const size_t length)
+static struct ini_config *get_ini_from_credentials(struct api_credentials *credentials, const size_t length)
 {
     if (NULL == credentials) { return NULL; }
     if (length == 0) { return NULL; }
@@ -87,7 +94,13 @@ static struct ini_config *get_ini_from_credentials(struct api_credentials creden
         if (NULL == current) { continue; }
         if (current->end_point == api_unknown) { continue; }
 
-        const char *label = get_api_type_group(current->end_point);
+        // NOTE(marius): every account after the first one of a service has its name appended to the group: [lastfm:name]
+        char label[MAX_PROPERTY_LENGTH+1] = {0};
+        if (strlen(current->account) > 0) {
+            snprintf(label, MAX_PROPERTY_LENGTH, "%s%c%s", get_api_type_group(current->end_point), SERVICE_ACCOUNT_SEPARATOR, current->account);
+        } else {
+            snprintf(label, MAX_PROPERTY_LENGTH, "%s", get_api_type_group(current->end_point));
+        }
         struct ini_group *group = ini_group_new(label);
 
         struct ini_value *enabled = ini_value_new(CONFIG_KEY_ENABLED, current->enabled ? "true" : "false");
@@ -223,6 +236,26 @@ static void set_cache_path(const struct configuration *config)
     set_cache_file(config, CACHE_FILE_NAME);
 }
 
+static void set_dead_letter_path(const struct configuration *config)
+{
+    if (NULL == config) { return; }
+
+    const int wrote = snprintf((char*)config->dead_letter_path, FILE_PATH_MAX-3, TOKENIZED_CACHE_PATH, config->env.xdg_cache_home, config->name, DEAD_LETTER_FILE_NAME);
+    if (wrote == 0) {
+        _trace2("path::error: unable build dead letter path");
+    }
+}
+
+static void set_fingerprints_path(const struct configuration *config)
+{
+    if (NULL == config) { return; }
+
+    const int wrote = snprintf((char*)config->fingerprints_path, FILE_PATH_MAX-3, TOKENIZED_CACHE_PATH, config->env.xdg_cache_home, config->name, FINGERPRINTS_FILE_NAME);
+    if (wrote == 0) {
+        _trace2("path::error: unable build fingerprints path");
+    }
+}
+
 static void set_credentials_file(const struct configuration *config, const char *file_name)
 {
     if (NULL == config) { return; }
@@ -274,77 +307,57 @@ static int load_pid_path(const struct configuration *config)
     return snprintf((char*)config->pid_path, FILE_PATH_MAX-5, TOKENIZED_PID_PATH, config->env.xdg_runtime_dir, config->name, PID_SUFFIX);
 }
 
-static bool load_credentials_from_ini_group (struct ini_group *group, struct api_credentials *credentials)
+static void load_credentials_from_ini_group(const struct ini_view *group, struct api_credentials *credentials)
 {
-    if (NULL == credentials) { return false; }
-    if (NULL == group) { return false; }
-#if 0
-    _trace("api::loaded:%s", group->name);
-#endif
+    if (ini_view_has_prefix(group, SERVICE_LABEL_LASTFM)) {
+        credentials->end_point = api_lastfm;
+    } else if (ini_view_has_prefix(group, SERVICE_LABEL_LIBREFM)) {
+        credentials->end_point = api_librefm;
+    } else if (ini_view_has_prefix(group, SERVICE_LABEL_LISTENBRAINZ)) {
+        credentials->end_point = api_listenbrainz;
+    }
+    const char *account = memchr(group->data, SERVICE_ACCOUNT_SEPARATOR, group->len);
+    if (NULL != account) {
+        const struct ini_view name = { .data = account + 1, .len = group->len - (size_t)(account + 1 - group->data), };
+        ini_view_copy(&name, credentials->account, USER_NAME_MAX);
+    }
+}
 
-    if (strncmp(group->name->data, SERVICE_LABEL_LASTFM, strlen(SERVICE_LABEL_LASTFM)) == 0) {
-        (credentials)->end_point = api_lastfm;
-    } else if (strncmp(group->name->data, SERVICE_LABEL_LIBREFM, strlen(SERVICE_LABEL_LIBREFM)) == 0) {
-        (credentials)->end_point = api_librefm;
-    } else if (strncmp(group->name->data, SERVICE_LABEL_LISTENBRAINZ, strlen(SERVICE_LABEL_LISTENBRAINZ)) == 0) {
-        (credentials)->end_point = api_listenbrainz;
-    }
-    assert(group->values);
-
-    const size_t count = arrlen(group->values);
-    for (size_t i = 0; i < count; i++) {
-        const struct ini_value *setting = group->values[i];
-        if (NULL == setting) { continue; }
-
-        const string key = setting->key;
-        if (NULL == key) { continue; }
-
-        const string value = setting->value;
-        if (NULL == value) { continue; }
-
-        if (value->len == 0) { continue; }
-
-        if (strncmp(key->data, CONFIG_KEY_ENABLED, strlen(CONFIG_KEY_ENABLED)) == 0) {
-            if (strncmp(value->data, CONFIG_VALUE_TRUE, strlen(CONFIG_VALUE_TRUE)) == 0) {
-                (credentials)->enabled = true;
-            }
-            if (strncmp(value->data, CONFIG_VALUE_ONE, strlen(CONFIG_VALUE_ONE)) == 0) {
-                (credentials)->enabled = true;
-            }
-            // NOTE(marius): redundant, as false should be the default if nothing is present
-            if (strncmp(value->data, CONFIG_VALUE_FALSE, strlen(CONFIG_VALUE_FALSE)) == 0) {
-                (credentials)->enabled = false;
-            }
-            if (strncmp(value->data, CONFIG_VALUE_ZERO, strlen(CONFIG_VALUE_ZERO)) == 0) {
-                (credentials)->enabled = false;
-            }
-        }
-        if (strncmp(key->data, CONFIG_KEY_USER_NAME, strlen(CONFIG_KEY_USER_NAME)) == 0) {
-            strncpy((credentials)->user_name, value->data, value->len + 1);
-        }
-        if (strncmp(key->data, CONFIG_KEY_PASSWORD, strlen(CONFIG_KEY_PASSWORD)) == 0) {
-            strncpy((credentials)->password, value->data, value->len + 1);
-        }
-        if (strncmp(key->data, CONFIG_KEY_TOKEN, strlen(CONFIG_KEY_TOKEN)) == 0) {
-            strncpy((char*)(credentials)->token, value->data, value->len + 1);
+static void load_credentials_from_ini_value(const struct ini_view *key, const struct ini_view *value, struct api_credentials *credentials)
+{
+    if (ini_view_is(key, CONFIG_KEY_ENABLED)) {
+        if (ini_view_is(value, CONFIG_VALUE_TRUE) || ini_view_is(value, CONFIG_VALUE_ONE)) {
+            credentials->enabled = true;
         }
-        if (strncmp(key->data, CONFIG_KEY_SESSION, strlen(CONFIG_KEY_SESSION)) == 0) {
-            strncpy((char*)(credentials)->session_key, value->data, value->len + 1);
+        // NOTE(marius): redundant, as false should be the default if nothing is present
+        if (ini_view_is(value, CONFIG_VALUE_FALSE) || ini_view_is(value, CONFIG_VALUE_ZERO)) {
+            credentials->enabled = false;
         }
-        switch ((credentials)->end_point) {
-        case api_librefm:
-        case api_listenbrainz:
-            if (strncmp(key->data, CONFIG_KEY_URL, strlen(CONFIG_KEY_URL)) == 0) {
-                strncpy((char*)(credentials)->url, value->data, value->len + 1);
-            }
-            break;
-        case api_lastfm:
-        case api_unknown:
-        default:
-            break;
+    }
+    if (ini_view_is(key, CONFIG_KEY_USER_NAME)) {
+        ini_view_copy(value, credentials->user_name, USER_NAME_MAX);
+    }
+    if (ini_view_is(key, CONFIG_KEY_PASSWORD)) {
+        ini_view_copy(value, credentials->password, MAX_SECRET_LENGTH);
+    }
+    if (ini_view_is(key, CONFIG_KEY_TOKEN)) {
+        ini_view_copy(value, credentials->token, MAX_SECRET_LENGTH);
+    }
+    if (ini_view_is(key, CONFIG_KEY_SESSION)) {
+        ini_view_copy(value, credentials->session_key, MAX_SECRET_LENGTH);
+    }
+    switch (credentials->end_point) {
+    case api_librefm:
+    case api_listenbrainz:
+        if (ini_view_is(key, CONFIG_KEY_URL)) {
+            ini_view_copy(value, credentials->url, MAX_URL_LENGTH);
         }
+        break;
+    case api_lastfm:
+    case api_unknown:
+    default:
+        break;
     }
-    return true;
 }
 
 static bool write_pid(const char *path)
@@ -361,67 +374,85 @@ static bool write_pid(const char *path)
     return true;
 }
 
-static void load_ini_from_file(struct ini_config *ini, const char* path)
+static void load_config_from_ini(const struct ini_view *group, const struct ini_view *key, const struct ini_view *value, void *data)
 {
-    if (NULL == ini) { return; }
-    if (NULL == path) { return; }
-
-    FILE *file = fopen(path, "r");
-    if (NULL == file) { return; }
-
-
-    fseek(file, 0L, SEEK_END);
-    const long file_size = ftell(file);
+    struct configuration *config = data;
+    if (NULL == key) { return; }
+    if (!ini_view_is(group, DEFAULT_GROUP_NAME)) { return; }
 
-    if (file_size <= 0) { goto _exit; }
-    rewind (file);
-
-    char *buffer = get_zero_string((size_t)file_size);
-    if (NULL == buffer) { goto _exit; }
-    if (1 != fread(buffer, (size_t)file_size, 1, file)) {
-        _warn("config::error: unable to read file %s", path);
-        goto _failure;
+    if (ini_view_is(key, CONFIG_KEY_HTTP2)) {
+        config->http2 = ini_view_is(value, CONFIG_VALUE_TRUE) || ini_view_is(value, CONFIG_VALUE_ONE);
+        return;
     }
-
-    if (ini_parse(buffer, (size_t)file_size, ini) < 0) {
-        _error("config::error: failed to parse file %s", path);
+    if (ini_view_is(key, CONFIG_KEY_HTTP2_STREAMS)) {
+        char streams[MAX_PROPERTY_LENGTH+1] = {0};
+        ini_view_copy(value, streams, MAX_PROPERTY_LENGTH);
+        const long count = strtol(streams, NULL, 10);
+        if (count < 1 || count > HTTP2_MAX_STREAMS) {
+            _warn("config::invalid_http2_streams: %s, it needs to be between 1 and %ld", streams, HTTP2_MAX_STREAMS);
+            return;
+        }
+        config->http2_streams = count;
+        return;
     }
+    if (!ini_view_is(key, CONFIG_KEY_IGNORE)) { return; }
 
-_failure:
-    string_free(buffer);
-_exit:
-    fclose(file);
+    const short cnt = config->ignore_players_count;
+    if (cnt >= MAX_PLAYERS) {
+        _warn("config::too_many_ignored_players: only %d are supported", MAX_PLAYERS);
+        return;
+    }
+    ini_view_copy(value, (char*)config->ignore_players[cnt], MAX_PROPERTY_LENGTH);
+    _trace("config::ignore_player[%d]: %s", cnt, config->ignore_players[cnt]);
+    config->ignore_players_count++;
 }
 
 static bool load_config_from_file(struct configuration *config, const char* path)
 {
     if (NULL == config) { return false; }
     if (NULL == path) { return false; }
+    memset((char*)config->ignore_players, 0x0, sizeof(config->ignore_players));
     config->ignore_players_count = 0;
+    config->http2 = false;
+    config->http2_streams = HTTP2_DEFAULT_STREAMS;
 
-    struct ini_config ini = {0};
-    load_ini_from_file(&ini, path);
-    const size_t group_count = arrlen(ini.groups);
-    for (size_t i = 0; i < group_count; i++) {
-        const struct ini_group *group = ini.groups[i];
-        if (NULL == group->name) { continue; }
-        if (strncmp(group->name->data, DEFAULT_GROUP_NAME, group->name->len) != 0) {
-            break;
-        }
-        const size_t value_count = arrlen(group->values);
-        for (size_t j = 0; j < value_count; j++) {
-            const struct ini_value *val = group->values[j];
-            if (strncmp(val->key->data, CONFIG_KEY_IGNORE, val->key->len) != 0) {
-                break;
-            }
-            const short cnt = config->ignore_players_count;
-            _trace("config::ignore_player[%d]: %s", cnt, val->value->data);
-            memcpy((char*)config->ignore_players[cnt], val->value->data, val->value->len);
-            config->ignore_players_count++;
+    struct ini_file file = {0};
+    if (!ini_file_map(&file, path)) { return true; }
+
+    ini_parse_views(file.data, file.size, load_config_from_ini, config);
+    ini_file_unmap(&file);
+    return true;
+}
+
+struct credentials_loader {
+    struct configuration *config;
+    struct api_credentials *current;
+};
+
+/*
+ * Every group of the credentials file is loaded directly in the next free slot of the configuration,
+ * without building an intermediary ini_config.
+ */
+static void load_credentials_from_ini(const struct ini_view *group, const struct ini_view *key, const struct ini_view *value, void *data)
+{
+    struct credentials_loader *loader = data;
+    struct configuration *config = loader->config;
+
+    if (NULL == key) {
+        loader->current = NULL;
+        if (config->credentials_count >= MAX_CREDENTIALS) {
+            _warn("ini::too_many_credentials[%.*s]: only %d are supported", (int)group->len, group->data, MAX_CREDENTIALS);
+            return;
         }
+        // NOTE(marius): the pointer is valid only until the next group is appended to the array
+        arrput(config->credentials, (struct api_credentials){0});
+        loader->current = &arrlast(config->credentials);
+        load_credentials_from_ini_group(group, loader->current);
+        config->credentials_count = arrlenu(config->credentials);
+        return;
     }
-    ini_config_clean(&ini);
-    return true;
+    if (NULL == loader->current) { return; }
+    load_credentials_from_ini_value(key, value, loader->current);
 }
 
 static bool load_credentials_from_file(struct configuration *config, const char* path)
@@ -429,23 +460,12 @@ static bool load_credentials_from_file(struct configuration *config, const char*
     if (NULL == config) { return false; }
     if (NULL == path) { return false; }
 
-    struct ini_config ini = {0};
-    load_ini_from_file(&ini, path);
-    const size_t count = arrlen(ini.groups);
-    assert(count < MAX_CREDENTIALS);
+    struct ini_file file = {0};
+    if (!ini_file_map(&file, path)) { return true; }
 
-    for (size_t i = 0; i < count; i++) {
-        struct ini_group *group = ini.groups[i];
-        struct api_credentials *creds = &config->credentials[i];
-
-        if (!load_credentials_from_ini_group(group, creds)) {
-            _warn("ini::invalid_config[%s]: not loading values", group->name->data);
-            memset(creds, 0x0, sizeof(struct api_credentials));
-        } else {
-            config->credentials_count++;
-        }
-    }
-    ini_config_clean(&ini);
+    struct credentials_loader loader = { .config = config, .current = NULL, };
+    ini_parse_views(file.data, file.size, load_credentials_from_ini, &loader);
+    ini_file_unmap(&file);
     return true;
 }
 
@@ -463,7 +483,7 @@ static void load_credentials (struct configuration *config)
 {
     set_credentials_path(config);
 
-    memset(config->credentials, 0x0, sizeof(config->credentials));
+    arrfree(config->credentials);
     config->credentials_count = 0;
 
     // Load
@@ -497,7 +517,8 @@ static void configuration_clean(struct configuration *config)
     if (NULL == config) { return; }
     const size_t count = config->credentials_count;
     _trace2("mem::free::configuration(%u)", count);
-    memset(&config->credentials, 0x0, sizeof(config->credentials));
+    arrfree(config->credentials);
+    config->credentials_count = 0;
     if (config->wrote_pid) {
         _trace("main::cleanup_pid: %s", config->pid_path);
         cleanup_pid(config->pid_path);
@@ -556,6 +577,8 @@ bool load_configuration(struct configuration *config, const char *name)
     set_config_path(config);
     set_credentials_path(config);
     set_cache_path(config);
+    set_dead_letter_path(config);
+    set_fingerprints_path(config);
 
     load_config(config);
 
@@ -53,6 +53,9 @@ static bool connection_should_retry(const struct scrobbler_connection *conn)
 #endif
 
 static bool connection_was_fulfilled(const struct scrobbler_connection *);
+static void scrobbler_connection_acknowledge(struct scrobbler *, struct scrobbler_connection *);
+static void scrobbler_connection_done(struct scrobbler *, struct scrobbler_connection *);
+static void scrobbler_schedule(struct scrobbler *);
 /*
  * Based on https://curl.se/libcurl/c/hiperfifo.html
  * Check for completed transfers, and remove their easy handles
@@ -80,6 +83,9 @@ static void check_multi_info(struct scrobbler *s)
         curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
 
         assert(conn);
+        long connects = 0;
+        curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+        s->scheduler.stats[conn->priority].connects += (unsigned)connects;
 
         if (strlen(conn->error) != 0) {
             _warn("curl::transfer::done[%zd]: %s => (%d) %s", conn->idx, eff_url, res, conn->error);
@@ -92,6 +98,8 @@ static void check_multi_info(struct scrobbler *s)
 
         const bool success = conn->response.code == 200;
         _info(" api::submitted_to[%s]: %s", get_api_type_label(conn->credentials.end_point), (success ? "ok" : "nok"));
+        scrobbler_connection_done(s, conn);
+        scrobbler_connection_acknowledge(s, conn);
         if(evtimer_pending(&s->timer_event, NULL)) {
             _trace2("curl::multi_timer_remove(%p)", &s->timer_event);
             evtimer_del(&s->timer_event);
@@ -155,6 +163,7 @@ static void timer_cb(int fd, short kind, void *data)
     check_multi_info(s);
 
     scrobbler_connections_clean(&s->connections, false);
+    scrobbler_schedule(s);
 }
 
 /* Called by libevent when we get action on a multi socket */
@@ -178,6 +187,7 @@ static void event_cb(int fd, short kind, void *data)
     check_multi_info(s);
 
     scrobbler_connections_clean(&s->connections, false);
+    scrobbler_schedule(s);
 }
 
 /*
@@ -411,6 +421,13 @@ static void build_curl_request(struct scrobbler_connection *conn)
     curl_easy_setopt(handle, CURLOPT_PRIVATE, conn);
     curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, conn->error);
     curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, MAX_WAIT_SECONDS * 1000L);
+    if (NULL != conn->parent && NULL != conn->parent->conf && conn->parent->conf->http2) {
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        // NOTE(marius): prefer waiting for a connection that can be multiplexed over opening a new one
+        curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    } else {
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+    }
 
     curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(handle, CURLOPT_CURLU, req->url);
@@ -428,6 +445,8 @@ static void build_curl_request(struct scrobbler_connection *conn)
         }
         curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
         arrput(*req_headers, headers);
+    } else if (NULL != req->shared_headers) {
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, req->shared_headers);
     }
 
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, http_response_write_body);
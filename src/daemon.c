@@ -13,6 +13,11 @@
 #endif
 #define STB_DS_IMPLEMENTATION
 #include "stb_ds.h"
+#include "timer_wheel.h"
+#include "arena.h"
+#include "hash.h"
+#include "fingerprint.h"
+#include "playback.h"
 #include "sstrings.h"
 #include "structs.h"
 #include "utils.h"
@@ -0,0 +1,396 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_DEADLETTER_H
+#define MPRIS_SCROBBLER_DEADLETTER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The dead letter store keeps the scrobbles that we gave up on, so they can be fixed and resubmitted later.
+ *
+ * The data file contains one tab separated record per line, and the index file next to it contains the
+ * offset of every record as an uint64_t. The position of a record in the index is its id, which allows
+ * reading and updating a record without scanning the whole file.
+ *
+ * The first byte of each record is its state and is updated in place. Fixing the metadata of a record
+ * marks it as superseded and appends a new record with the changes, so records are never rewritten.
+ */
+
+#define DEAD_LETTER_INDEX_SUFFIX    ".idx"
+#define DEAD_LETTER_MAX_LINE        (MAX_BODY_SIZE+1)
+#define DEAD_LETTER_FIELD_COUNT     18
+#define DEAD_LETTER_MIN_FIELD_COUNT 17
+
+#define DEAD_LETTER_STATE_PENDING       'P'
+#define DEAD_LETTER_STATE_RESUBMITTED   'S'
+#define DEAD_LETTER_STATE_SUPERSEDED    'X'
+#define DEAD_LETTER_STATE_REMOVED       'D'
+
+static const char *get_dead_letter_reason_label(const enum dead_letter_reason reason)
+{
+    switch (reason) {
+        case dead_letter_invalid:
+            return "invalid";
+        case dead_letter_ignored:
+            return "ignored";
+        case dead_letter_rejected:
+            return "rejected";
+        case dead_letter_evicted:
+            return "evicted";
+        default:
+            return "unknown";
+    }
+}
+
+static const char *get_dead_letter_state_label(const char state)
+{
+    switch (state) {
+        case DEAD_LETTER_STATE_PENDING:
+            return "pending";
+        case DEAD_LETTER_STATE_RESUBMITTED:
+            return "resubmitted";
+        case DEAD_LETTER_STATE_SUPERSEDED:
+            return "superseded";
+        case DEAD_LETTER_STATE_REMOVED:
+            return "removed";
+        default:
+            return "unknown";
+    }
+}
+
+static void dead_letter_index_path(char *result, const char *path)
+{
+    snprintf(result, FILE_PATH_MAX+1, "%s" DEAD_LETTER_INDEX_SUFFIX, path);
+}
+
+static void dead_letter_write_field(FILE *file, const char *value)
+{
+    fputc('\t', file);
+    for (const char *c = value; *c != '\0'; c++) {
+        switch (*c) {
+            case '\\':
+                fputs("\\\\", file);
+                break;
+            case '\t':
+                fputs("\\t", file);
+                break;
+            case '\n':
+                fputs("\\n", file);
+                break;
+            case '\r':
+                fputs("\\r", file);
+                break;
+            default:
+                fputc(*c, file);
+        }
+    }
+}
+
+static void dead_letter_unescape_field(char *value)
+{
+    char *out = value;
+    for (const char *c = value; *c != '\0'; c++) {
+        if (*c != '\\' || c[1] == '\0') {
+            *out++ = *c;
+            continue;
+        }
+        c++;
+        switch (*c) {
+            case 't':
+                *out++ = '\t';
+                break;
+            case 'n':
+                *out++ = '\n';
+                break;
+            case 'r':
+                *out++ = '\r';
+                break;
+            default:
+                *out++ = *c;
+        }
+    }
+    *out = '\0';
+}
+
+static size_t scrobble_join_artists(char*, const struct scrobble*);
+
+static bool dead_letter_write(FILE *file, const struct dead_letter *letter)
+{
+    const struct scrobble *track = &letter->scrobble;
+    char full_artist[MAX_FULL_ARTIST_LENGTH];
+    scrobble_join_artists(full_artist, track);
+
+    fprintf(file, "%c\t%d\t%d\t%d\t%lld\t%lld\t%.3f\t%u", letter->state, (int)letter->end_point, (int)letter->reason,
+        letter->code, (long long)letter->rejected_at, (long long)track->start_time, track->length, (unsigned)track->track_number);
+    dead_letter_write_field(file, full_artist);
+    dead_letter_write_field(file, track->title);
+    dead_letter_write_field(file, track->album);
+    dead_letter_write_field(file, track->mb_track_id[0]);
+    dead_letter_write_field(file, track->mb_artist_id[0]);
+    dead_letter_write_field(file, track->mb_album_id[0]);
+    dead_letter_write_field(file, track->mb_spotify_id);
+    dead_letter_write_field(file, track->url);
+    dead_letter_write_field(file, track->player_name);
+    dead_letter_write_field(file, letter->account);
+    return fputc('\n', file) != EOF;
+}
+
+static bool dead_letter_parse(char *line, struct dead_letter *letter)
+{
+    char *fields[DEAD_LETTER_FIELD_COUNT] = {0};
+    size_t count = 0;
+
+    char *end = strchr(line, '\n');
+    if (NULL != end) { *end = '\0'; }
+
+    char *cur = line;
+    while (count < DEAD_LETTER_FIELD_COUNT) {
+        fields[count++] = cur;
+        char *tab = strchr(cur, '\t');
+        if (NULL == tab) { break; }
+        *tab = '\0';
+        cur = tab + 1;
+    }
+    // NOTE(marius): the account column was added later, so it's optional
+    if (count < DEAD_LETTER_MIN_FIELD_COUNT) { return false; }
+
+    for (size_t i = 0; i < count; i++) {
+        dead_letter_unescape_field(fields[i]);
+    }
+
+    struct scrobble *track = &letter->scrobble;
+    memset(track, 0x0, sizeof(*track));
+    letter->state = fields[0][0];
+    letter->end_point = (enum api_type)strtol(fields[1], NULL, 10);
+    letter->reason = (enum dead_letter_reason)strtol(fields[2], NULL, 10);
+    letter->code = (int)strtol(fields[3], NULL, 10);
+    letter->rejected_at = (time_t)strtoll(fields[4], NULL, 10);
+    track->start_time = (time_t)strtoll(fields[5], NULL, 10);
+    track->length = strtod(fields[6], NULL);
+    track->track_number = (unsigned short)strtoul(fields[7], NULL, 10);
+    strncpy(track->artist[0], fields[8], MAX_PROPERTY_LENGTH);
+    strncpy(track->title, fields[9], MAX_PROPERTY_LENGTH);
+    strncpy(track->album, fields[10], MAX_PROPERTY_LENGTH);
+    strncpy(track->mb_track_id[0], fields[11], MAX_PROPERTY_LENGTH);
+    strncpy(track->mb_artist_id[0], fields[12], MAX_PROPERTY_LENGTH);
+    strncpy(track->mb_album_id[0], fields[13], MAX_PROPERTY_LENGTH);
+    strncpy(track->mb_spotify_id, fields[14], MAX_PROPERTY_LENGTH);
+    strncpy(track->url, fields[15], MAX_PROPERTY_LENGTH);
+    strncpy(track->player_name, fields[16], MAX_PROPERTY_LENGTH);
+    memset(letter->account, 0x0, sizeof(letter->account));
+    if (count > DEAD_LETTER_MIN_FIELD_COUNT) {
+        strncpy(letter->account, fields[17], USER_NAME_MAX);
+    }
+    // NOTE(marius): the listen already happened, so the play time is the full track
+    track->play_time = track->length;
+
+    return true;
+}
+
+bool configuration_folder_create(const char *);
+bool configuration_folder_exists(const char *);
+static size_t dead_letter_append(const char *path, const struct dead_letter *letter)
+{
+    size_t id = 0;
+    if (NULL == path || strlen(path) == 0) { return id; }
+
+    char folder_path[FILE_PATH_MAX+1] = {0};
+    memcpy(folder_path, path, min(FILE_PATH_MAX, strlen(path)));
+    const char *folder = dirname(folder_path);
+    if (!configuration_folder_exists(folder) && !configuration_folder_create(folder)) {
+        _error("dead_letter::append: unable to create cache folder %s", folder);
+        return id;
+    }
+
+    char index_path[FILE_PATH_MAX+1] = {0};
+    dead_letter_index_path(index_path, path);
+
+    FILE *file = fopen(path, "a");
+    if (NULL == file) {
+        _warn("dead_letter::append: unable to open %s", path);
+        return id;
+    }
+    FILE *index = fopen(index_path, "a");
+    if (NULL == index) {
+        _warn("dead_letter::append: unable to open %s", index_path);
+        fclose(file);
+        return id;
+    }
+
+    fseek(file, 0, SEEK_END);
+    fseek(index, 0, SEEK_END);
+    const uint64_t offset = (uint64_t)ftell(file);
+    const long index_size = ftell(index);
+    if (dead_letter_write(file, letter) && fwrite(&offset, sizeof(offset), 1, index) == 1) {
+        id = (size_t)index_size / sizeof(offset) + 1;
+    }
+
+    fclose(index);
+    fclose(file);
+    return id;
+}
+
+static size_t dead_letter_count(const char *path)
+{
+    char index_path[FILE_PATH_MAX+1] = {0};
+    dead_letter_index_path(index_path, path);
+
+    FILE *index = fopen(index_path, "r");
+    if (NULL == index) { return 0; }
+    fseek(index, 0, SEEK_END);
+    const long size = ftell(index);
+    fclose(index);
+
+    return size > 0 ? (size_t)size / sizeof(uint64_t) : 0;
+}
+
+static bool dead_letter_offset(const char *path, const size_t id, long *offset)
+{
+    if (id == 0) { return false; }
+
+    char index_path[FILE_PATH_MAX+1] = {0};
+    dead_letter_index_path(index_path, path);
+
+    FILE *index = fopen(index_path, "r");
+    if (NULL == index) { return false; }
+
+    uint64_t value = 0;
+    const bool status = fseek(index, (long)((id - 1) * sizeof(value)), SEEK_SET) == 0 && fread(&value, sizeof(value), 1, index) == 1;
+    fclose(index);
+
+    *offset = (long)value;
+    return status;
+}
+
+static bool dead_letter_read(const char *path, const size_t id, struct dead_letter *letter)
+{
+    long offset = 0;
+    if (!dead_letter_offset(path, id, &offset)) { return false; }
+
+    FILE *file = fopen(path, "r");
+    if (NULL == file) { return false; }
+
+    bool status = false;
+    char *line = calloc(1, DEAD_LETTER_MAX_LINE);
+    if (fseek(file, offset, SEEK_SET) == 0 && NULL != fgets(line, DEAD_LETTER_MAX_LINE, file)) {
+        status = dead_letter_parse(line, letter);
+        letter->id = id;
+    }
+    free(line);
+    fclose(file);
+    return status;
+}
+
+static bool dead_letter_set_state(const char *path, const size_t id, const char state)
+{
+    long offset = 0;
+    if (!dead_letter_offset(path, id, &offset)) { return false; }
+
+    FILE *file = fopen(path, "r+");
+    if (NULL == file) { return false; }
+
+    const bool status = fseek(file, offset, SEEK_SET) == 0 && fputc(state, file) != EOF;
+    fclose(file);
+    return status;
+}
+
+/*
+ * Reads the record following the current position of file, the caller is responsible for keeping
+ * letter->id in sync with the lines that were read, starting from 0.
+ */
+static bool dead_letter_next(FILE *file, char *line, struct dead_letter *letter)
+{
+    while (NULL != fgets(line, DEAD_LETTER_MAX_LINE, file)) {
+        letter->id++;
+        if (dead_letter_parse(line, letter)) {
+            return true;
+        }
+        _warn("dead_letter::read[%zu]: invalid record", letter->id);
+    }
+    return false;
+}
+
+/*
+ * The index is written after the data, so a crash in between leaves it short. In that case, or if it
+ * was lost, we rebuild it from the data file.
+ */
+static bool dead_letter_index_check(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (NULL == file) { return true; }
+
+    uint64_t *offsets = NULL;
+    char *line = calloc(1, DEAD_LETTER_MAX_LINE);
+    long offset = 0;
+    while (NULL != fgets(line, DEAD_LETTER_MAX_LINE, file)) {
+        // NOTE(marius): lines longer than the buffer are read in multiple chunks
+        if (NULL != strchr(line, '\n')) {
+            arrput(offsets, (uint64_t)offset);
+            offset = ftell(file);
+        }
+    }
+    free(line);
+    fclose(file);
+
+    bool status = true;
+    const size_t count = (size_t)arrlen(offsets);
+    if (count != dead_letter_count(path)) {
+        char index_path[FILE_PATH_MAX+1] = {0};
+        dead_letter_index_path(index_path, path);
+
+        _info("dead_letter::index_rebuild: %zu records", count);
+        FILE *index = fopen(index_path, "w");
+        if (NULL == index) {
+            _error("dead_letter::index_rebuild: unable to open %s", index_path);
+            status = false;
+            goto _exit;
+        }
+        status = count == 0 || fwrite(offsets, sizeof(uint64_t), count, index) == count;
+        fclose(index);
+    }
+
+_exit:
+    arrfree(offsets);
+    return status;
+}
+
+static bool dead_letter_key_is(const char *field, const size_t key_len, const char *key)
+{
+    return key_len == strlen(key) && strncmp(field, key, key_len) == 0;
+}
+
+static bool dead_letter_set_field(struct dead_letter *letter, const char *field)
+{
+    struct scrobble *track = &letter->scrobble;
+
+    const char *value = strchr(field, '=');
+    if (NULL == value) { return false; }
+    const size_t key_len = (size_t)(value - field);
+    value++;
+
+    if (dead_letter_key_is(field, key_len, "artist")) {
+        memset(track->artist, 0x0, sizeof(track->artist));
+        strncpy(track->artist[0], value, MAX_PROPERTY_LENGTH);
+    } else if (dead_letter_key_is(field, key_len, "title")) {
+        memset(track->title, 0x0, sizeof(track->title));
+        strncpy(track->title, value, MAX_PROPERTY_LENGTH);
+    } else if (dead_letter_key_is(field, key_len, "album")) {
+        memset(track->album, 0x0, sizeof(track->album));
+        strncpy(track->album, value, MAX_PROPERTY_LENGTH);
+    } else if (dead_letter_key_is(field, key_len, "mbid")) {
+        memset(track->mb_track_id[0], 0x0, sizeof(track->mb_track_id[0]));
+        strncpy(track->mb_track_id[0], value, MAX_PROPERTY_LENGTH);
+    } else if (dead_letter_key_is(field, key_len, "length")) {
+        track->length = strtod(value, NULL);
+        track->play_time = track->length;
+    } else if (dead_letter_key_is(field, key_len, "timestamp")) {
+        track->start_time = (time_t)strtoll(value, NULL, 10);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif // MPRIS_SCROBBLER_DEADLETTER_H
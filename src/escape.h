@@ -0,0 +1,287 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_ESCAPE_H
+#define MPRIS_SCROBBLER_ESCAPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Percent encoding (RFC 3986) and JSON string escaping.
+ *
+ * Most of the values we escape are titles and names that need few changes, if any, so the work is in
+ * finding the next character to escape. The *_clean_run functions return how many bytes from the start of
+ * the string can be copied as they are, and on x86 they check 16 (SSE2) or 32 (AVX2) bytes at a time.
+ * The implementation is picked on the first call, based on what the CPU supports.
+ */
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ESCAPE_X86 1
+#include <immintrin.h>
+#endif
+
+#define ESCAPE_URL_MAX_LENGTH(len)  (3 * (len) + 1)
+#define ESCAPE_JSON_MAX_LENGTH(len) (6 * (len) + 1)
+
+typedef size_t (*escape_scan_fn)(const char*, size_t);
+
+static inline bool escape_url_is_clean(const unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+        c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static inline bool escape_json_is_clean(const unsigned char c)
+{
+    return c >= ' ' && c != '"' && c != '\\' && c != '/';
+}
+
+static size_t escape_url_clean_run_scalar(const char *str, const size_t len)
+{
+    size_t i = 0;
+    while (i < len && escape_url_is_clean((unsigned char)str[i])) { i++; }
+    return i;
+}
+
+static size_t escape_json_clean_run_scalar(const char *str, const size_t len)
+{
+    size_t i = 0;
+    while (i < len && escape_json_is_clean((unsigned char)str[i])) { i++; }
+    return i;
+}
+
+#ifdef ESCAPE_X86
+/*
+ * The comparisons are signed, so the bytes over 0x7f are negative and fall outside all the ranges.
+ * The letters are matched case insensitive by setting the 0x20 bit, which doesn't bring any other
+ * character in the a-z range. The '-', '.' and digits are matched as the '-'..'9' range, without '/'.
+ */
+__attribute__((target("sse2")))
+static inline __m128i escape_url_clean_mask_sse2(const __m128i c)
+{
+    const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+    const __m128i digit = _mm_andnot_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('/')),
+        _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('-' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c)));
+    const __m128i other = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('_')), _mm_cmpeq_epi8(c, _mm_set1_epi8('~')));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), other);
+}
+
+// NOTE(marius): the control characters are the ones that don't change with max(c, 0x1f), unsigned
+__attribute__((target("sse2")))
+static inline __m128i escape_json_dirty_mask_sse2(const __m128i c)
+{
+    const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(c, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+    const __m128i quote = _mm_cmpeq_epi8(c, _mm_set1_epi8('"'));
+    const __m128i backslash = _mm_cmpeq_epi8(c, _mm_set1_epi8('\\'));
+    const __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+    return _mm_or_si128(_mm_or_si128(control, quote), _mm_or_si128(backslash, slash));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i escape_url_clean_mask_avx2(const __m256i c)
+{
+    const __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    const __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    const __m256i digit = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('/')),
+        _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('-' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c)));
+    const __m256i other = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('~')));
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), other);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i escape_json_dirty_mask_avx2(const __m256i c)
+{
+    const __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(c, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+    const __m256i quote = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('"'));
+    const __m256i backslash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\\'));
+    const __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+    return _mm256_or_si256(_mm256_or_si256(control, quote), _mm256_or_si256(backslash, slash));
+}
+
+__attribute__((target("sse2")))
+static size_t escape_url_clean_run_sse2(const char *str, const size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(str + i));
+        const unsigned clean = (unsigned)_mm_movemask_epi8(escape_url_clean_mask_sse2(c));
+        if (clean != 0xffff) {
+            return i + (size_t)__builtin_ctz(~clean);
+        }
+    }
+    return i + escape_url_clean_run_scalar(str + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t escape_json_clean_run_sse2(const char *str, const size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(str + i));
+        const unsigned dirty = (unsigned)_mm_movemask_epi8(escape_json_dirty_mask_sse2(c));
+        if (dirty != 0) {
+            return i + (size_t)__builtin_ctz(dirty);
+        }
+    }
+    return i + escape_json_clean_run_scalar(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t escape_url_clean_run_avx2(const char *str, const size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(str + i));
+        const uint32_t clean = (uint32_t)_mm256_movemask_epi8(escape_url_clean_mask_avx2(c));
+        if (clean != 0xffffffff) {
+            return i + (size_t)__builtin_ctz(~clean);
+        }
+    }
+    // NOTE(marius): mixing VEX and legacy SSE code is slow, so the upper halves of the registers are cleared
+    //  before going back to it, and the tail isn't left to the SSE2 function
+    _mm256_zeroupper();
+    if (i + 16 <= len) {
+        const unsigned clean = (unsigned)_mm_movemask_epi8(escape_url_clean_mask_sse2(_mm_loadu_si128((const __m128i*)(str + i))));
+        if (clean != 0xffff) {
+            return i + (size_t)__builtin_ctz(~clean);
+        }
+        i += 16;
+    }
+    return i + escape_url_clean_run_scalar(str + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t escape_json_clean_run_avx2(const char *str, const size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(str + i));
+        const uint32_t dirty = (uint32_t)_mm256_movemask_epi8(escape_json_dirty_mask_avx2(c));
+        if (dirty != 0) {
+            return i + (size_t)__builtin_ctz(dirty);
+        }
+    }
+    _mm256_zeroupper();
+    if (i + 16 <= len) {
+        const unsigned dirty = (unsigned)_mm_movemask_epi8(escape_json_dirty_mask_sse2(_mm_loadu_si128((const __m128i*)(str + i))));
+        if (dirty != 0) {
+            return i + (size_t)__builtin_ctz(dirty);
+        }
+        i += 16;
+    }
+    return i + escape_json_clean_run_scalar(str + i, len - i);
+}
+#endif // ESCAPE_X86
+
+static escape_scan_fn escape_url_scan = NULL;
+static escape_scan_fn escape_json_scan = NULL;
+
+static const char *escape_select(void)
+{
+    escape_url_scan = escape_url_clean_run_scalar;
+    escape_json_scan = escape_json_clean_run_scalar;
+#ifdef ESCAPE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        escape_url_scan = escape_url_clean_run_avx2;
+        escape_json_scan = escape_json_clean_run_avx2;
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        escape_url_scan = escape_url_clean_run_sse2;
+        escape_json_scan = escape_json_clean_run_sse2;
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+static inline size_t escape_url_clean_run(const char *str, const size_t len)
+{
+    if (NULL == escape_url_scan) { escape_select(); }
+    return escape_url_scan(str, len);
+}
+
+static inline size_t escape_json_clean_run(const char *str, const size_t len)
+{
+    if (NULL == escape_json_scan) { escape_select(); }
+    return escape_json_scan(str, len);
+}
+
+/*
+ * Percent encodes src into dest, which needs to hold ESCAPE_URL_MAX_LENGTH(len) bytes.
+ * Returns the length of the result, without the terminating zero.
+ */
+static size_t escape_url(char *dest, const char *src, const size_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    size_t pos = 0;
+    size_t i = 0;
+    while (i < len) {
+        const size_t run = escape_url_clean_run(src + i, len - i);
+        memcpy(dest + pos, src + i, run);
+        pos += run;
+        i += run;
+        if (i == len) { break; }
+
+        const unsigned char c = (unsigned char)src[i++];
+        dest[pos++] = '%';
+        dest[pos++] = hex[c >> 4];
+        dest[pos++] = hex[c & 0x0f];
+    }
+    dest[pos] = '\0';
+    return pos;
+}
+
+/*
+ * Writes the JSON escape sequence for c, that the *_clean_run functions stopped at, in dest.
+ * Returns its length.
+ */
+static size_t escape_json_char(char *dest, const unsigned char c)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    switch (c) {
+        case '\b': memcpy(dest, "\\b", 2); return 2;
+        case '\n': memcpy(dest, "\\n", 2); return 2;
+        case '\r': memcpy(dest, "\\r", 2); return 2;
+        case '\t': memcpy(dest, "\\t", 2); return 2;
+        case '\f': memcpy(dest, "\\f", 2); return 2;
+        case '"':  memcpy(dest, "\\\"", 2); return 2;
+        case '\\': memcpy(dest, "\\\\", 2); return 2;
+        case '/':  memcpy(dest, "\\/", 2); return 2;
+        default:
+            memcpy(dest, "\\u00", 4);
+            dest[4] = hex[c >> 4];
+            dest[5] = hex[c & 0x0f];
+            return 6;
+    }
+}
+
+/*
+ * Escapes src as the contents of a JSON string into dest, which needs to hold ESCAPE_JSON_MAX_LENGTH(len)
+ * bytes. Returns the length of the result, without the terminating zero.
+ */
+static size_t escape_json(char *dest, const char *src, const size_t len)
+{
+    size_t pos = 0;
+    size_t i = 0;
+    while (i < len) {
+        const size_t run = escape_json_clean_run(src + i, len - i);
+        memcpy(dest + pos, src + i, run);
+        pos += run;
+        i += run;
+        if (i == len) { break; }
+
+        pos += escape_json_char(dest + pos, (unsigned char)src[i++]);
+    }
+    dest[pos] = '\0';
+    return pos;
+}
+
+#endif // MPRIS_SCROBBLER_ESCAPE_H
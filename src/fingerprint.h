@@ -0,0 +1,315 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_FINGERPRINT_H
+#define MPRIS_SCROBBLER_FINGERPRINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+
+/*
+ * Fingerprints of the tracks we announced or scrobbled recently, to catch the same listen reported by two
+ * players (a browser and its MPRIS bridge), or again after a restart.
+ *
+ * A fingerprint is the hash of the normalised artists, title and album, and the entry keeps the start time
+ * of the last listen of the track and the player that announced it. The start times reported for the same
+ * listen differ by a few seconds, so they match when they are at most FINGERPRINT_MATCH_WINDOW seconds
+ * apart, or half the length of the track for the short ones, which can't be played again that soon.
+ *
+ * The cache keeps the last FINGERPRINT_CACHE_SIZE fingerprints: the entries are in a fixed array linked
+ * from the most to the least recently used one, and they're found through an open addressing table with
+ * linear probing, so the lookups, the inserts and the evictions don't depend on how full the cache is.
+ */
+
+#define FINGERPRINT_CACHE_SIZE      256
+#define FINGERPRINT_CACHE_SLOTS     512 // a power of two, the table is kept at most half full
+#define FINGERPRINT_MATCH_WINDOW    60  // seconds
+#define FINGERPRINT_NONE            UINT16_MAX
+#define FINGERPRINT_MAX_VALUE       384 // bytes of a value that are taken into account
+#define FINGERPRINT_ANY_OWNER       0   // the lookups that match the listens of all the players
+
+enum fingerprint_flags {
+    fingerprint_now_playing = 1U << 0U,
+    fingerprint_scrobbled = 1U << 1U,
+};
+
+struct fingerprint_entry {
+    uint64_t fingerprint;
+    uint64_t owner; // the hash of the name of the player that announced the listen, 0 when none did
+    int64_t start_time;
+    uint16_t prev; // the more recently used neighbour
+    uint16_t next; // the less recently used neighbour
+    uint8_t flags;
+};
+
+struct fingerprint_cache {
+    struct fingerprint_entry entries[FINGERPRINT_CACHE_SIZE];
+    uint16_t slots[FINGERPRINT_CACHE_SLOTS]; // the index of the entry + 1, 0 for the empty slots
+    uint16_t head; // the most recently used entry
+    uint16_t tail; // the least recently used entry, the first to be evicted
+    uint16_t count;
+};
+
+// NOTE(marius): the records written to the cache file, from the least to the most recently used
+struct fingerprint_record {
+    uint64_t fingerprint;
+    uint64_t owner;
+    int64_t start_time;
+    uint8_t flags;
+};
+
+static void fingerprint_cache_init(struct fingerprint_cache *cache)
+{
+    memset(cache, 0x0, sizeof(*cache));
+    cache->head = FINGERPRINT_NONE;
+    cache->tail = FINGERPRINT_NONE;
+}
+
+/*
+ * Hashes a value lowercased, with the runs of whitespace collapsed and trimmed, so "The  Beatles " and
+ * "the beatles" have the same fingerprint.
+ */
+static uint64_t fingerprint_add_value(const uint64_t hash, const char *value)
+{
+    char normalised[FINGERPRINT_MAX_VALUE];
+    size_t len = 0;
+    bool space = false;
+    for (size_t i = 0; i < FINGERPRINT_MAX_VALUE && value[i] != '\0'; i++) {
+        const unsigned char c = (unsigned char)value[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            space = len > 0;
+            continue;
+        }
+        if (space) {
+            if (len == FINGERPRINT_MAX_VALUE) { break; }
+            normalised[len++] = ' ';
+            space = false;
+        }
+        if (len == FINGERPRINT_MAX_VALUE) { break; }
+        normalised[len++] = (char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+    }
+    return hash_bytes(hash, normalised, len);
+}
+
+/*
+ * The fingerprint of the hash of the values, 0 is reserved for the empty entries.
+ */
+static inline uint64_t fingerprint_for_values(const uint64_t values_hash)
+{
+    return values_hash != 0 ? values_hash : 1;
+}
+
+static uint64_t fingerprint_owner(const char *player_name)
+{
+    return hash_string(player_name, strlen(player_name));
+}
+
+/*
+ * How far apart the start times of the same listen can be, a track played again starts at least its
+ * length after the previous listen.
+ */
+static int64_t fingerprint_window(const double length)
+{
+    if (length > 0 && length / 2 < FINGERPRINT_MATCH_WINDOW) {
+        return (int64_t)(length / 2);
+    }
+    return FINGERPRINT_MATCH_WINDOW;
+}
+
+static bool fingerprint_same_listen(const struct fingerprint_entry *entry, const time_t start_time, const double length)
+{
+    return llabs(entry->start_time - (int64_t)start_time) <= fingerprint_window(length);
+}
+
+static inline uint16_t fingerprint_home_slot(const uint64_t fingerprint)
+{
+    return (uint16_t)(fingerprint & (FINGERPRINT_CACHE_SLOTS - 1));
+}
+
+/*
+ * The slot that holds the fingerprint, or the empty one where it would be inserted.
+ */
+static uint16_t fingerprint_cache_slot(const struct fingerprint_cache *cache, const uint64_t fingerprint)
+{
+    uint16_t slot = fingerprint_home_slot(fingerprint);
+    while (cache->slots[slot] != 0) {
+        if (cache->entries[cache->slots[slot] - 1].fingerprint == fingerprint) { break; }
+        slot = (slot + 1) & (FINGERPRINT_CACHE_SLOTS - 1);
+    }
+    return slot;
+}
+
+/*
+ * Empties a slot, and moves back the entries that were probed past it, so the lookups don't stop early.
+ */
+static void fingerprint_cache_slot_remove(struct fingerprint_cache *cache, uint16_t slot)
+{
+    uint16_t next = slot;
+    while (true) {
+        next = (next + 1) & (FINGERPRINT_CACHE_SLOTS - 1);
+        if (cache->slots[next] == 0) { break; }
+
+        const uint16_t home = fingerprint_home_slot(cache->entries[cache->slots[next] - 1].fingerprint);
+        // NOTE(marius): the entry can move to the empty slot if it's not between its home and its position
+        const bool movable = (slot <= next) ? (home <= slot || home > next) : (home <= slot && home > next);
+        if (movable) {
+            cache->slots[slot] = cache->slots[next];
+            slot = next;
+        }
+    }
+    cache->slots[slot] = 0;
+}
+
+static void fingerprint_cache_unlink(struct fingerprint_cache *cache, const uint16_t idx)
+{
+    struct fingerprint_entry *entry = &cache->entries[idx];
+    if (entry->prev != FINGERPRINT_NONE) {
+        cache->entries[entry->prev].next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != FINGERPRINT_NONE) {
+        cache->entries[entry->next].prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+static void fingerprint_cache_push_front(struct fingerprint_cache *cache, const uint16_t idx)
+{
+    struct fingerprint_entry *entry = &cache->entries[idx];
+    entry->prev = FINGERPRINT_NONE;
+    entry->next = cache->head;
+    if (cache->head != FINGERPRINT_NONE) {
+        cache->entries[cache->head].prev = idx;
+    }
+    cache->head = idx;
+    if (cache->tail == FINGERPRINT_NONE) {
+        cache->tail = idx;
+    }
+}
+
+/*
+ * The entry of the fingerprint, NULL when it's not in the cache.
+ */
+static const struct fingerprint_entry *fingerprint_cache_get(const struct fingerprint_cache *cache, const uint64_t fingerprint)
+{
+    const uint16_t slot = fingerprint_cache_slot(cache, fingerprint);
+    if (cache->slots[slot] == 0) { return NULL; }
+    return &cache->entries[cache->slots[slot] - 1];
+}
+
+/*
+ * The entry of the fingerprint, marked as the most recently used. A new entry is added, with no flags, when
+ * it's missing, and the least recently used one is evicted when the cache is full.
+ */
+static struct fingerprint_entry *fingerprint_cache_add(struct fingerprint_cache *cache, const uint64_t fingerprint)
+{
+    uint16_t slot = fingerprint_cache_slot(cache, fingerprint);
+    if (cache->slots[slot] != 0) {
+        const uint16_t idx = cache->slots[slot] - 1;
+        if (cache->head != idx) {
+            fingerprint_cache_unlink(cache, idx);
+            fingerprint_cache_push_front(cache, idx);
+        }
+        return &cache->entries[idx];
+    }
+
+    uint16_t idx = cache->count;
+    if (cache->count == FINGERPRINT_CACHE_SIZE) {
+        idx = cache->tail;
+        fingerprint_cache_unlink(cache, idx);
+        fingerprint_cache_slot_remove(cache, fingerprint_cache_slot(cache, cache->entries[idx].fingerprint));
+        // NOTE(marius): the removal can move the entries around, so we look for the free slot again
+        slot = fingerprint_cache_slot(cache, fingerprint);
+    } else {
+        cache->count++;
+    }
+
+    struct fingerprint_entry *entry = &cache->entries[idx];
+    entry->fingerprint = fingerprint;
+    entry->owner = 0;
+    entry->start_time = 0;
+    entry->flags = 0;
+    cache->slots[slot] = idx + 1;
+    fingerprint_cache_push_front(cache, idx);
+    return entry;
+}
+
+/*
+ * Checks if the listen has any of the flags. With an owner, only the listens announced by other players
+ * match, so the player can announce its own listen again.
+ */
+static bool fingerprint_cache_seen(const struct fingerprint_cache *cache, const uint64_t values_hash, const time_t start_time,
+    const double length, const uint8_t flags, const uint64_t owner)
+{
+    const struct fingerprint_entry *entry = fingerprint_cache_get(cache, fingerprint_for_values(values_hash));
+    if (NULL == entry || !(entry->flags & flags)) { return false; }
+    if (!fingerprint_same_listen(entry, start_time, length)) { return false; }
+    return owner == FINGERPRINT_ANY_OWNER || entry->owner != owner;
+}
+
+/*
+ * Adds the flags to the listen, a listen of the track that started at another time replaces the previous one.
+ */
+static void fingerprint_cache_mark(struct fingerprint_cache *cache, const uint64_t values_hash, const time_t start_time,
+    const double length, const uint8_t flags, const uint64_t owner)
+{
+    struct fingerprint_entry *entry = fingerprint_cache_add(cache, fingerprint_for_values(values_hash));
+    if (entry->flags == 0 || !fingerprint_same_listen(entry, start_time, length)) {
+        entry->owner = 0;
+        entry->start_time = (int64_t)start_time;
+        entry->flags = 0;
+    }
+    // NOTE(marius): the first player to announce the listen keeps it
+    if (entry->owner == 0) { entry->owner = owner; }
+    entry->flags |= flags;
+}
+
+static bool fingerprint_cache_write(const struct fingerprint_cache *cache, FILE *file)
+{
+    size_t wrote = fwrite(&cache->count, sizeof(cache->count), 1, file);
+    for (uint16_t idx = cache->tail; idx != FINGERPRINT_NONE; idx = cache->entries[idx].prev) {
+        struct fingerprint_record record = {0};
+        record.fingerprint = cache->entries[idx].fingerprint;
+        record.owner = cache->entries[idx].owner;
+        record.start_time = cache->entries[idx].start_time;
+        record.flags = cache->entries[idx].flags;
+        wrote += fwrite(&record, sizeof(record), 1, file);
+    }
+    return wrote == 1 + (size_t)cache->count;
+}
+
+/*
+ * Loads the fingerprints written by fingerprint_cache_write, the cache is left untouched if the file is not
+ * valid.
+ */
+static bool fingerprint_cache_read(struct fingerprint_cache *cache, FILE *file)
+{
+    uint16_t count = 0;
+    if (fread(&count, sizeof(count), 1, file) != 1 || count > FINGERPRINT_CACHE_SIZE) {
+        return false;
+    }
+    struct fingerprint_record records[FINGERPRINT_CACHE_SIZE];
+    if (fread(records, sizeof(records[0]), count, file) != count || fgetc(file) != EOF) {
+        return false;
+    }
+    fingerprint_cache_init(cache);
+    for (uint16_t i = 0; i < count; i++) {
+        if (records[i].fingerprint == 0) { continue; }
+        struct fingerprint_entry *entry = fingerprint_cache_add(cache, records[i].fingerprint);
+        entry->owner = records[i].owner;
+        entry->start_time = records[i].start_time;
+        entry->flags = records[i].flags;
+    }
+    return true;
+}
+
+#endif // MPRIS_SCROBBLER_FINGERPRINT_H
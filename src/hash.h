@@ -0,0 +1,100 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_HASH_H
+#define MPRIS_SCROBBLER_HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 64-bit hashes for the string fields we receive from the players.
+ *
+ * A hash_field keeps the length of each value of a field, and the hash of all of them. They are computed
+ * once, when the field is loaded, and the equality checks only compare the bytes of the values when the
+ * lengths and the hashes match.
+ * An empty field hashes to 0, so a zeroed field and its zeroed hash_field are consistent.
+ */
+
+#define HASH_SEED                   0xcbf29ce484222325ULL
+#define HASH_MULTIPLIER             0x9e3779b97f4a7c15ULL
+
+#define HASH_FIELD_MAX_VALUES       8
+
+struct hash_field {
+    uint64_t hash;
+    uint16_t len[HASH_FIELD_MAX_VALUES]; // the single valued fields use only the first one
+};
+
+static inline uint64_t hash_mix(uint64_t hash, const uint64_t word)
+{
+    hash ^= word;
+    hash *= HASH_MULTIPLIER;
+    return hash ^ (hash >> 29);
+}
+
+/*
+ * The data is consumed 8 bytes at a time, the last partial word is padded with zeroes and the length is
+ * mixed in at the end, so "a" and "a\0" hash differently.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, const size_t len)
+{
+    const unsigned char *bytes = data;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = hash_mix(hash, word);
+    }
+    if (i < len) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, len - i);
+        hash = hash_mix(hash, word);
+    }
+    return hash_mix(hash, (uint64_t)len);
+}
+
+static inline uint64_t hash_string(const char *str, const size_t len)
+{
+    if (len == 0) { return 0; }
+    return hash_bytes(HASH_SEED, str, len);
+}
+
+/*
+ * Loads the lengths and the hash of count values stored stride bytes apart, each of them at most
+ * stride - 1 bytes long.
+ */
+static void hash_field_load(struct hash_field *field, const char *values, size_t count, const size_t stride)
+{
+    memset(field, 0x0, sizeof(*field));
+    if (count > HASH_FIELD_MAX_VALUES) { count = HASH_FIELD_MAX_VALUES; }
+
+    // NOTE(marius): the multi valued fields are filled in order, the first empty value ends them
+    uint64_t hash = HASH_SEED;
+    for (size_t i = 0; i < count; i++) {
+        const char *value = values + i * stride;
+        const char *end = memchr(value, '\0', stride - 1);
+        const size_t len = NULL != end ? (size_t)(end - value) : stride - 1;
+        if (len == 0) { break; }
+        field->len[i] = (uint16_t)len;
+        hash = hash_bytes(hash, value, len);
+    }
+    field->hash = field->len[0] > 0 ? hash : 0;
+}
+
+static bool hash_field_equals(const char *a, const struct hash_field *fa, const char *b, const struct hash_field *fb, const size_t stride)
+{
+    if (fa->hash != fb->hash) { return false; }
+    if (memcmp(fa->len, fb->len, sizeof(fa->len)) != 0) { return false; }
+
+    // NOTE(marius): same lengths and same hash, only a collision would make the values different
+    for (size_t i = 0; i < HASH_FIELD_MAX_VALUES; i++) {
+        if (fa->len[i] == 0) { break; }
+        if (memcmp(a + i * stride, b + i * stride, fa->len[i]) != 0) { return false; }
+    }
+    return true;
+}
+
+#endif // MPRIS_SCROBBLER_HASH_H
@@ -0,0 +1,207 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_IMPORT_H
+#define MPRIS_SCROBBLER_IMPORT_H
+
+#include <json-c/json.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Readers for the listen histories that can be imported by the signon binary:
+ *  - ListenBrainz JSONL exports, one listen object per line, as returned by the listens API.
+ *  - Rockbox .scrobbler.log files, see https://web.archive.org/web/2019/http://www.audioscrobbler.net/wiki/Portable_Player_Logging
+ *
+ * The files are read one line at a time, so the memory used doesn't depend on their size.
+ */
+
+#define IMPORT_CHECKPOINT_FILE_NAME     "import"
+
+#define ROCKBOX_HEADER                  "#AUDIOSCROBBLER/"
+#define ROCKBOX_TIMEZONE_UNKNOWN        "#TZ/UNKNOWN"
+#define ROCKBOX_RATING_SKIPPED          'S'
+#define ROCKBOX_MIN_FIELD_COUNT         7
+#define ROCKBOX_FIELD_COUNT             8
+
+#define API_DURATION_MS_NODE_NAME       "duration_ms"
+#define API_TRACK_NUMBER_NODE_NAME      "tracknumber"
+
+static enum import_format import_detect_format(const char *first_line)
+{
+    if (NULL == first_line) { return import_format_unknown; }
+    if (strncmp(first_line, ROCKBOX_HEADER, strlen(ROCKBOX_HEADER)) == 0) {
+        return import_format_rockbox;
+    }
+    if (first_line[0] == '{') {
+        return import_format_jsonl;
+    }
+    return import_format_unknown;
+}
+
+static const char *get_import_format_label(const enum import_format format)
+{
+    switch (format) {
+        case import_format_jsonl:
+            return "jsonl";
+        case import_format_rockbox:
+            return "rockbox";
+        case import_format_unknown:
+        default:
+            return "unknown";
+    }
+}
+
+/*
+ * Rockbox writes the time stamps in local time when the player doesn't know its timezone,
+ * so we need to shift them to UTC.
+ */
+static time_t import_local_time_to_utc(const time_t local)
+{
+    struct tm tm = {0};
+    gmtime_r(&local, &tm);
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static enum import_entry_status import_parse_rockbox(char *line, struct scrobble *track, const bool local_time)
+{
+    if (line[0] == '#') { return import_entry_skipped; }
+
+    char *fields[ROCKBOX_FIELD_COUNT] = {0};
+    size_t count = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    char *cur = line;
+    while (count < ROCKBOX_FIELD_COUNT) {
+        fields[count++] = cur;
+        char *tab = strchr(cur, '\t');
+        if (NULL == tab) { break; }
+        *tab = '\0';
+        cur = tab + 1;
+    }
+    if (count < ROCKBOX_MIN_FIELD_COUNT) { return import_entry_invalid; }
+    if (fields[5][0] == ROCKBOX_RATING_SKIPPED) { return import_entry_skipped; }
+
+    memset(track, 0x0, sizeof(*track));
+    strncpy(track->artist[0], fields[0], MAX_PROPERTY_LENGTH);
+    strncpy(track->album, fields[1], MAX_PROPERTY_LENGTH);
+    strncpy(track->title, fields[2], MAX_PROPERTY_LENGTH);
+    track->track_number = (unsigned short)strtoul(fields[3], NULL, 10);
+    track->length = strtod(fields[4], NULL);
+    track->start_time = (time_t)strtoll(fields[6], NULL, 10);
+    if (local_time) {
+        track->start_time = import_local_time_to_utc(track->start_time);
+    }
+    if (count > 7) {
+        strncpy(track->mb_track_id[0], fields[7], MAX_PROPERTY_LENGTH);
+    }
+    return import_entry_ok;
+}
+
+static void import_json_copy_string(json_object *parent, const char *name, char *destination)
+{
+    json_object *node = NULL;
+    if (!json_object_object_get_ex(parent, name, &node) || !json_object_is_type(node, json_type_string)) { return; }
+
+    strncpy(destination, json_object_get_string(node), MAX_PROPERTY_LENGTH);
+}
+
+static enum import_entry_status import_parse_listen(struct json_tokener *tokener, const char *line, const size_t length, struct scrobble *track)
+{
+    enum import_entry_status status = import_entry_invalid;
+
+    json_tokener_reset(tokener);
+    json_object *root = json_tokener_parse_ex(tokener, line, (int)length);
+    if (NULL == root || !json_object_is_type(root, json_type_object)) {
+        goto _exit;
+    }
+
+    json_object *listened_at = NULL;
+    if (!json_object_object_get_ex(root, API_LISTENED_AT_NODE_NAME, &listened_at)) {
+        goto _exit;
+    }
+    json_object *metadata = NULL;
+    if (!json_object_object_get_ex(root, API_METADATA_NODE_NAME, &metadata) || !json_object_is_type(metadata, json_type_object)) {
+        goto _exit;
+    }
+
+    memset(track, 0x0, sizeof(*track));
+    track->start_time = (time_t)json_object_get_int64(listened_at);
+    import_json_copy_string(metadata, API_ARTIST_NAME_NODE_NAME, track->artist[0]);
+    import_json_copy_string(metadata, API_TRACK_NAME_NODE_NAME, track->title);
+    import_json_copy_string(metadata, API_ALBUM_NAME_NODE_NAME, track->album);
+
+    json_object *info = NULL;
+    if (json_object_object_get_ex(metadata, API_ADDITIONAL_INFO_NODE_NAME, &info) && json_object_is_type(info, json_type_object)) {
+        json_object *node = NULL;
+        if (json_object_object_get_ex(info, API_DURATION_NODE_NAME, &node)) {
+            track->length = (double)json_object_get_int64(node);
+        } else if (json_object_object_get_ex(info, API_DURATION_MS_NODE_NAME, &node)) {
+            track->length = (double)json_object_get_int64(node) / 1000.0;
+        }
+        if (json_object_object_get_ex(info, API_TRACK_NUMBER_NODE_NAME, &node)) {
+            track->track_number = (unsigned short)json_object_get_int(node);
+        }
+        import_json_copy_string(info, API_MUSICBRAINZ_RECORDING_ID_NODE_NAME, track->mb_track_id[0]);
+        import_json_copy_string(info, API_MUSICBRAINZ_ALBUM_ID_NODE_NAME, track->mb_album_id[0]);
+        import_json_copy_string(info, API_MUSICBRAINZ_SPOTIFY_ID_NODE_NAME, track->mb_spotify_id);
+        import_json_copy_string(info, API_URI_NODE_NAME, track->url);
+        import_json_copy_string(info, API_PLAYER_NODE_NAME, track->player_name);
+        if (json_object_object_get_ex(info, API_MUSICBRAINZ_ARTISTS_ID_NODE_NAME, &node) && json_object_is_type(node, json_type_array)) {
+            const size_t artist_count = min(json_object_array_length(node), MAX_PROPERTY_COUNT);
+            for (size_t i = 0; i < artist_count; i++) {
+                json_object *artist_id = json_object_array_get_idx(node, i);
+                if (!json_object_is_type(artist_id, json_type_string)) { continue; }
+                strncpy(track->mb_artist_id[i], json_object_get_string(artist_id), MAX_PROPERTY_LENGTH);
+            }
+        }
+    }
+    status = import_entry_ok;
+
+_exit:
+    if (NULL != root) { json_object_put(root); }
+    return status;
+}
+
+static void import_checkpoint_path(const struct configuration *config, char *result)
+{
+    snprintf(result, FILE_PATH_MAX+1, TOKENIZED_CACHE_PATH, config->env.xdg_cache_home, config->name, IMPORT_CHECKPOINT_FILE_NAME);
+}
+
+/*
+ * The checkpoint contains the offset up to which every entry of the imported file was handled, and the
+ * path of the file, so we don't resume an import from a different one.
+ */
+static long import_checkpoint_load(const char *path, const char *file_path)
+{
+    FILE *checkpoint = fopen(path, "r");
+    if (NULL == checkpoint) { return 0; }
+
+    long offset = 0;
+    char saved_path[FILE_PATH_MAX+1] = {0};
+    if (fscanf(checkpoint, "%ld\t", &offset) != 1 || NULL == fgets(saved_path, FILE_PATH_MAX, checkpoint)) {
+        offset = 0;
+    }
+    fclose(checkpoint);
+
+    saved_path[strcspn(saved_path, "\n")] = '\0';
+    if (strncmp(saved_path, file_path, FILE_PATH_MAX) != 0) {
+        return 0;
+    }
+    return offset;
+}
+
+static bool import_checkpoint_save(const char *path, const char *file_path, const long offset)
+{
+    FILE *checkpoint = fopen(path, "w");
+    if (NULL == checkpoint) {
+        _warn("import::checkpoint: unable to open %s", path);
+        return false;
+    }
+    const bool status = fprintf(checkpoint, "%ld\t%s\n", offset, file_path) > 0;
+    fclose(checkpoint);
+    return status;
+}
+
+#endif // MPRIS_SCROBBLER_IMPORT_H
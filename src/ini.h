@@ -4,6 +4,12 @@
 #ifndef MPRIS_SCROBBLER_INI_H
 #define MPRIS_SCROBBLER_INI_H
 
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "ini_base.h"
 
 #define DEFAULT_GROUP_NAME "base"
@@ -147,4 +153,146 @@ static int ini_parse(const char *buff, const size_t buff_size, struct ini_config
     return result;
 }
 
+/*
+ * The views point inside the buffer that was parsed, so they are valid only as long as it is, and their
+ * data is not NUL terminated.
+ */
+struct ini_view {
+    const char *data;
+    size_t len;
+};
+
+struct ini_file {
+    const char *data;
+    size_t size;
+};
+
+/*
+ * The handler is called with a NULL key and value when a group starts, and once for every key = value
+ * pair of the group after that.
+ */
+typedef void (*ini_view_handler)(const struct ini_view *group, const struct ini_view *key, const struct ini_view *value, void *data);
+
+static bool ini_view_is(const struct ini_view *view, const char *what)
+{
+    const size_t len = strlen(what);
+    return view->len == len && memcmp(view->data, what, len) == 0;
+}
+
+static bool ini_view_has_prefix(const struct ini_view *view, const char *prefix)
+{
+    const size_t len = strlen(prefix);
+    return view->len >= len && memcmp(view->data, prefix, len) == 0;
+}
+
+static size_t ini_view_copy(const struct ini_view *view, char *destination, const size_t max_len)
+{
+    const size_t len = view->len < max_len ? view->len : max_len;
+    memcpy(destination, view->data, len);
+    destination[len] = '\0';
+    return len;
+}
+
+static bool ini_is_blank(const char c)
+{
+    return c == SPACE || c == '\t' || c == EOL_OSX;
+}
+
+static struct ini_view ini_view_trim(const char *start, const char *end)
+{
+    while (start < end && ini_is_blank(*start)) { start++; }
+    while (end > start && ini_is_blank(end[-1])) { end--; }
+    return (struct ini_view){ .data = start, .len = (size_t)(end - start), };
+}
+
+/*
+ * Single pass parser that doesn't copy or allocate anything, the group names, keys and values are handed
+ * to the handler as views into the buffer.
+ */
+static int ini_parse_views(const char *buff, const size_t buff_size, ini_view_handler handler, void *data)
+{
+    assert(buff);
+    assert(handler);
+
+    int result = 0;
+    struct ini_view group = { .data = DEFAULT_GROUP_NAME, .len = strlen(DEFAULT_GROUP_NAME), };
+    bool group_started = false;
+
+    const char *end = buff + buff_size;
+    const char *line = buff;
+    while (line < end) {
+        const char *eol = memchr(line, EOL_LINUX, (size_t)(end - line));
+        if (NULL == eol) { eol = end; }
+        const struct ini_view cur = ini_view_trim(line, eol);
+        line = eol + 1;
+
+        if (cur.len == 0) { continue; }
+        /* comment */
+        if (cur.data[0] == COMMENT_SEMICOLON || cur.data[0] == COMMENT_HASH) { continue; }
+        /* new group */
+        if (cur.data[0] == GROUP_OPEN) {
+            const char *close = memchr(cur.data, GROUP_CLOSE, cur.len);
+            if (NULL == close) { continue; }
+
+            group = ini_view_trim(cur.data + 1, close);
+            handler(&group, NULL, NULL, data);
+            group_started = true;
+            continue;
+        }
+        /* key = value pair of the current group */
+        const char *equals = memchr(cur.data, EQUALS, cur.len);
+        if (NULL == equals) { continue; }
+
+        const struct ini_view key = ini_view_trim(cur.data, equals);
+        const struct ini_view value = ini_view_trim(equals + 1, cur.data + cur.len);
+        if (key.len == 0 || value.len == 0) { continue; }
+
+        if (!group_started) {
+            // NOTE(marius): if there isn't a group we use a default one
+            handler(&group, NULL, NULL, data);
+            group_started = true;
+        }
+        handler(&group, &key, &value, data);
+        result++;
+    }
+
+    return result;
+}
+
+static bool ini_file_map(struct ini_file *file, const char *path)
+{
+    if (NULL == file) { return false; }
+    if (NULL == path) { return false; }
+
+    file->data = NULL;
+    file->size = 0;
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) { return false; }
+
+    bool status = false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) { goto _exit; }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == data) { goto _exit; }
+
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    status = true;
+
+_exit:
+    close(fd);
+    return status;
+}
+
+static void ini_file_unmap(struct ini_file *file)
+{
+    if (NULL == file || NULL == file->data) { return; }
+
+    munmap((void*)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
 #endif // MPRIS_SCROBBLER_INI_H
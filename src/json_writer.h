@@ -0,0 +1,175 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_JSON_WRITER_H
+#define MPRIS_SCROBBLER_JSON_WRITER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "escape.h"
+
+/*
+ * Streaming JSON writer, the document is written directly in the caller's buffer as the values are
+ * added, without building it in memory first.
+ *
+ * The output has the same format as json_object_to_json_string from json-c: a space after the opening
+ * and before the closing brackets, ", " between values, ": " after the keys, and the forward slashes
+ * escaped.
+ * When the buffer is too small the writer stops and sets `overflow`, the buffer holds a truncated document.
+ */
+
+#define JSON_WRITER_MAX_DEPTH       16
+
+enum json_writer_container {
+    json_writer_root = 0,
+    json_writer_object,
+    json_writer_array,
+};
+
+struct json_writer {
+    char *buffer;
+    size_t capacity; // including the terminating zero
+    size_t length;
+    unsigned depth;
+    enum json_writer_container containers[JSON_WRITER_MAX_DEPTH];
+    bool has_values[JSON_WRITER_MAX_DEPTH];
+    bool overflow;
+};
+
+static void json_writer_init(struct json_writer *w, char *buffer, const size_t capacity)
+{
+    memset(w, 0x0, sizeof(*w));
+    w->buffer = buffer;
+    w->capacity = capacity;
+    if (capacity > 0) { buffer[0] = '\0'; }
+}
+
+static void json_writer_append(struct json_writer *w, const char *data, const size_t len)
+{
+    if (w->overflow) { return; }
+    if (w->length + len >= w->capacity) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buffer + w->length, data, len);
+    w->length += len;
+    w->buffer[w->length] = '\0';
+}
+
+static void json_writer_append_escaped(struct json_writer *w, const char *str, const size_t len)
+{
+    json_writer_append(w, "\"", 1);
+    size_t i = 0;
+    while (i < len) {
+        // NOTE(marius): the characters that don't need escaping are copied in runs
+        const size_t run = escape_json_clean_run(str + i, len - i);
+        json_writer_append(w, str + i, run);
+        i += run;
+        if (i == len) { break; }
+
+        char escape[6];
+        json_writer_append(w, escape, escape_json_char(escape, (unsigned char)str[i++]));
+    }
+    json_writer_append(w, "\"", 1);
+}
+
+/*
+ * The separator in front of a value, the keys of an object take care of it for their values.
+ */
+static void json_writer_value_begin(struct json_writer *w)
+{
+    if (w->containers[w->depth] != json_writer_array) { return; }
+    if (w->has_values[w->depth]) {
+        json_writer_append(w, ", ", 2);
+    } else {
+        json_writer_append(w, " ", 1);
+    }
+    w->has_values[w->depth] = true;
+}
+
+static void json_writer_container_begin(struct json_writer *w, const enum json_writer_container type, const char *open)
+{
+    json_writer_value_begin(w);
+    json_writer_append(w, open, 1);
+    if (w->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        w->overflow = true;
+        return;
+    }
+    w->depth++;
+    w->containers[w->depth] = type;
+    w->has_values[w->depth] = false;
+}
+
+static void json_writer_container_end(struct json_writer *w, const char *close)
+{
+    if (w->depth == 0) { return; }
+    json_writer_append(w, " ", 1);
+    json_writer_append(w, close, 1);
+    w->depth--;
+}
+
+static void json_writer_object_begin(struct json_writer *w)
+{
+    json_writer_container_begin(w, json_writer_object, "{");
+}
+
+static void json_writer_object_end(struct json_writer *w)
+{
+    json_writer_container_end(w, "}");
+}
+
+static void json_writer_array_begin(struct json_writer *w)
+{
+    json_writer_container_begin(w, json_writer_array, "[");
+}
+
+static void json_writer_array_end(struct json_writer *w)
+{
+    json_writer_container_end(w, "]");
+}
+
+static void json_writer_key(struct json_writer *w, const char *key)
+{
+    if (w->has_values[w->depth]) {
+        json_writer_append(w, ", ", 2);
+    } else {
+        json_writer_append(w, " ", 1);
+    }
+    w->has_values[w->depth] = true;
+    json_writer_append_escaped(w, key, strlen(key));
+    json_writer_append(w, ": ", 2);
+}
+
+static void json_writer_string(struct json_writer *w, const char *value)
+{
+    json_writer_value_begin(w);
+    json_writer_append_escaped(w, value, strlen(value));
+}
+
+static void json_writer_int(struct json_writer *w, const int64_t value)
+{
+    char number[24] = {0};
+    const int len = snprintf(number, sizeof(number), "%" PRId64, value);
+
+    json_writer_value_begin(w);
+    json_writer_append(w, number, (size_t)len);
+}
+
+static void json_writer_key_string(struct json_writer *w, const char *key, const char *value)
+{
+    json_writer_key(w, key);
+    json_writer_string(w, value);
+}
+
+static void json_writer_key_int(struct json_writer *w, const char *key, const int64_t value)
+{
+    json_writer_key(w, key);
+    json_writer_int(w, value);
+}
+
+#endif // MPRIS_SCROBBLER_JSON_WRITER_H
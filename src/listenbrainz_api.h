@@ -97,126 +97,130 @@ static http_request *build_generic_request()
 }
 #endif
 
-static void listenbrainz_api_append_additional_info(json_object* root,const struct scrobble *track){
+static void listenbrainz_api_write_additional_info(struct json_writer *w, const struct scrobble *track)
+{
     const char *mb_track_id = (char*)track->mb_track_id[0];
     const char *mb_artist_id = (char*)track->mb_artist_id[0];
     const char *mb_album_id = (char*)track->mb_album_id[0];
 
-    json_object *additional_info = json_object_new_object();
-    json_object_object_add(additional_info, API_DURATION_NODE_NAME, json_object_new_int((int)track->length));
-    json_object_object_add(additional_info, API_SUBMITTER_NODE_NAME, json_object_new_string(get_application_name()));
-    json_object_object_add(additional_info, API_SUBMITTER_VERSION_NODE_NAME, json_object_new_string(get_version()));
-    json_object_object_add(additional_info, API_PLAYER_NODE_NAME, json_object_new_string(track->player_name));
+    json_writer_key(w, API_ADDITIONAL_INFO_NODE_NAME);
+    json_writer_object_begin(w);
+    json_writer_key_int(w, API_DURATION_NODE_NAME, (int)track->length);
+    json_writer_key_string(w, API_SUBMITTER_NODE_NAME, get_application_name());
+    json_writer_key_string(w, API_SUBMITTER_VERSION_NODE_NAME, get_version());
+    json_writer_key_string(w, API_PLAYER_NODE_NAME, track->player_name);
     if (strlen(mb_track_id) > 0) {
-        json_object_object_add(additional_info, API_MUSICBRAINZ_RECORDING_ID_NODE_NAME, json_object_new_string(mb_track_id));
+        json_writer_key_string(w, API_MUSICBRAINZ_RECORDING_ID_NODE_NAME, mb_track_id);
     }
     if (strlen(mb_artist_id) > 0) {
-        json_object *artists_ids = json_object_new_array();
-        json_object_array_add(artists_ids, json_object_new_string(mb_artist_id));
-        json_object_object_add(additional_info, API_MUSICBRAINZ_ARTISTS_ID_NODE_NAME, artists_ids);
+        json_writer_key(w, API_MUSICBRAINZ_ARTISTS_ID_NODE_NAME);
+        json_writer_array_begin(w);
+        json_writer_string(w, mb_artist_id);
+        json_writer_array_end(w);
     }
     if (strlen(mb_album_id) > 0) {
-        json_object_object_add(additional_info, API_MUSICBRAINZ_ALBUM_ID_NODE_NAME, json_object_new_string(mb_album_id));
+        json_writer_key_string(w, API_MUSICBRAINZ_ALBUM_ID_NODE_NAME, mb_album_id);
     }
     if (strlen(track->mb_spotify_id) > 0) {
-        json_object_object_add(additional_info, API_MUSICBRAINZ_SPOTIFY_ID_NODE_NAME, json_object_new_string(track->mb_spotify_id));
+        json_writer_key_string(w, API_MUSICBRAINZ_SPOTIFY_ID_NODE_NAME, track->mb_spotify_id);
     }
     if (
         strlen(track->url) > 0
         && (strncmp(track->url, API_PROTO_WHITELIST_HTTP, strlen(API_PROTO_WHITELIST_HTTP)) == 0
         || strncmp(track->url, API_PROTO_WHITELIST_HTTPS, strlen(API_PROTO_WHITELIST_HTTPS)) == 0)
     ) {
-        json_object_object_add(additional_info, API_URI_NODE_NAME, json_object_new_string(track->url));
+        json_writer_key_string(w, API_URI_NODE_NAME, track->url);
     }
-
-    json_object_object_add(root, API_ADDITIONAL_INFO_NODE_NAME, additional_info);
+    json_writer_object_end(w);
 }
 
-struct http_header *http_authorization_header_new (const char*);
-struct http_header *http_content_type_header_new (void);
-static void listenbrainz_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth)
-{
-    if (!listenbrainz_valid_credentials(auth)) { return; }
-
-    assert(track_count == 1);
-
-    const struct scrobble *track = tracks[0];
-
-    const char *token = auth->token;
+static const struct scrobble_details *scrobble_details_get(struct track_cache*, const struct scrobble*, struct arena*);
 
-    char body[MAX_BODY_SIZE+1] = {0};
-
-    json_object *root = json_object_new_object();
-    json_object_object_add(root, API_LISTEN_TYPE_NODE_NAME, json_object_new_string(API_LISTEN_TYPE_NOW_PLAYING));
+static bool listenbrainz_api_write_metadata(struct json_writer *w, const struct scrobble *track, const bool always_title, struct track_cache *cache, struct arena *arena)
+{
+    // NOTE(marius): the details are written right away, the next track can replace them in the cache
+    const struct scrobble_details *details = scrobble_details_get(cache, track, arena);
+    if (NULL == details) { return false; }
 
-    json_object *payload = json_object_new_array();
 
-    json_object *payload_elem = json_object_new_object();
-    json_object *metadata = json_object_new_object();
+    json_writer_key(w, API_METADATA_NODE_NAME);
+    json_writer_object_begin(w);
     if (strlen(track->album) > 0) {
-        json_object_object_add(metadata, API_ALBUM_NAME_NODE_NAME, json_object_new_string(track->album));
+        json_writer_key_string(w, API_ALBUM_NAME_NODE_NAME, track->album);
     }
 
-    char full_artist[MAX_PROPERTY_COUNT * (MAX_PROPERTY_LENGTH  + 1)] = {0};
-    size_t full_artist_len = 0;
-    for (size_t i = 0; i < array_count(track->artist); i++) {
-        const char *artist = track->artist[i];
-        const size_t artist_len = strlen(artist);
-        if (NULL == artist || artist_len == 0) { continue; }
-
-        if (full_artist_len > 0) {
-            const size_t l_val_sep = strlen(VALUE_SEPARATOR);
-            strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
-            full_artist_len += l_val_sep;
-        }
-        strncat(full_artist, artist, min(MAX_PROPERTY_LENGTH, artist_len));
-        full_artist_len += artist_len;
+    if (details->full_artist_len > 0) {
+        json_writer_key_string(w, API_ARTIST_NAME_NODE_NAME, details->full_artist);
+    }
+    if (always_title || strlen(track->title) > 0) {
+        json_writer_key_string(w, API_TRACK_NAME_NODE_NAME, track->title);
     }
-    if (full_artist_len > 0) {
-        json_object_object_add(metadata, API_ARTIST_NAME_NODE_NAME, json_object_new_string(full_artist));
+
+    listenbrainz_api_write_additional_info(w, track);
+    json_writer_object_end(w);
+    return true;
+}
+
+/*
+ * A payload that didn't fit is not valid JSON, so the body is left empty and the caller splits the batch.
+ */
+static bool listenbrainz_api_request_set_body(struct http_request *request, const struct json_writer *w)
+{
+    request->request_type = http_post;
+    if (w->overflow) {
+        _warn("listenbrainz::payload_too_large: over %zu bytes", w->capacity - 1);
+        request->body[0] = '\0';
+        request->body_length = 0;
+        return false;
     }
-    json_object_object_add(metadata, API_TRACK_NAME_NODE_NAME, json_object_new_string(track->title));
+    request->body_length = w->length;
+    return true;
+}
 
-    listenbrainz_api_append_additional_info(metadata, track);
+static void api_request_template_apply(struct http_request*, const struct api_request_template*);
+static bool listenbrainz_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth, const struct api_request_template *template, struct track_cache *cache, struct arena *arena)
+{
+    if (!listenbrainz_valid_credentials(auth)) { return false; }
 
-    json_object_object_add(payload_elem, API_METADATA_NODE_NAME, metadata);
+    assert(track_count == 1);
 
-    json_object_array_add(payload, payload_elem);
-    json_object_object_add(root, API_PAYLOAD_NODE_NAME, payload);
+    const struct scrobble *track = tracks[0];
 
-    const char *json_str = json_object_to_json_string(root);
-    strncpy(body, json_str, MAX_BODY_SIZE);
+    struct json_writer w;
+    json_writer_init(&w, request->body, sizeof(request->body));
 
-    arrput(request->headers, http_authorization_header_new(token));
-    arrput(request->headers, http_content_type_header_new());
+    json_writer_object_begin(&w);
+    json_writer_key_string(&w, API_LISTEN_TYPE_NODE_NAME, API_LISTEN_TYPE_NOW_PLAYING);
+    json_writer_key(&w, API_PAYLOAD_NODE_NAME);
+    json_writer_array_begin(&w);
 
-    request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
-    api_get_url(request->url, request->end_point);
+    json_writer_object_begin(&w);
+    if (!listenbrainz_api_write_metadata(&w, track, true, cache, arena)) { return false; }
+    json_writer_object_end(&w);
 
-    json_object_put(root);
+    json_writer_array_end(&w);
+    json_writer_object_end(&w);
+
+    if (!listenbrainz_api_request_set_body(request, &w)) { return false; }
+    api_request_template_apply(request, template);
+    return true;
 }
 
 /*
+ * The payload is written directly in the request body, so an import batch doesn't need to be built in
+ * memory first.
  */
-static void listenbrainz_api_build_request_scrobble(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth)
+static bool listenbrainz_api_build_request_scrobble(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth, const struct api_request_template *template, struct track_cache *cache, struct arena *arena)
 {
-    if (!listenbrainz_valid_credentials(auth)) { return; }
-
-    const char *token = auth->token;
+    if (!listenbrainz_valid_credentials(auth)) { return false; }
 
-    char body[MAX_BODY_SIZE+1] = {0};
-
-    json_object *root = json_object_new_object();
-    if (track_count > 1) {
-        json_object_object_add(root, API_LISTEN_TYPE_NODE_NAME, json_object_new_string(API_LISTEN_TYPE_IMPORT));
-    } else {
-        json_object_object_add(root, API_LISTEN_TYPE_NODE_NAME, json_object_new_string(API_LISTEN_TYPE_SINGLE));
-    }
+    struct json_writer w;
+    json_writer_init(&w, request->body, sizeof(request->body));
 
-    json_object *payload = json_object_new_array();
+    json_writer_object_begin(&w);
+    json_writer_key_string(&w, API_LISTEN_TYPE_NODE_NAME, track_count > 1 ? API_LISTEN_TYPE_IMPORT : API_LISTEN_TYPE_SINGLE);
+    json_writer_key(&w, API_PAYLOAD_NODE_NAME);
+    json_writer_array_begin(&w);
     for (size_t ti = 0; ti < track_count; ti++) {
         const struct scrobble *track = tracks[ti];
 
@@ -224,56 +228,50 @@ static void listenbrainz_api_build_request_scrobble(struct http_request *request
             continue;
         }
 
-        json_object *payload_elem = json_object_new_object();
-        json_object *metadata = json_object_new_object();
-        if (strlen(track->album) > 0) {
-            json_object_object_add(metadata, API_ALBUM_NAME_NODE_NAME, json_object_new_string(track->album));
-        }
-        char full_artist[MAX_PROPERTY_COUNT * (MAX_PROPERTY_LENGTH + 1)] = {0};
-        size_t full_artist_len = 0;
-        for (size_t ai = 0; ai < array_count(track->artist); ai++) {
-            const char *artist = track->artist[ai];
-            const size_t artist_len = strlen(artist);
-            if (NULL == artist || artist_len == 0) { continue; }
-
-            if (full_artist_len > 0) {
-                const size_t l_val_sep = strlen(VALUE_SEPARATOR);
-                strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
-                full_artist_len += l_val_sep;
-            }
-            strncat(full_artist, artist, min(MAX_PROPERTY_LENGTH, artist_len));
-            full_artist_len += artist_len;
-        }
-        if (full_artist_len > 0) {
-            json_object_object_add(metadata, API_ARTIST_NAME_NODE_NAME, json_object_new_string(full_artist));
-        }
-        if (strlen(track->title) > 0) {
-            json_object_object_add(metadata, API_TRACK_NAME_NODE_NAME, json_object_new_string(track->title));
-        }
-        
-        listenbrainz_api_append_additional_info(metadata, track);
-
-        json_object_object_add(payload_elem, API_LISTENED_AT_NODE_NAME, json_object_new_int64(track->start_time));
-        json_object_object_add(payload_elem, API_METADATA_NODE_NAME, metadata);
-
-        json_object_array_add(payload, payload_elem);
+        json_writer_object_begin(&w);
+        json_writer_key_int(&w, API_LISTENED_AT_NODE_NAME, track->start_time);
+        if (!listenbrainz_api_write_metadata(&w, track, false, cache, arena)) { return false; }
+        json_writer_object_end(&w);
     }
+    json_writer_array_end(&w);
+    json_writer_object_end(&w);
 
-    json_object_object_add(root, API_PAYLOAD_NODE_NAME, payload);
-
-    const char *json_str = json_object_to_json_string(root);
-    strncpy(body, json_str, MAX_BODY_SIZE);
+    if (!listenbrainz_api_request_set_body(request, &w)) { return false; }
+    api_request_template_apply(request, template);
+    return true;
+}
 
-    arrput(request->headers, (http_authorization_header_new(token)));
-    arrput(request->headers, (http_content_type_header_new()));
+/*
+ * The payload doesn't depend on the account, only the authorization header does, and that comes
+ * with the template, so a request built for one account is reused as is for the others.
+ */
+static void listenbrainz_api_build_request_from(struct http_request *request, const struct http_request *source, const struct api_credentials *auth, const struct api_request_template *template)
+{
+    if (!listenbrainz_valid_credentials(auth)) { return; }
 
-    request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
-    api_get_url(request->url, request->end_point);
+    request->request_type = source->request_type;
+    memcpy(request->body, source->body, source->body_length + 1);
+    request->body_length = source->body_length;
+    api_request_template_apply(request, template);
+}
 
-    json_object_put(root);
+/*
+ * ListenBrainz validates the whole payload, so a bad listen makes it refuse the full batch with a 400
+ * status. In that case the tracks need to be resent on their own to find which one is at fault.
+ */
+static void listenbrainz_api_response_get_scrobble_acks(const long http_code, struct scrobble_ack acks[], const unsigned count)
+{
+    for (unsigned i = 0; i < count; i++) {
+        acks[i].code = (int)http_code;
+        if (http_code == 200) {
+            acks[i].status = scrobble_ack_accepted;
+        } else if (http_code == 400) {
+            acks[i].status = (count > 1) ? scrobble_ack_isolate : scrobble_ack_rejected;
+        } else {
+            // NOTE(marius): authorization errors, rate limiting and server errors can be retried
+            acks[i].status = scrobble_ack_retry;
+        }
+    }
 }
 
 static bool listenbrainz_json_document_is_error(const char *buffer, const size_t length)
@@ -50,93 +50,125 @@ static uint32_t to_int32(const uint8_t *bytes)
         | ((uint32_t) bytes[3] << 24);
 }
 
-static void md5(const uint8_t *message, const size_t length, uint8_t *digest)
+struct md5_context {
+    uint32_t state[4];
+    uint64_t length; // bytes hashed so far
+    uint8_t buffer[64];
+    size_t buffered;
+};
+
+static void md5_process_chunk(uint32_t state[4], const uint8_t *chunk)
 {
-    // These vars will contain the hash
-    uint32_t a0, b0, c0, d0;
+    uint32_t w[16] = {0};
+    // break chunk into sixteen 32-bit words w[i], 0 <= i <= 15
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = to_int32(chunk + i * 4);
+    }
 
-    uint8_t *msg = NULL;
+    // Initialize hash value for this chunk:
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+
+    // Main loop:
+    for(size_t i = 0; i < 64; i++) {
+        uint32_t f, g;
+        if (i < 16) {
+            f = (b & c) | ((~b) & d);
+            g = (uint32_t)i;
+        } else if (i < 32) {
+            f = (d & b) | ((~d) & c);
+            g = (5*i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3*i + 5) % 16;
+        } else {
+            f = c ^ (b | (~d));
+            g = (7*i) % 16;
+        }
 
-    size_t new_len, offset;
-    uint32_t w[16] = {0};
+        uint32_t temp = d;
+        d = c;
+        c = b;
+        b = b + LEFTROTATE((a + f + k[i] + w[g]), shifts[i]);
+        a = temp;
+    }
+
+    // Add this chunk's hash to result so far:
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
 
+static void md5_init(struct md5_context *ctx)
+{
     // Initialize variables - simple count in nibbles:
-    a0 = 0x67452301;
-    b0 = 0xefcdab89;
-    c0 = 0x98badcfe;
-    d0 = 0x10325476;
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+    ctx->buffered = 0;
+}
+
+/*
+ * The message can be hashed in as many pieces as needed, only the incomplete 512-bit chunk is kept between calls.
+ */
+static void md5_update(struct md5_context *ctx, const uint8_t *data, size_t length)
+{
+    ctx->length += length;
+    if (ctx->buffered > 0) {
+        const size_t missing = sizeof(ctx->buffer) - ctx->buffered;
+        const size_t count = length < missing ? length : missing;
+        memcpy(ctx->buffer + ctx->buffered, data, count);
+        ctx->buffered += count;
+        data += count;
+        length -= count;
+        if (ctx->buffered < sizeof(ctx->buffer)) { return; }
+        md5_process_chunk(ctx->state, ctx->buffer);
+        ctx->buffered = 0;
+    }
+    // Process the message in successive 512-bit chunks:
+    while (length >= sizeof(ctx->buffer)) {
+        md5_process_chunk(ctx->state, data);
+        data += sizeof(ctx->buffer);
+        length -= sizeof(ctx->buffer);
+    }
+    if (length > 0) {
+        memcpy(ctx->buffer, data, length);
+        ctx->buffered = length;
+    }
+}
 
+static void md5_final(struct md5_context *ctx, uint8_t *digest)
+{
     //Pre-processing:
     //append "1" bit to message
     //append "0" bits until message length in bits ≡ 448 (mod 512)
     //append length mod (2^64) to message
+    const uint64_t bits = ctx->length * 8;
 
-    for (new_len = length + 1; new_len % (512 / 8) != 448 / 8; new_len++);
-
-    msg = (uint8_t*)malloc(new_len + 8);
-    memcpy(msg, message, length);
-    msg[length] = 0x80; // append the "1" bit; most significant bit is "first"
-
-    for (offset = length + 1; offset < new_len; offset++) {
-        msg[offset] = 0x0; // append "0" bits
-    }
+    uint8_t padding[64 + 8] = {0x80}; // append the "1" bit; most significant bit is "first"
+    size_t padding_len = (ctx->buffered < 56) ? 56 - ctx->buffered : 120 - ctx->buffered;
 
     // append the len in bits at the end of the buffer.
-    to_bytes((uint32_t)length * 8, msg + new_len);
-    // length >> 29 == length * 8 >> 32, but avoids overflow.
-    to_bytes((uint32_t)length >> 29, msg + new_len + 4);
-
-    // Process the message in successive 512-bit chunks:
-    //for each 512-bit chunk of message:
-    for (offset = 0; offset < new_len; offset += (512 / 8)) {
-        // break chunk into sixteen 32-bit words w[i], 0 <= i <= 15
-        for (size_t i = 0; i < 16; i++) {
-            w[i] = to_int32(msg + offset + i * 4);
-        }
-
-        // Initialize hash value for this chunk:
-        uint32_t a = a0;
-        uint32_t b = b0;
-        uint32_t c = c0;
-        uint32_t d = d0;
-
-        // Main loop:
-        for(size_t i = 0; i < 64; i++) {
-            uint32_t f, g;
-            if (i < 16) {
-                f = (b & c) | ((~b) & d);
-                g = (uint32_t)i;
-            } else if (i < 32) {
-                f = (d & b) | ((~d) & c);
-                g = (5*i + 1) % 16;
-            } else if (i < 48) {
-                f = b ^ c ^ d;
-                g = (3*i + 5) % 16;
-            } else {
-                f = c ^ (b | (~d));
-                g = (7*i) % 16;
-            }
-
-            uint32_t temp = d;
-            d = c;
-            c = b;
-            b = b + LEFTROTATE((a + f + k[i] + w[g]), shifts[i]);
-            a = temp;
-        }
-
-        // Add this chunk's hash to result so far:
-        a0 += a;
-        b0 += b;
-        c0 += c;
-        d0 += d;
-    }
-
-    // cleanup
-    free(msg);
+    to_bytes((uint32_t)bits, padding + padding_len);
+    to_bytes((uint32_t)(bits >> 32), padding + padding_len + 4);
+    md5_update(ctx, padding, padding_len + 8);
 
     //digest[16] = a0 append b0 append c0 append d0 // (Output is in little-endian)
-    to_bytes(a0, digest);
-    to_bytes(b0, digest + 4);
-    to_bytes(c0, digest + 8);
-    to_bytes(d0, digest + 12);
+    to_bytes(ctx->state[0], digest);
+    to_bytes(ctx->state[1], digest + 4);
+    to_bytes(ctx->state[2], digest + 8);
+    to_bytes(ctx->state[3], digest + 12);
+}
+
+static void md5(const uint8_t *message, const size_t length, uint8_t *digest)
+{
+    struct md5_context ctx;
+    md5_init(&ctx);
+    md5_update(&ctx, message, length);
+    md5_final(&ctx, digest);
 }
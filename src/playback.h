@@ -0,0 +1,45 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_PLAYBACK_H
+#define MPRIS_SCROBBLER_PLAYBACK_H
+
+#include <stdbool.h>
+
+/*
+ * A track can be scrobbled once it was played for half its length, or for four minutes, whichever comes
+ * first.
+ *
+ * The threshold depends only on the length of the track. The play time is the time actually listened,
+ * accumulated by the playback state machine across pauses and seeks, and it's subtracted from the
+ * threshold only once, when checking if the track is due and when computing how long is left to play.
+ */
+
+#define MIN_SCROBBLE_DELAY_SECONDS  (4.0*60.0)
+#define PLAY_TIME_TOLERANCE_SECONDS 0.5
+
+static double playback_scrobble_threshold(const double length)
+{
+    if (length <= 0.1) { return 0; }
+
+    const double half = length / 2.0;
+    return (half < MIN_SCROBBLE_DELAY_SECONDS ? half : MIN_SCROBBLE_DELAY_SECONDS) + 1.0;
+}
+
+static bool playback_scrobble_is_due(const double length, const double played)
+{
+    return playback_scrobble_threshold(length) - played <= PLAY_TIME_TOLERANCE_SECONDS;
+}
+
+/*
+ * The wall clock time until the track is due, the remaining play time is scaled by the playback rate.
+ */
+static double playback_scrobble_due_in(const double length, const double played, const double rate)
+{
+    const double remaining = playback_scrobble_threshold(length) - played;
+    if (remaining <= 0) { return 0; }
+
+    return rate > 0 ? remaining / rate : remaining;
+}
+
+#endif // MPRIS_SCROBBLER_PLAYBACK_H
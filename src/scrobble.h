@@ -9,7 +9,7 @@
 
 #define MPRIS_SPOTIFY_TRACK_ID_PREFIX   "spotify:track:"
 
-short load_player_namespaces(DBusConnection *, struct mpris_player *, short);
+short load_player_namespaces(DBusConnection *, struct mpris_player *[MAX_PLAYERS], short);
 void load_player_mpris_properties(DBusConnection*, struct mpris_player*);
 
 struct dbus *dbus_connection_init(struct state*);
@@ -148,11 +148,7 @@ const char *get_api_status_label (api_return_codes code)
 
 static double min_scrobble_delay_seconds(const struct scrobble *s)
 {
-    if (s->length <= 0.1L) {
-        return 0L;
-    }
-    const double result = (double)min(MIN_SCROBBLE_DELAY_SECONDS, s->length / 2L) - s->play_time + 1L;
-    return max(result, 0L);
+    return playback_scrobble_threshold(s->length);
 }
 
 static void scrobble_init(struct scrobble *s)
@@ -181,24 +177,32 @@ static void mpris_player_free(struct mpris_player *player)
             free(player->history[i]);
         }
     }
-    if (event_initialized(&player->now_playing.event) && event_pending(&player->now_playing.event, EV_TIMEOUT, NULL)) {
-        event_del(&player->now_playing.event);
-    }
-    if (event_initialized(&player->queue.event) && event_pending(&player->queue.event, EV_TIMEOUT, NULL)) {
-        event_del(&player->queue.event);
+    if (NULL != player->timers) {
+        timer_wheel_cancel(&player->timers->wheel, &player->now_playing.timer);
+        timer_wheel_cancel(&player->timers->wheel, &player->queue.timer);
     }
     memset(player, 0x0, sizeof(*player));
 }
 
+static void mpris_player_release(struct mpris_player *player)
+{
+    if (NULL == player) { return; }
+    mpris_player_free(player);
+    free(player);
+}
+
 void dbus_close(struct state*);
 void events_free(const struct events*);
 static void state_destroy(struct state *s)
 {
     if (NULL != s->dbus) { dbus_close(s); }
-    for (int i = 0; i < s->player_count; i++) {
-        mpris_player_free(&s->players[i]);
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        mpris_player_release(s->players[i]);
+        s->players[i] = NULL;
     }
 
+    scrobbler_persist_queue(&s->scrobbler);
+    scrobbler_persist_fingerprints(&s->scrobbler);
     scrobbler_clean(&s->scrobbler);
     events_free(&s->events);
 }
@@ -237,8 +241,8 @@ static bool mpris_player_init (const struct dbus *dbus, struct mpris_player *pla
     }
     assert(scrobbler);
     player->scrobbler = scrobbler;
-    assert(events.base);
-    player->evbase = events.base;
+    assert(events.timers);
+    player->timers = events.timers;
 
     load_player_mpris_properties(dbus->conn, player);
 
@@ -249,7 +253,7 @@ static bool mpris_player_init (const struct dbus *dbus, struct mpris_player *pla
 }
 
 void print_mpris_player(struct mpris_player *, enum log_levels, bool);
-static short mpris_players_init(const struct dbus *dbus, struct mpris_player *players, const struct events events, struct scrobbler *scrobbler, const char ignored[MAX_PLAYERS][MAX_PROPERTY_LENGTH+1], const short ignored_count)
+static short mpris_players_init(const struct dbus *dbus, struct mpris_player *players[MAX_PLAYERS], const struct events events, struct scrobbler *scrobbler, const char ignored[MAX_PLAYERS][MAX_PROPERTY_LENGTH+1], const short ignored_count)
 {
     if (NULL == players){
         return -1;
@@ -261,7 +265,7 @@ static short mpris_players_init(const struct dbus *dbus, struct mpris_player *pl
     const short player_count = load_player_namespaces(dbus->conn, players, MAX_PLAYERS);
     short loaded_player_count = 0;
     for (short i = 0; i < player_count; i++) {
-        struct mpris_player *player = &players[i];
+        struct mpris_player *player = players[i];
         _trace("mpris_player[%d]: %s%s", i, player->mpris_name, player->bus_id);
         if (!mpris_player_init(dbus, player, events, scrobbler, ignored, ignored_count)) {
             _trace("mpris_player[%d:%s]: failed to load properties", i, player->mpris_name);
@@ -269,6 +273,9 @@ static short mpris_players_init(const struct dbus *dbus, struct mpris_player *pl
         }
         if (!player->ignored) {
             print_mpris_player(player, log_tracing2, false);
+            // NOTE(marius): the players that weren't loaded are kept after the loaded ones, they can be picked up later
+            players[i] = players[loaded_player_count];
+            players[loaded_player_count] = player;
             loaded_player_count++;
         }
     }
@@ -381,12 +388,123 @@ static bool scrobbles_equal(const struct scrobble *s, const struct scrobble *p)
 
     if (s == p) { return true; }
 
-    const bool result = _eq(s, p);
+    // NOTE(marius): the strings are compared only up to their terminator, not the whole buffers
+    bool result = (
+        (s->start_time == p->start_time) &&
+        (s->length == p->length) &&
+        (s->track_number == p->track_number) &&
+        strncmp(s->title, p->title, MAX_PROPERTY_LENGTH) == 0 &&
+        strncmp(s->album, p->album, MAX_PROPERTY_LENGTH) == 0
+    );
+    for (int i = 0; result && i < MAX_PROPERTY_COUNT; i++) {
+        result = strncmp(s->artist[i], p->artist[i], MAX_PROPERTY_LENGTH) == 0;
+    }
     _trace("scrobbler::check_scrobbles(%p:%p) %s", s, p, result ? "same" : "different");
     return result;
 }
 
-static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p, const struct mpris_event *e)
+/*
+ * Joins the artists with VALUE_SEPARATOR in dest, which holds MAX_FULL_ARTIST_LENGTH bytes, what doesn't
+ * fit is truncated. Returns the length of the result.
+ */
+static size_t scrobble_join_artists(char *dest, const struct scrobble *s)
+{
+    const size_t separator_len = strlen(VALUE_SEPARATOR);
+    size_t len = 0;
+    for (size_t i = 0; i < MAX_PROPERTY_COUNT; i++) {
+        const char *end = memchr(s->artist[i], '\0', MAX_PROPERTY_LENGTH);
+        const size_t artist_len = NULL != end ? (size_t)(end - s->artist[i]) : MAX_PROPERTY_LENGTH;
+        if (artist_len == 0) { continue; }
+
+        if (len > 0) {
+            if (len + separator_len >= MAX_FULL_ARTIST_LENGTH - 1) { break; }
+            memcpy(dest + len, VALUE_SEPARATOR, separator_len);
+            len += separator_len;
+        }
+        const size_t copied = min(artist_len, MAX_FULL_ARTIST_LENGTH - 1 - len);
+        memcpy(dest + len, s->artist[i], copied);
+        len += copied;
+    }
+    dest[len] = '\0';
+    return len;
+}
+
+/*
+ * Joins the artists and URL escapes the values the audioscrobbler requests send.
+ */
+static void scrobble_details_load(struct scrobble_details *details, const struct scrobble *s)
+{
+    const size_t len = scrobble_join_artists(details->full_artist, s);
+    details->full_artist_len = (unsigned short)len;
+
+    details->esc_full_artist_len = (unsigned short)escape_url(details->esc_full_artist, details->full_artist, len);
+    details->esc_title_len = (unsigned short)escape_url(details->esc_title, s->title, strnlen(s->title, MAX_PROPERTY_LENGTH));
+    details->esc_album_len = (unsigned short)escape_url(details->esc_album, s->album, strnlen(s->album, MAX_PROPERTY_LENGTH));
+    details->loaded = true;
+}
+
+/*
+ * The hash of the values the details are derived from. The players can update the metadata of the track
+ * that's playing, so the ids of the track are not enough to find them.
+ */
+static uint64_t scrobble_details_key(const struct scrobble *s)
+{
+    uint64_t hash = HASH_SEED;
+    for (size_t i = 0; i < MAX_PROPERTY_COUNT; i++) {
+        hash = hash_bytes(hash, s->artist[i], strnlen(s->artist[i], MAX_PROPERTY_LENGTH));
+    }
+    hash = hash_bytes(hash, s->title, strnlen(s->title, MAX_PROPERTY_LENGTH));
+    hash = hash_bytes(hash, s->album, strnlen(s->album, MAX_PROPERTY_LENGTH));
+    // NOTE(marius): zero marks the empty entries
+    return hash != 0 ? hash : 1;
+}
+
+/*
+ * Returns the entry of the track, or an empty or the least recently used one, for the caller to load.
+ */
+static struct track_cache_entry *track_cache_get(struct track_cache *cache, const uint64_t key, bool *found)
+{
+    struct track_cache_entry *result = &cache->entries[0];
+    for (size_t i = 0; i < TRACK_CACHE_SIZE; i++) {
+        struct track_cache_entry *entry = &cache->entries[i];
+        if (entry->key == key) {
+            result = entry;
+            break;
+        }
+        if (entry->used < result->used) { result = entry; }
+    }
+    *found = result->key == key;
+    result->key = key;
+    result->used = ++cache->uses;
+    return result;
+}
+
+/*
+ * The details the request builders need, from the cache when the track was sent recently, like the now
+ * playing refreshes and the other accounts. They're derived in the arena when there's no cache.
+ * The result is valid only until the next call, which can replace the entry.
+ */
+static const struct scrobble_details *scrobble_details_get(struct track_cache *cache, const struct scrobble *s, struct arena *arena)
+{
+    if (NULL == cache) {
+        struct scrobble_details *details = arena_alloc(arena, sizeof(*details));
+        if (NULL != details) {
+            scrobble_details_load(details, s);
+        }
+        return details;
+    }
+
+    bool found = false;
+    struct track_cache_entry *entry = track_cache_get(cache, scrobble_details_key(s), &found);
+    if (found) {
+        _trace2("scrobble::details:cached: %s", s->title);
+    } else {
+        scrobble_details_load(&entry->details, s);
+    }
+    return &entry->details;
+}
+
+static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p)
 {
     assert (NULL != d);
     assert (NULL != p);
@@ -404,26 +522,13 @@ static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p,
     }
     d->scrobbled = false;
     d->track_number = (unsigned short )p->metadata.track_number;
-    if (mpris_event_changed_track(e) && mpris_properties_is_playing(p)) {
-        if (mpris_event_changed_position(e)) {
-            d->position = (double)p->position / (double)1000000L;
-        }
-        if (d->position > 0) {
-            d->play_time = d->position;
-        }
-        // we're checking if it's a newly started track, in order to set the start_time accordingly
-        if (d->play_time > 0) {
-            d->start_time = time(NULL) - (time_t)(d->play_time/1);
-        } else if (e->timestamp > 0) {
-            d->start_time = e->timestamp;
-        }
-    }
 
     // musicbrainz data
     memcpy(d->mb_track_id, p->metadata.mb_track_id, sizeof(d->mb_track_id));
     memcpy(d->mb_album_id, p->metadata.mb_album_id, sizeof(d->mb_album_id));
     memcpy(d->mb_artist_id, p->metadata.mb_artist_id, sizeof(d->mb_artist_id));
     memcpy(d->mb_album_artist_id, p->metadata.mb_album_artist_id, sizeof(d->mb_album_artist_id));
+
     // if this is spotify we add the track_id as the spotify_id
     const size_t spotify_prefix_len = strlen(MPRIS_SPOTIFY_TRACK_ID_PREFIX);
     if (strncmp(p->metadata.track_id, MPRIS_SPOTIFY_TRACK_ID_PREFIX, spotify_prefix_len) == 0){
@@ -432,14 +537,39 @@ static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p,
     return true;
 }
 
-static bool queue_append(struct scrobble_queue *queue, const struct scrobble *track)
+/*
+ * The hash of the normalised artists, title and album, the start time is added by the fingerprint cache.
+ */
+static uint64_t scrobble_fingerprint(const struct scrobble *s)
+{
+    uint64_t hash = HASH_SEED;
+    for (int i = 0; i < MAX_PROPERTY_COUNT && s->artist[i][0] != '\0'; i++) {
+        hash = fingerprint_add_value(hash, s->artist[i]);
+    }
+    hash = fingerprint_add_value(hash, s->title);
+    return fingerprint_add_value(hash, s->album);
+}
+
+static bool queue_append(struct scrobble_queue *queue, const struct scrobble *track, const unsigned pending)
 {
+    if (queue->length == MAX_QUEUE_LENGTH) {
+        // NOTE(marius): the queue is full, so we make room by dropping the oldest entry
+        _warn("scrobbler::queue_full: dropping oldest entry %s//%s//%s", queue->entries[0].title, queue->entries[0].artist[0], queue->entries[0].album);
+        memset(&queue->deliveries[0], 0x0, sizeof(queue->deliveries[0]));
+        queue_compact(queue);
+    }
     const int queue_length = queue->length;
+    if ((int)arrlen(queue->entries) <= queue_length) {
+        arraddn(queue->entries, 1);
+        memset(&arrlast(queue->entries), 0x0, sizeof(struct scrobble));
+    }
 
     struct scrobble *top = &queue->entries[queue_length];
     scrobble_copy(top, track);
 
-    top->play_time = difftime(time(0), top->start_time);
+    if (top->play_time <= 0) {
+        top->play_time = difftime(time(0), top->start_time);
+    }
 #if 0
     if (top->play_time == 0) {
         // TODO(marius): we need to be able to load the current playing mpris_properties from the track
@@ -448,8 +578,15 @@ static bool queue_append(struct scrobble_queue *queue, const struct scrobble *tr
     _debug("scrobbler::queue:setting_top_scrobble_playtime(%.3f): %s//%s//%s", top->play_time, top->title, top->artist[0], top->album);
 #endif
 
+    struct scrobble_delivery *delivery = &queue->deliveries[queue_length];
+    queue->last_id++;
+    delivery->id = queue->last_id;
+    delivery->pending = pending;
+    delivery->in_flight = 0;
+    delivery->isolated = 0;
+
     queue->length++;
-    assert(queue->length < MAX_QUEUE_LENGTH);
+    assert(queue->length <= MAX_QUEUE_LENGTH);
 
     for (int pos = queue->length-2; pos >= 0; pos--) {
         struct scrobble *current = &queue->entries[pos];
@@ -469,9 +606,33 @@ static bool scrobbles_append(struct scrobbler *scrobbler, const struct scrobble
     assert(NULL != scrobbler);
     assert(NULL != track);
 
+    const unsigned pending = scrobbler_valid_credentials_mask(scrobbler);
+    if (pending == 0) {
+        _debug("scrobbler::queue_push: skipping, no valid services");
+        return false;
+    }
+
+    // NOTE(marius): the same listen can come from two players, or from the same one after a restart
+    const uint64_t fingerprint = scrobble_fingerprint(track);
+    if (fingerprint_cache_seen(&scrobbler->fingerprints, fingerprint, track->start_time, track->length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER)) {
+        _info("scrobbler::queue_push: skipping duplicate %s//%s//%s", track->title, track->artist[0], track->album);
+        return false;
+    }
+
     struct scrobble_queue *queue = &scrobbler->queue;
+    if (queue->length == MAX_QUEUE_LENGTH) {
+        // NOTE(marius): the oldest entry gets dropped by queue_append, we keep it for the services that didn't get it yet
+        const struct scrobble_delivery *oldest = &queue->deliveries[0];
+        for (size_t i = 0; i < scrobbler->conf->credentials_count; i++) {
+            if (!(oldest->pending & (1U << i))) { continue; }
+            scrobbler_dead_letter(scrobbler, &queue->entries[0], &scrobbler->conf->credentials[i], dead_letter_evicted, 0);
+        }
+    }
     _trace("scrobbler::queue_push(%4zu) %s//%s//%s", queue->length, track->title, track->artist[0], track->album);
-    const bool result = queue_append(queue, track);
+    const bool result = queue_append(queue, track, pending);
+    if (result) {
+        fingerprint_cache_mark(&scrobbler->fingerprints, fingerprint, track->start_time, track->length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER);
+    }
     _trace("scrobbler::new_queue_length: %zu", queue->length);
     return result;
 }
@@ -483,42 +644,157 @@ static unsigned int scrobbler_consume_queue(struct scrobbler *scrobbler)
     const int queue_length = scrobbler->queue.length;
     _trace("scrobbler::queue_length: %u", queue_length);
 
-    unsigned int consumed = 0;
-    const int top = scrobbler->queue.length - 1;
-    const bool top_scrobble_invalid = false;
+    for (int pos = queue_length - 1; pos >= 0; pos--) {
+        const struct scrobble *current = &scrobbler->queue.entries[pos];
+        _info("scrobbler::scrobble:(%4zu) %s//%s//%s", pos, current->title, current->artist[0], current->album);
+    }
+
+    // NOTE(marius): the tracks are removed from the queue only when the services acknowledge them
+    return scrobbler_send_queue(scrobbler, api_build_request_scrobble);
+}
+
+static bool add_event_now_playing(struct mpris_player *, const struct scrobble *, const double);
+static bool add_event_queue(struct mpris_player*, const struct scrobble*);
+static void mpris_event_clear(struct mpris_event *);
 
-    struct scrobble *tracks[MAX_QUEUE_LENGTH] = {0};
-    for (int pos = top; pos >= 0; pos--) {
-        struct scrobble *current = &scrobbler->queue.entries[pos];
-            tracks[pos] = current;
-            _info("scrobbler::scrobble:(%4zu) %s//%s//%s", pos, current->title, current->artist[0], current->album);
-            consumed++;
+static const char *get_player_state_label(const enum player_state state)
+{
+    switch (state) {
+        case player_playing:
+            return "playing";
+        case player_paused:
+            return "paused";
+        case player_seeking:
+            return "seeking";
+        case player_track_changed:
+            return "track_changed";
+        case player_stopped:
+        default:
+            return "stopped";
     }
-    if (consumed > 0) {
-        api_request_do(scrobbler, (const struct scrobble**)tracks, consumed, scrobble_is_valid, api_build_request_scrobble);
+}
+
+/*
+ * Accumulates the time played since the last update, this is called before every transition so the play
+ * time doesn't need to be computed again from the properties, or the Position polled from the player.
+ */
+static void player_playback_advance(struct mpris_player *player)
+{
+    struct player_playback *playback = &player->playback;
+
+    const double now = monotonic_milliseconds();
+    if (playback->state == player_playing && playback->updated_at > 0) {
+        const double listened = (now - playback->updated_at) / 1000.0 * playback->rate;
+        playback->play_time += listened;
+        playback->position += listened;
     }
-    int min_scrobble_zero = 0;
-    if (top_scrobble_invalid) {
-        struct scrobble *first = &scrobbler->queue.entries[0];
-        struct scrobble *last = &scrobbler->queue.entries[top];
-        // leave the former top scrobble (which might still be playing) as the only one in the queue
-        memcpy(first, last, sizeof(*first));
-        memset(last, 0x0, sizeof(*last));
-        min_scrobble_zero = 1;
+    playback->updated_at = now;
+    playback->rate = mpris_properties_rate(&player->properties);
+}
+
+/*
+ * Players emit the Seeked signal instead of a PropertiesChanged for the Position, when it jumps.
+ */
+static void player_playback_seeked(struct mpris_player *player, const int64_t position)
+{
+    if (player->ignored) { return; }
+
+    struct player_playback *playback = &player->playback;
+    player_playback_advance(player);
+    _debug("events::player[%s]: seeked from %.2lfs to %.2lfs, played %.2lfs", player->name, playback->position,
+           (double)position / (double)1000000L, playback->play_time);
+    player->properties.position = position;
+    playback->position = (double)position / (double)1000000L;
+    if (playback->loaded && playback->state == player_playing) {
+        add_event_now_playing(player, &player->queue.scrobble, 0);
     }
-    for (int pos = top; pos >= min_scrobble_zero; pos--) {
-        memset(&scrobbler->queue.entries[pos], 0x0, sizeof(scrobbler->queue.entries[pos]));
-        scrobbler->queue.length--;
-        assert(scrobbler->queue.length >= 0);
+}
+
+static enum player_state player_next_state(const struct player_playback *playback, const struct mpris_properties *properties, const struct mpris_event *what_happened)
+{
+    switch (get_mpris_playback_status(properties)) {
+        case playing:
+            if (!playback->loaded || playback->state == player_stopped) {
+                return player_track_changed;
+            }
+            if (playback->state == player_playing && mpris_event_changed_position(what_happened)) {
+                return player_seeking;
+            }
+            return player_playing;
+        case paused:
+            return player_paused;
+        case stopped:
+        case killed:
+        default:
+            return player_stopped;
     }
+}
 
-    return consumed;
+static void player_events_cancel(struct mpris_player *player)
+{
+    if (NULL == player->timers) { return; }
+    if (timer_wheel_entry_pending(&player->now_playing.timer)) {
+        _trace("events::removing::now_loading(%p)", &player->now_playing.timer);
+        timer_wheel_cancel(&player->timers->wheel, &player->now_playing.timer);
+    }
+    if (timer_wheel_entry_pending(&player->queue.timer)) {
+        _trace("events::removing::queue(%p)", &player->queue.timer);
+        timer_wheel_cancel(&player->timers->wheel, &player->queue.timer);
+    }
+}
+
+/*
+ * The scrobble is built once per track, directly in the queue payload, and it's reused when the playback
+ * resumes after a pause.
+ */
+static bool player_track_started(struct mpris_player *player, const struct mpris_event *what_happened)
+{
+    struct player_playback *playback = &player->playback;
+    struct mpris_properties *properties = &player->properties;
+    struct scrobble *track = &player->queue.scrobble;
+
+    player_events_cancel(player);
+    memset(track, 0x0, sizeof(*track));
+    load_scrobble(track, properties);
+    if (scrobble_is_empty(track)) {
+        _warn("events::invalid_scrobble");
+        playback->loaded = false;
+        return false;
+    }
+
+    if (!mpris_event_changed_position(what_happened)) {
+        properties->position = 0;
+    }
+    // NOTE(marius): for a track we find already playing, we assume it was played from the start
+    playback->position = (double)properties->position / (double)1000000L;
+    playback->play_time = playback->position;
+    playback->loaded = true;
+    playback->queued = false;
+    playback->now_playing_until = 0;
+    playback->now_playing_forced = false;
+
+    track->position = playback->position;
+    track->play_time = playback->play_time;
+    track->start_time = time(NULL) - (time_t)(playback->play_time/1);
+
+    add_event_now_playing(player, track, 0);
+    add_event_queue(player, track);
+    return true;
+}
+
+static void player_track_resumed(struct mpris_player *player)
+{
+    struct player_playback *playback = &player->playback;
+    struct scrobble *track = &player->queue.scrobble;
+
+    track->position = playback->position;
+    track->play_time = playback->play_time;
+    add_event_now_playing(player, track, 0);
+    if (!playback->queued) {
+        add_event_queue(player, track);
+    }
 }
 
-static bool add_event_now_playing(struct mpris_player *, const struct scrobble *, const time_t);
-static bool add_event_queue(struct mpris_player*, const struct scrobble*);
-static void mpris_event_clear(struct mpris_event *);
-static void print_properties_if_changed(struct mpris_properties*, struct mpris_properties*, struct mpris_event*, enum log_levels);
 void state_loaded_properties(const DBusConnection *conn, struct mpris_player *player, struct mpris_properties *properties, const struct mpris_event *what_happened)
 {
     assert(conn);
@@ -535,43 +811,43 @@ void state_loaded_properties(const DBusConnection *conn, struct mpris_player *pl
     }
     debug_event(&player->changed);
 
-    struct scrobble scrobble = {0};
-    load_scrobble(&scrobble, properties, what_happened);
-
-    if (scrobble_is_empty(&scrobble)) {
-        _warn("events::invalid_scrobble");
-        return;
-    }
-
-    if (mpris_player_is_playing(player)) {
-        if(mpris_event_changed_track(what_happened) || mpris_event_changed_playback_status(what_happened)) {
-            add_event_now_playing(player, &scrobble, 0);
-            add_event_queue(player, &scrobble);
-        }
-        if (mpris_event_changed_track(what_happened) && !mpris_event_changed_position(what_happened)) {
-            properties->position = 0;
-        }
-    } else {
-        // remove add_now_event
-        // compute current play_time for properties.metadata
-        if (event_initialized(&player->now_playing.event)) {
-            _trace("events::removing::now_loading(%p)", &player->now_playing.event);
-            event_del(&player->now_playing.event);
-            memset(&player->now_playing.event, 0x0, sizeof(player->now_playing.event));
-        }
-        if (event_initialized(&player->queue.event)) {
-            _trace("events::removing::queue(%p)", &player->queue.event);
-            event_del(&player->queue.event);
-            memset(&player->queue.event, 0x0, sizeof(player->queue.event));
-        }
-    }
-    if (mpris_event_changed_volume(what_happened)) {
-        // trigger volume_changed event
-    }
-    if (mpris_event_changed_position(what_happened)) {
-        // trigger position event
-        // compute current play_time for properties.metadata
-    }
+    struct player_playback *playback = &player->playback;
+    player_playback_advance(player);
+    if (mpris_event_changed_track(what_happened)) {
+        playback->loaded = false;
+    }
+
+    const enum player_state previous = playback->state;
+    enum player_state next = player_next_state(playback, properties, what_happened);
+    _debug("events::player[%s]: %s -> %s, played %.2lfs", player->name, get_player_state_label(previous), get_player_state_label(next), playback->play_time);
+
+    switch (next) {
+        case player_track_changed:
+            if (!player_track_started(player, what_happened)) {
+                next = player_stopped;
+                break;
+            }
+            next = player_playing;
+            break;
+        case player_seeking:
+            // NOTE(marius): seeking changes only the position, the time played so far stays the same
+            playback->position = (double)properties->position / (double)1000000L;
+            add_event_now_playing(player, &player->queue.scrobble, 0);
+            next = player_playing;
+            break;
+        case player_playing:
+            if (previous != player_playing) {
+                player_track_resumed(player);
+            }
+            break;
+        case player_paused:
+        case player_stopped:
+            if (previous == player_playing) {
+                player_events_cancel(player);
+            }
+            break;
+    }
+    playback->state = next;
 
     mpris_event_clear(&player->changed);
 }
@@ -581,13 +857,20 @@ static void check_player(struct mpris_player* player)
     if (!mpris_player_is_valid(player) || !mpris_player_is_playing(player) || player->ignored) {
         return;
     }
-    const struct mpris_event all = {.loaded_state = mpris_load_all };
-
-    struct scrobble scrobble = {0};
-    load_scrobble(&scrobble, &player->properties, &all);
+    struct player_playback *playback = &player->playback;
+    player_playback_advance(player);
+    if (!playback->loaded || playback->state != player_playing) {
+        const struct mpris_event all = {.loaded_state = mpris_load_all };
+        playback->state = player_track_started(player, &all) ? player_playing : player_stopped;
+        return;
+    }
 
-    add_event_now_playing(player, &scrobble, 0);
-    add_event_queue(player, &scrobble);
+    // NOTE(marius): the track didn't change, so only the now playing notification is sent again
+    struct scrobble *track = &player->queue.scrobble;
+    track->position = playback->position;
+    playback->now_playing_until = 0;
+    playback->now_playing_forced = true;
+    add_event_now_playing(player, track, 0);
 }
 
 struct events *events_new(void);
@@ -606,10 +889,12 @@ static bool state_init(struct state *s, struct configuration *config)
 
     if (NULL == s->events.base) { return false; }
     scrobbler_init(&s->scrobbler, s->config, s->events.base);
+    scrobbler_load_queue(&s->scrobbler);
+    fingerprints_load_from_file(&s->scrobbler.fingerprints, s->config->fingerprints_path);
 
     s->player_count = mpris_players_init(s->dbus, s->players, s->events, &s->scrobbler, s->config->ignore_players, s->config->ignore_players_count);
     for (short i = 0; i < s->player_count; i++) {
-        struct mpris_player *player = &s->players[i];
+        struct mpris_player *player = s->players[i];
         check_player(player);
     }
     _trace2("mem::loaded %zd players", s->player_count);
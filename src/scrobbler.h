@@ -7,10 +7,20 @@
 #include <assert.h>
 #include <curl/curl.h>
 #include "curl.h"
+#include "deadletter.h"
+
+#define BACKOFF_BASE_SECONDS    5
+#define BACKOFF_MAX_SECONDS     900
+#define BACKOFF_MAX_SHIFT       8
+
+// NOTE(marius): curl starts the transfers over its host connection limit in the order they were added,
+//  so we hold them back and start them by priority instead
+#define REQUEST_MAX_RUNNING     4
 
 static bool connection_was_fulfilled(const struct scrobbler_connection *conn)
 {
     if (NULL == conn) { return false; }
+    if (conn->waiting) { return false; }
 
     const time_t now = time(NULL);
     const double elapsed_seconds = difftime(now, conn->request.time);
@@ -20,6 +30,56 @@ static bool connection_was_fulfilled(const struct scrobbler_connection *conn)
     return fulfilled;
 }
 
+static int queue_find(const struct scrobble_queue *queue, const unsigned long id)
+{
+    for (int pos = 0; pos < queue->length; pos++) {
+        if (queue->deliveries[pos].id == id) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+static void queue_compact(struct scrobble_queue *queue)
+{
+    int length = 0;
+    for (int pos = 0; pos < queue->length; pos++) {
+        const struct scrobble_delivery *delivery = &queue->deliveries[pos];
+        if (delivery->pending == 0 && delivery->in_flight == 0) {
+            _trace2("scrobbler::queue_remove(%4zu:%lu) %s", pos, delivery->id, queue->entries[pos].title);
+            continue;
+        }
+        if (length != pos) {
+            memcpy(&queue->deliveries[length], delivery, sizeof(queue->deliveries[length]));
+            memcpy(&queue->entries[length], &queue->entries[pos], sizeof(queue->entries[length]));
+        }
+        length++;
+    }
+    for (int pos = length; pos < queue->length; pos++) {
+        memset(&queue->deliveries[pos], 0x0, sizeof(queue->deliveries[pos]));
+        memset(&queue->entries[pos], 0x0, sizeof(queue->entries[pos]));
+    }
+    queue->length = length;
+}
+
+/*
+ * Returns the tracks of a connection that didn't get a response back to the queue, so they can be resent.
+ */
+static void scrobbler_connection_release(struct scrobbler_connection *conn)
+{
+    if (NULL == conn->parent || conn->acknowledged || conn->track_count == 0) { return; }
+
+    struct scrobble_queue *queue = &conn->parent->queue;
+    const unsigned bit = 1U << conn->credentials_idx;
+    for (unsigned i = 0; i < conn->track_count; i++) {
+        const int pos = queue_find(queue, conn->track_ids[i]);
+        if (pos < 0) { continue; }
+        queue->deliveries[pos].in_flight &= ~bit;
+    }
+    _debug("scrobbler::connection_release[%s]: %u tracks returned to queue", get_api_type_label(conn->credentials.end_point), conn->track_count);
+    conn->track_count = 0;
+}
+
 static void scrobbler_connection_free (struct scrobbler_connection *conn, const bool force)
 {
     if (NULL == conn) { return; }
@@ -28,6 +88,12 @@ static void scrobbler_connection_free (struct scrobbler_connection *conn, const
     const char *api_label = get_api_type_label(conn->credentials.end_point);
     _trace("scrobbler::connection_free[%s]", api_label);
 
+    scrobbler_connection_release(conn);
+    if (conn->running && NULL != conn->parent) {
+        conn->parent->scheduler.running--;
+        conn->running = false;
+    }
+
     if (NULL != conn->headers) {
         const size_t headers_count = arrlen(conn->headers);
         for (int i = (int)headers_count - 1; i >= 0; i--) {
@@ -56,6 +122,8 @@ static void scrobbler_connection_free (struct scrobbler_connection *conn, const
     http_request_clean(&conn->request);
     _trace2("scrobbler::connection_clean:response[%p]", conn->response);
     http_response_clean(&conn->response);
+    _trace2("scrobbler::connection_clean:arena[%p]: %zu bytes in %u allocations, %u blocks", &conn->arena, conn->arena.allocated, conn->arena.allocations, conn->arena.blocks);
+    arena_free(&conn->arena);
     if (NULL != conn->handle) {
         _trace2("scrobbler::connection_free:curl_easy_handle[%p]", conn->handle);
         if (NULL != conn->parent && NULL != conn->parent->handle) {
@@ -81,12 +149,14 @@ static void scrobbler_connection_init(struct scrobbler_connection *connection, s
     connection->handle = curl_easy_init();
     connection->idx = idx;
     connection->parent = s;
+    connection->credentials_idx = -1;
 
     memcpy(&connection->credentials, &credentials, sizeof(credentials));
     memset(&connection->error, '\0', CURL_ERROR_SIZE);
 
     http_request_init(&connection->request);
     http_response_init(&connection->response);
+    arena_init(&connection->arena);
 
     _trace("scrobbler::connection_init[%s][%p]:curl_easy_handle(%p)", get_api_type_label(credentials.end_point), connection, connection->handle);
 }
@@ -98,7 +168,7 @@ static void scrobbler_connections_clean(struct scrobble_connections *connections
     }
     size_t cleaned = 0;
     size_t skipped = 0;
-    for (int i = MAX_QUEUE_LENGTH; i >= 0; i--) {
+    for (int i = MAX_QUEUE_LENGTH - 1; i >= 0; i--) {
         struct scrobbler_connection *conn = connections->entries[i];
         if (NULL == conn) {
             continue;
@@ -129,17 +199,23 @@ static bool scrobbler_queue_is_empty(const struct scrobble_queue *queue)
 
 bool configuration_folder_create(const char *);
 bool configuration_folder_exists(const char *);
-static bool queue_persist_to_file(const struct scrobble_queue *to_persist, const char* path)
+/*
+ * The delivery masks are saved with the accounts their bits stood for, so the tracks can be matched to the
+ * accounts again when the credentials changed between the runs.
+ */
+static bool queue_persist_to_file(const struct scrobble_queue *to_persist, const struct api_credentials *credentials, const size_t credentials_count, const char* path)
 {
     bool status = false;
 
     if (NULL == to_persist || NULL == path) { return status; }
-    if (to_persist->length > 0) { return status; }
+    if (to_persist->length == 0) { return status; }
 
-    char *file_path = (char *)path;
-    char *folder_path = dirname(file_path);
-    if (!configuration_folder_exists(folder_path) && !configuration_folder_create(folder_path)) {
-        _error("main::cache: unable to create cache folder %s", folder_path);
+    // NOTE(marius): dirname() can modify its argument, so we work on a copy of the path
+    char folder_path[FILE_PATH_MAX+1] = {0};
+    memcpy(folder_path, path, min(FILE_PATH_MAX, strlen(path)));
+    const char *folder = dirname(folder_path);
+    if (!configuration_folder_exists(folder) && !configuration_folder_create(folder)) {
+        _error("main::cache: unable to create cache folder %s", folder);
         goto _exit;
     }
 
@@ -149,10 +225,24 @@ static bool queue_persist_to_file(const struct scrobble_queue *to_persist, const
         _warn("saving::queue:failed: %s", path);
         goto _exit;
     }
-    const size_t wrote = fwrite(to_persist, sizeof(to_persist), 1, file);
-    status = wrote == sizeof(to_persist);
+    struct queue_account accounts[MAX_CREDENTIALS] = {0};
+    const uint32_t account_count = (uint32_t)min(credentials_count, MAX_CREDENTIALS);
+    for (uint32_t i = 0; i < account_count; i++) {
+        accounts[i].end_point = (int32_t)credentials[i].end_point;
+        strncpy(accounts[i].account, credentials[i].account, USER_NAME_MAX);
+    }
+
+    // NOTE(marius): the file holds the queue header followed by the queued entries and the accounts
+    const size_t length = (size_t)to_persist->length;
+    size_t wrote = fwrite(&to_persist->length, sizeof(to_persist->length), 1, file);
+    wrote += fwrite(&to_persist->last_id, sizeof(to_persist->last_id), 1, file);
+    wrote += fwrite(to_persist->deliveries, sizeof(to_persist->deliveries), 1, file);
+    wrote += fwrite(to_persist->entries, sizeof(struct scrobble), length, file);
+    wrote += fwrite(&account_count, sizeof(account_count), 1, file);
+    wrote += fwrite(accounts, sizeof(accounts), 1, file);
+    status = wrote == 5 + length;
     if (!status) {
-        _warn("saving::queue:unable to save full file %zu vs. %zu", wrote, sizeof(to_persist));
+        _warn("saving::queue:unable to save full file %zu vs. %zu entries", wrote, 5 + length);
     }
 
     fclose(file);
@@ -161,30 +251,198 @@ _exit:
     return status;
 }
 
-static bool queue_append(struct scrobble_queue *, const struct scrobble *);
+/*
+ * Loads the queue and the accounts of its delivery masks, account_count is -1 for the files saved without
+ * them, whose bits are the positions of the accounts in the current configuration.
+ */
+static bool queue_load_from_file(struct scrobble_queue *queue, struct queue_account accounts[MAX_CREDENTIALS], int *account_count, const char* path)
+{
+    bool status = false;
+    if (NULL == queue || NULL == path) { return status; }
+
+    FILE *file = fopen(path, "r");
+    if (NULL == file) {
+        return status;
+    }
+    struct scrobble_queue loaded = {0};
+    size_t read = fread(&loaded.length, sizeof(loaded.length), 1, file);
+    read += fread(&loaded.last_id, sizeof(loaded.last_id), 1, file);
+    read += fread(loaded.deliveries, sizeof(loaded.deliveries), 1, file);
+    if (read != 3 || loaded.length < 0 || loaded.length > MAX_QUEUE_LENGTH) {
+        goto _invalid;
+    }
+    if (loaded.length > 0) {
+        arraddn(loaded.entries, loaded.length);
+        read += fread(loaded.entries, sizeof(struct scrobble), (size_t)loaded.length, file);
+    }
+    if (read != 3 + (size_t)loaded.length) {
+        goto _invalid;
+    }
+    // NOTE(marius): the files saved by the previous versions end after the queued entries
+    uint32_t saved_accounts = 0;
+    struct queue_account loaded_accounts[MAX_CREDENTIALS] = {0};
+    int loaded_account_count = -1;
+    if (fread(&saved_accounts, sizeof(saved_accounts), 1, file) == 1) {
+        if (saved_accounts > MAX_CREDENTIALS || fread(loaded_accounts, sizeof(loaded_accounts), 1, file) != 1) {
+            goto _invalid;
+        }
+        loaded_account_count = (int)saved_accounts;
+    }
+    // NOTE(marius): anything else after them means the file was written by a different version
+    if (fgetc(file) != EOF) {
+        goto _invalid;
+    }
+    for (int pos = 0; pos < loaded.length; pos++) {
+        loaded.deliveries[pos].in_flight = 0;
+    }
+    arrfree(queue->entries);
+    memcpy(queue, &loaded, sizeof(*queue));
+    loaded.entries = NULL;
+    memcpy(accounts, loaded_accounts, sizeof(loaded_accounts));
+    *account_count = loaded_account_count;
+    _debug("loading::queue[%u]: %s", queue->length, path);
+    status = true;
+    goto _exit;
+
+_invalid:
+    _warn("loading::queue:invalid_file: %s", path);
+_exit:
+    arrfree(loaded.entries);
+    fclose(file);
+    return status;
+}
+
 static bool scrobbler_persist_queue(const struct scrobbler *scrobbler)
 {
-    if (NULL == scrobbler || scrobbler_queue_is_empty(&scrobbler->queue)) {
+    if (NULL == scrobbler || NULL == scrobbler->conf) {
+        return false;
+    }
+    if (scrobbler_queue_is_empty(&scrobbler->queue)) {
+        // NOTE(marius): remove the queue loaded at start-up, so we don't submit it again
+        unlink(scrobbler->conf->cache_path);
         return false;
     }
 
-    return queue_persist_to_file(&scrobbler->queue, scrobbler->conf->cache_path);
+    return queue_persist_to_file(&scrobbler->queue, scrobbler->conf->credentials, scrobbler->conf->credentials_count, scrobbler->conf->cache_path);
+}
+
+static bool scrobbler_persist_fingerprints(const struct scrobbler *scrobbler)
+{
+    bool status = false;
+    if (NULL == scrobbler || NULL == scrobbler->conf) { return status; }
+    if (scrobbler->fingerprints.count == 0) { return status; }
+
+    const char *path = scrobbler->conf->fingerprints_path;
+    char folder_path[FILE_PATH_MAX+1] = {0};
+    memcpy(folder_path, path, min(FILE_PATH_MAX, strlen(path)));
+    const char *folder = dirname(folder_path);
+    if (!configuration_folder_exists(folder) && !configuration_folder_create(folder)) {
+        _error("main::cache: unable to create cache folder %s", folder);
+        return status;
+    }
+
+    FILE *file = fopen(path, "w+");
+    if (NULL == file) {
+        _warn("saving::fingerprints:failed: %s", path);
+        return status;
+    }
+    status = fingerprint_cache_write(&scrobbler->fingerprints, file);
+    if (status) {
+        _debug("saving::fingerprints[%u]: %s", scrobbler->fingerprints.count, path);
+    } else {
+        _warn("saving::fingerprints:unable to save full file: %s", path);
+    }
+    fclose(file);
+    return status;
+}
+
+static bool fingerprints_load_from_file(struct fingerprint_cache *fingerprints, const char *path)
+{
+    bool status = false;
+    if (NULL == fingerprints || NULL == path) { return status; }
+
+    FILE *file = fopen(path, "r");
+    if (NULL == file) {
+        return status;
+    }
+    status = fingerprint_cache_read(fingerprints, file);
+    if (status) {
+        _debug("loading::fingerprints[%u]: %s", fingerprints->count, path);
+    } else {
+        _warn("loading::fingerprints:invalid_file: %s", path);
+    }
+    fclose(file);
+    return status;
+}
+
+/*
+ * Builds the request templates of the accounts that don't have one yet.
+ */
+static void scrobbler_templates_build(struct scrobbler *s)
+{
+    if (NULL == s->conf) { return; }
+
+    for (size_t i = 0; i < s->conf->credentials_count && i < MAX_CREDENTIALS; i++) {
+        struct api_request_template *template = &s->services[i].template;
+        if (NULL != template->url) { continue; }
+
+        const struct api_credentials *cur = &s->conf->credentials[i];
+        if (api_request_template_init(template, cur)) {
+            _trace("scrobbler::template[%s]: built for %s", get_api_type_label(cur->end_point), cur->account);
+        }
+    }
+}
+
+static void scrobbler_templates_clean(struct scrobbler *s)
+{
+    for (size_t i = 0; i < MAX_CREDENTIALS; i++) {
+        api_request_template_clean(&s->services[i].template);
+    }
+}
+
+/*
+ * The cache of the track details is allocated with the first request, the scrobbler doesn't need it before
+ * it sends something. Without it the details are derived again for each request.
+ */
+static struct track_cache *scrobbler_track_cache(struct scrobbler *s)
+{
+    if (NULL == s->tracks) {
+        s->tracks = calloc(1, sizeof(struct track_cache));
+        if (NULL == s->tracks) {
+            _warn("scrobbler::track_cache: unable to allocate %zu bytes", sizeof(struct track_cache));
+        }
+    }
+    return s->tracks;
 }
 
 static void scrobbler_clean(struct scrobbler *s)
 {
     if (NULL == s) { return; }
 
-    scrobbler_persist_queue(s);
-
     _trace("scrobbler::clean[%p]", s);
 
     scrobbler_connections_clean(&s->connections, true);
+    scrobbler_templates_clean(s);
+    for (int i = 0; i < REQUEST_CLASS_COUNT; i++) {
+        const struct request_class_stats *stats = &s->scheduler.stats[i];
+        if (stats->sent == 0 && stats->shed == 0) { continue; }
+        _info("scrobbler::scheduler[%s]: %u sent, %u shed, %u preempted, %u connections, waited %.3lfms on average, %.3lfms max",
+              get_request_class_label(i), stats->sent, stats->shed, stats->preempted, stats->connects,
+              stats->sent > 0 ? stats->wait_total / stats->sent : 0.0, stats->wait_max);
+    }
 
     if(evtimer_initialized(&s->timer_event) && evtimer_pending(&s->timer_event, NULL)) {
         _trace2("curl::multi_timer_remove(%p)", &s->timer_event);
         evtimer_del(&s->timer_event);
     }
+    if(evtimer_initialized(&s->backoff_event) && evtimer_pending(&s->backoff_event, NULL)) {
+        evtimer_del(&s->backoff_event);
+    }
+
+    arrfree(s->queue.entries);
+    s->queue.length = 0;
+    free(s->tracks);
+    s->tracks = NULL;
 
     curl_multi_cleanup(s->handle);
     curl_global_cleanup();
@@ -206,6 +464,36 @@ static struct scrobbler_connection *scrobbler_connection_get(const struct scrobb
     return conn;
 }
 
+typedef bool(*request_builder_t)(struct http_request*, const struct scrobble*[MAX_QUEUE_LENGTH], const unsigned, const struct api_credentials*, const struct api_request_template*, struct track_cache*, struct arena*);
+static unsigned scrobbler_send_queue(struct scrobbler *, const request_builder_t);
+
+static void backoff_cb(int fd, short kind, void *data)
+{
+    assert(data);
+
+    struct scrobbler *s = data;
+    _trace("scrobbler::backoff_expired[%p]", s);
+    scrobbler_send_queue(s, api_build_request_scrobble);
+}
+
+/*
+ * With HTTP/2 the requests to the same host are sent as streams on a single connection, instead of each
+ * waiting for a connection of its own. It can be changed by reloading the configuration.
+ */
+static void scrobbler_http_setup(struct scrobbler *s)
+{
+    const struct configuration *config = s->conf;
+    if (NULL == s->handle || NULL == config) { return; }
+
+    curl_multi_setopt(s->handle, CURLMOPT_PIPELINING, config->http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+#if LIBCURL_VERSION_NUM >= 0x074300
+    if (config->http2) {
+        curl_multi_setopt(s->handle, CURLMOPT_MAX_CONCURRENT_STREAMS, config->http2_streams);
+    }
+#endif
+    _debug("scrobbler::http: %s", config->http2 ? "HTTP/2" : "HTTP/1.1");
+}
+
 static void scrobbler_init(struct scrobbler *s, struct configuration *config, struct event_base *evbase)
 {
     curl_global_init(CURL_GLOBAL_DEFAULT);
@@ -215,19 +503,24 @@ static void scrobbler_init(struct scrobbler *s, struct configuration *config, st
     s->evbase = evbase;
 
     evtimer_assign(&s->timer_event, s->evbase, timer_cb, s);
+    evtimer_assign(&s->backoff_event, s->evbase, backoff_cb, s);
     _trace2("curl::multi_timer_add(%p:%p)", s->handle, &s->timer_event);
 
     curl_multi_setopt(s->handle, CURLMOPT_SOCKETFUNCTION, curl_request_has_data);
     curl_multi_setopt(s->handle, CURLMOPT_SOCKETDATA, s);
     curl_multi_setopt(s->handle, CURLMOPT_TIMERFUNCTION, curl_request_wait_timeout);
     curl_multi_setopt(s->handle, CURLMOPT_TIMERDATA, s);
-    curl_multi_setopt(s->handle, CURLMOPT_MAX_TOTAL_CONNECTIONS, MAX_CREDENTIALS*2L);
+    // NOTE(marius): the connections are pooled per host, so the accounts of a service share them instead of adding new ones
     curl_multi_setopt(s->handle, CURLMOPT_MAX_HOST_CONNECTIONS, 2L);
+    scrobbler_http_setup(s);
 
     s->connections.length = 0;
+    memset(s->services, 0x0, sizeof(s->services));
+    fingerprint_cache_init(&s->fingerprints);
+    s->tracks = NULL;
+    scrobbler_templates_build(s);
 }
 
-typedef void(*request_builder_t)(struct http_request*, const struct scrobble*[MAX_QUEUE_LENGTH], const unsigned, const struct api_credentials*, CURL*);
 typedef bool(*request_validation_t)(const struct scrobble*, const struct api_credentials*);
 
 static bool scrobble_is_valid(const struct scrobble *m, const struct api_credentials *cur)
@@ -247,13 +540,169 @@ static bool scrobble_is_valid(const struct scrobble *m, const struct api_credent
     }
 }
 
-static void api_request_do(struct scrobbler *s, const struct scrobble *tracks[], const unsigned track_count, const request_validation_t validate_request, const request_builder_t build_request)
+static int scrobbler_connection_slot(const struct scrobble_connections *connections)
+{
+    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+        if (NULL == connections->entries[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void scrobbler_connection_drop(struct scrobbler *s, struct scrobbler_connection *conn)
+{
+    s->connections.entries[conn->idx] = NULL;
+    s->connections.length--;
+    conn->waiting = false;
+    scrobbler_connection_free(conn, true);
+}
+
+/*
+ * The waiting now playing requests of an account are dropped when a newer one is added, or when a
+ * higher class needs their slot.
+ */
+static bool scrobbler_shed(struct scrobbler *s, const int credentials_idx)
+{
+    struct scrobbler_connection *oldest = NULL;
+    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+        struct scrobbler_connection *conn = s->connections.entries[i];
+        if (NULL == conn || !conn->waiting || conn->priority != request_now_playing) { continue; }
+        if (credentials_idx >= 0 && conn->credentials_idx != credentials_idx) { continue; }
+        if (NULL == oldest || conn->queued_at < oldest->queued_at) {
+            oldest = conn;
+        }
+    }
+    if (NULL == oldest) { return false; }
+
+    _debug("scrobbler::scheduler[%s]: shedding request for %s", get_request_class_label(oldest->priority), get_api_type_label(oldest->credentials.end_point));
+    s->scheduler.stats[oldest->priority].shed++;
+    scrobbler_connection_drop(s, oldest);
+    return true;
+}
+
+static void scrobbler_preempt(struct scrobbler *s, const enum request_class waiting)
+{
+    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+        struct scrobbler_connection *conn = s->connections.entries[i];
+        if (NULL == conn || !conn->running || conn->priority <= waiting) { continue; }
+
+        _debug("scrobbler::scheduler[%s]: preempted by %s", get_request_class_label(conn->priority), get_request_class_label(waiting));
+        s->scheduler.stats[conn->priority].preempted++;
+        scrobbler_connection_drop(s, conn);
+        return;
+    }
+}
+
+/*
+ * Starts the waiting requests in the order of their class, and of the time they were added in.
+ */
+static void scrobbler_schedule(struct scrobbler *s)
+{
+    struct request_scheduler *scheduler = &s->scheduler;
+    while (true) {
+        struct scrobbler_connection *next = NULL;
+        for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+            struct scrobbler_connection *conn = s->connections.entries[i];
+            if (NULL == conn || !conn->waiting) { continue; }
+            if (NULL == next || conn->priority < next->priority ||
+                (conn->priority == next->priority && conn->queued_at < next->queued_at)) {
+                next = conn;
+            }
+        }
+        if (NULL == next) { return; }
+        if (scheduler->running >= REQUEST_MAX_RUNNING) {
+            if (next->priority == request_now_playing) { return; }
+            const unsigned running = scheduler->running;
+            scrobbler_preempt(s, next->priority);
+            if (scheduler->running == running) { return; }
+        }
+
+        struct request_class_stats *stats = &scheduler->stats[next->priority];
+        const double waited = monotonic_milliseconds() - next->queued_at;
+        stats->sent++;
+        stats->wait_total += waited;
+        if (waited > stats->wait_max) { stats->wait_max = waited; }
+        _trace("scrobbler::scheduler[%s]: starting after %.3lfms, %u running", get_request_class_label(next->priority), waited, scheduler->running);
+
+        next->waiting = false;
+        next->running = true;
+        time(&next->request.time);
+        scheduler->running++;
+        curl_multi_add_handle(s->handle, next->handle);
+    }
+}
+
+static void scrobbler_connection_done(struct scrobbler *s, struct scrobbler_connection *conn)
+{
+    if (!conn->running) { return; }
+    conn->running = false;
+    s->scheduler.running--;
+}
+
+/*
+ * Accounts of the same service and server receive the same payload for the same tracks.
+ */
+static bool credentials_share_payload(const struct api_credentials *a, const struct api_credentials *b)
+{
+    return a->end_point == b->end_point && strncmp(a->url, b->url, MAX_URL_LENGTH) == 0;
+}
+
+/*
+ * When shared is not NULL, it's a connection to another account with the same payload, and its request
+ * is reused if the service allows it.
+ * When the request can't be built, no connection is added and build_failed is set, if it's not NULL.
+ */
+static struct scrobbler_connection *scrobbler_connection_add(struct scrobbler *s, const int credentials_idx, const struct scrobble *tracks[], const unsigned track_count, const request_builder_t build_request, const struct scrobbler_connection *shared, const enum request_class priority, bool *build_failed)
+{
+    const struct api_credentials *cur = &s->conf->credentials[credentials_idx];
+    const struct api_request_template *template = &s->services[credentials_idx].template;
+
+    if (priority == request_now_playing) {
+        // NOTE(marius): only the latest now playing request matters
+        scrobbler_shed(s, credentials_idx);
+    }
+    int idx = scrobbler_connection_slot(&s->connections);
+    if (idx < 0 && priority < request_now_playing && scrobbler_shed(s, -1)) {
+        idx = scrobbler_connection_slot(&s->connections);
+    }
+    if (idx < 0) {
+        _warn("scrobbler::new_connection[%s]: too many connections in flight", get_api_type_label(cur->end_point));
+        return NULL;
+    }
+
+    struct scrobbler_connection *conn = scrobbler_connection_new();
+    scrobbler_connection_init(conn, s, *cur, idx);
+    conn->credentials_idx = credentials_idx;
+    conn->priority = priority;
+    if (NULL == shared || !api_build_request_from(&conn->request, &shared->request, cur, template)) {
+        if (!build_request(&conn->request, tracks, track_count, cur, template, scrobbler_track_cache(s), &conn->arena)) {
+            _warn("scrobbler::new_connection[%s]: unable to build the request for %u tracks", get_api_type_label(cur->end_point), track_count);
+            scrobbler_connection_free(conn, true);
+            if (NULL != build_failed) { *build_failed = true; }
+            return NULL;
+        }
+    }
+    s->connections.entries[conn->idx] = conn;
+    s->connections.length++;
+    _trace("scrobbler::new_connection[%s]: connections: %zu ", get_api_type_label(cur->end_point), s->connections.length);
+
+    build_curl_request(conn);
+
+    conn->waiting = true;
+    conn->queued_at = monotonic_milliseconds();
+    scrobbler_schedule(s);
+    return conn;
+}
+
+static void api_request_do(struct scrobbler *s, const struct scrobble *tracks[], const unsigned track_count, const request_validation_t validate_request, const request_builder_t build_request, const enum request_class priority)
 {
     if (NULL == s) { return; }
     if (NULL == s->conf || 0 == s->conf->credentials_count) { return; }
 
     const size_t credentials_count = s->conf->credentials_count;
 
+    const struct scrobbler_connection *built[MAX_CREDENTIALS] = {0};
     for (size_t i = 0; i < credentials_count; i++) {
         const struct api_credentials *cur = &s->conf->credentials[i];
         if (!credentials_valid(cur)) {
@@ -275,22 +724,498 @@ static void api_request_do(struct scrobbler *s, const struct scrobble *tracks[],
             _warn("scrobbler::invalid_now_playing[%s]: no valid tracks", get_api_type_label(cur->end_point));
             continue;
         }
-        assert(s->connections.length < MAX_QUEUE_LENGTH);
-        if (s->connections.length == MAX_QUEUE_LENGTH) {
-            s->connections.length = 0;
+        // NOTE(marius): the tracks are validated per service, so all the accounts of a service get the same ones
+        const struct scrobbler_connection *shared = NULL;
+        for (size_t j = 0; j < i && NULL == shared; j++) {
+            if (NULL != built[j] && credentials_share_payload(&s->conf->credentials[j], cur)) {
+                shared = built[j];
+            }
+        }
+        built[i] = scrobbler_connection_add(s, (int)i, current_api_tracks, current_api_track_count, build_request, shared, priority, NULL);
+    }
+}
+
+static unsigned scrobbler_valid_credentials_mask(const struct scrobbler *s)
+{
+    unsigned mask = 0;
+    if (NULL == s->conf) { return mask; }
+
+    for (size_t i = 0; i < s->conf->credentials_count; i++) {
+        if (credentials_valid(&s->conf->credentials[i])) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+}
+
+static void scrobbler_dead_letter(const struct scrobbler *s, const struct scrobble *track, const struct api_credentials *cur, const enum dead_letter_reason reason, const int code)
+{
+    struct dead_letter letter = {
+        .state = DEAD_LETTER_STATE_PENDING,
+        .end_point = cur->end_point,
+        .reason = reason,
+        .code = code,
+        .rejected_at = time(0),
+    };
+    strncpy(letter.account, cur->account, USER_NAME_MAX);
+    memcpy(&letter.scrobble, track, sizeof(letter.scrobble));
+
+    const size_t id = dead_letter_append(s->conf->dead_letter_path, &letter);
+    _warn("scrobbler::dead_letter[%s]: %s(%d) %s//%s//%s, id %zu", get_api_type_label(cur->end_point),
+        get_dead_letter_reason_label(reason), code, track->title, track->artist[0], track->album, id);
+}
+
+static unsigned queue_in_flight_mask(const struct scrobble_queue *queue)
+{
+    unsigned mask = 0;
+    for (int pos = 0; pos < queue->length; pos++) {
+        mask |= queue->deliveries[pos].in_flight;
+    }
+    return mask;
+}
+
+static void scrobbler_backoff_schedule(struct scrobbler *s, const time_t delay)
+{
+    if (NULL == s->evbase) { return; }
+
+    const struct timeval timeout = { .tv_sec = delay > 0 ? delay : 1, .tv_usec = 0, };
+    evtimer_add(&s->backoff_event, &timeout);
+}
+
+/*
+ * A service that didn't acknowledge any track waits twice as long after each failure, so a service
+ * which is down doesn't delay the others, and its tracks stay in the queue until it comes back.
+ */
+static void scrobbler_service_update(struct scrobbler *s, const int credentials_idx, const bool failed)
+{
+    struct scrobbler_service *service = &s->services[credentials_idx];
+    const char *label = get_api_type_label(s->conf->credentials[credentials_idx].end_point);
+    if (!failed) {
+        if (service->failures > 0) {
+            _info("scrobbler::backoff[%s]: recovered after %u failures", label, service->failures);
+        }
+        service->failures = 0;
+        service->retry_at = 0;
+        return;
+    }
+
+    service->failures++;
+    time_t delay = BACKOFF_MAX_SECONDS;
+    if (service->failures < BACKOFF_MAX_SHIFT) {
+        delay = min(BACKOFF_BASE_SECONDS << (service->failures - 1), BACKOFF_MAX_SECONDS);
+    }
+    service->retry_at = time(0) + delay;
+    _warn("scrobbler::backoff[%s]: failure %u, retrying in %lds", label, service->failures, (long)delay);
+}
+
+/*
+ * Sends the track on its own, a track that doesn't fit in a request by itself is dead lettered.
+ */
+static unsigned scrobbler_send_isolated(struct scrobbler *s, const size_t credentials_idx, const int pos, const request_builder_t build_request)
+{
+    struct scrobble_delivery *delivery = &s->queue.deliveries[pos];
+    const struct scrobble *single[1] = {&s->queue.entries[pos]};
+    const unsigned bit = 1U << credentials_idx;
+
+    bool build_failed = false;
+    struct scrobbler_connection *conn = scrobbler_connection_add(s, (int)credentials_idx, single, 1, build_request, NULL, request_scrobble, &build_failed);
+    if (build_failed) {
+        delivery->pending &= ~bit;
+        scrobbler_dead_letter(s, single[0], &s->conf->credentials[credentials_idx], dead_letter_invalid, 0);
+        return 0;
+    }
+    if (NULL == conn) { return 0; }
+    conn->track_ids[0] = delivery->id;
+    conn->track_count = 1;
+    delivery->in_flight |= bit;
+    return 1;
+}
+
+/*
+ * Sends all queued tracks that are not already in flight, grouped in one request per service.
+ * The tracks stay in the queue until each service acknowledges them in scrobbler_connection_acknowledge.
+ */
+static unsigned scrobbler_send_queue(struct scrobbler *s, const request_builder_t build_request)
+{
+    if (NULL == s->conf) { return 0; }
+
+    struct scrobble_queue *queue = &s->queue;
+    if (s->paused != scrobbler_running) {
+        _debug("scrobbler::paused: %d scrobbles waiting", queue->length);
+        return 0;
+    }
+    const time_t now = time(0);
+    time_t retry_at = 0;
+    unsigned sent = 0;
+
+    // NOTE(marius): the batches sent in this call, so accounts with the same tracks can share the payload
+    const struct scrobbler_connection *built[MAX_CREDENTIALS] = {0};
+    unsigned built_counts[MAX_CREDENTIALS] = {0};
+    int built_positions[MAX_CREDENTIALS][MAX_QUEUE_LENGTH] = {0};
+    for (size_t i = 0; i < s->conf->credentials_count; i++) {
+        const struct api_credentials *cur = &s->conf->credentials[i];
+        if (!credentials_valid(cur)) { continue; }
+
+        const unsigned bit = 1U << i;
+        const struct scrobbler_service *service = &s->services[i];
+        if (service->retry_at > now) {
+            _debug("scrobbler::backoff[%s]: retrying in %.0lfs", get_api_type_label(cur->end_point), difftime(service->retry_at, now));
+            if (retry_at == 0 || service->retry_at < retry_at) {
+                retry_at = service->retry_at;
+            }
+            continue;
+        }
+        if (queue_in_flight_mask(queue) & bit) {
+            // NOTE(marius): each service has one batch in flight at most, the rest is sent once it's acknowledged
+            continue;
+        }
+        const struct scrobble *tracks[MAX_QUEUE_LENGTH] = {0};
+        int positions[MAX_QUEUE_LENGTH] = {0};
+        unsigned track_count = 0;
+        for (int pos = 0; pos < queue->length; pos++) {
+            struct scrobble_delivery *delivery = &queue->deliveries[pos];
+            if (!(delivery->pending & bit) || (delivery->in_flight & bit)) { continue; }
+
+            const struct scrobble *track = &queue->entries[pos];
+            if (!scrobble_is_valid(track, cur)) {
+                delivery->pending &= ~bit;
+                scrobbler_dead_letter(s, track, cur, dead_letter_invalid, 0);
+                continue;
+            }
+            if (delivery->isolated & bit) {
+                sent += scrobbler_send_isolated(s, i, pos, build_request);
+                continue;
+            }
+            tracks[track_count] = track;
+            positions[track_count] = pos;
+            track_count++;
         }
+        if (track_count == 0) { continue; }
 
-        struct scrobbler_connection *conn = scrobbler_connection_new();
-        scrobbler_connection_init(conn, s, *cur, s->connections.length);
-        build_request(&conn->request, current_api_tracks, current_api_track_count, cur, conn->handle);
-        s->connections.entries[conn->idx] = conn;
-        s->connections.length++;
-        _trace("scrobbler::new_connection[%s]: connections: %zu ", get_api_type_label(cur->end_point), s->connections.length);
+        const struct scrobbler_connection *shared = NULL;
+        for (size_t j = 0; j < i && NULL == shared; j++) {
+            if (NULL != built[j] && built_counts[j] == track_count && credentials_share_payload(&s->conf->credentials[j], cur) &&
+                memcmp(built_positions[j], positions, track_count * sizeof(positions[0])) == 0) {
+                shared = built[j];
+            }
+        }
+        bool build_failed = false;
+        struct scrobbler_connection *conn = scrobbler_connection_add(s, (int)i, tracks, track_count, build_request, shared, request_scrobble, &build_failed);
+        if (build_failed) {
+            // NOTE(marius): the batch doesn't fit in a request, so the tracks are sent on their own to find the one at fault
+            for (unsigned ti = 0; ti < track_count; ti++) {
+                queue->deliveries[positions[ti]].isolated |= bit;
+                sent += scrobbler_send_isolated(s, i, positions[ti], build_request);
+            }
+            continue;
+        }
+        if (NULL == conn) { continue; }
+        built[i] = conn;
+        built_counts[i] = track_count;
+        memcpy(built_positions[i], positions, sizeof(positions));
+        for (unsigned ti = 0; ti < track_count; ti++) {
+            struct scrobble_delivery *delivery = &queue->deliveries[positions[ti]];
+            conn->track_ids[ti] = delivery->id;
+            delivery->in_flight |= bit;
+        }
+        conn->track_count = track_count;
+        sent += track_count;
+    }
+    queue_compact(queue);
+    if (retry_at > 0) {
+        scrobbler_backoff_schedule(s, retry_at - now);
+    }
+
+    return sent;
+}
+
+static const char *get_scrobbler_pause_label(const enum scrobbler_pause reason)
+{
+    switch (reason) {
+        case scrobbler_offline:
+            return "offline";
+        case scrobbler_sleeping:
+            return "sleeping";
+        case scrobbler_running:
+        default:
+            return "running";
+    }
+}
 
-        build_curl_request(conn);
+/*
+ * The tracks played while the system is asleep or offline stay in the queue, which is persisted so they
+ * survive if the system doesn't wake up.
+ */
+static void scrobbler_pause(struct scrobbler *s, const enum scrobbler_pause reason)
+{
+    if (s->paused & reason) { return; }
+
+    s->paused |= reason;
+    s->drain_started = 0;
+    _info("scrobbler::pause[%s]: %d scrobbles waiting", get_scrobbler_pause_label(reason), s->queue.length);
+    if (!scrobbler_queue_is_empty(&s->queue)) {
+        scrobbler_persist_queue(s);
+    }
+    scrobbler_persist_fingerprints(s);
+}
+
+/*
+ * The failures from while the system was offline say nothing about the services, so the backoff is
+ * dropped and the backlog is sent right away, one batch per service at a time.
+ */
+static void scrobbler_resume(struct scrobbler *s, const enum scrobbler_pause reason)
+{
+    if (!(s->paused & reason)) { return; }
+
+    s->paused &= ~reason;
+    _info("scrobbler::resume[%s]: %d scrobbles waiting", get_scrobbler_pause_label(reason), s->queue.length);
+    if (s->paused != scrobbler_running) { return; }
+
+    // NOTE(marius): only the backoff is reset, the request templates stay in use
+    for (size_t i = 0; i < MAX_CREDENTIALS; i++) {
+        s->services[i].failures = 0;
+        s->services[i].retry_at = 0;
+    }
+    if (evtimer_initialized(&s->backoff_event) && evtimer_pending(&s->backoff_event, NULL)) {
+        evtimer_del(&s->backoff_event);
+    }
+    if (scrobbler_queue_is_empty(&s->queue)) { return; }
+
+    s->drain_started = monotonic_milliseconds();
+    scrobbler_send_queue(s, api_build_request_scrobble);
+}
+
+static bool credentials_same_account(const struct api_credentials *a, const struct api_credentials *b)
+{
+    return a->end_point == b->end_point && strncmp(a->account, b->account, USER_NAME_MAX) == 0;
+}
+
+static bool credentials_equal(const struct api_credentials *a, const struct api_credentials *b)
+{
+    return credentials_same_account(a, b) && a->enabled == b->enabled &&
+        strncmp(a->api_key, b->api_key, MAX_SECRET_LENGTH) == 0 &&
+        strncmp(a->secret, b->secret, MAX_SECRET_LENGTH) == 0 &&
+        strncmp(a->user_name, b->user_name, USER_NAME_MAX) == 0 &&
+        strncmp(a->password, b->password, MAX_SECRET_LENGTH) == 0 &&
+        strncmp(a->token, b->token, MAX_SECRET_LENGTH) == 0 &&
+        strncmp(a->session_key, b->session_key, MAX_SECRET_LENGTH) == 0 &&
+        strncmp(a->url, b->url, MAX_URL_LENGTH) == 0;
+}
+
+static unsigned remap_mask(const unsigned mask, const int map[MAX_CREDENTIALS])
+{
+    unsigned result = 0;
+    for (int i = 0; i < MAX_CREDENTIALS; i++) {
+        if ((mask & (1U << i)) && map[i] >= 0) {
+            result |= 1U << map[i];
+        }
+    }
+    return result;
+}
+
+/*
+ * Loads the queue saved by the previous run, and moves the bits of its delivery masks to the positions of
+ * the same accounts in the configuration, like scrobbler_reload does.
+ * The tracks still pending for the accounts that are no longer configured are dead lettered, for the files
+ * saved without the accounts that's any bit past the configured credentials.
+ */
+static bool scrobbler_load_queue(struct scrobbler *s)
+{
+    if (NULL == s || NULL == s->conf) { return false; }
+
+    struct configuration *config = s->conf;
+    struct scrobble_queue *queue = &s->queue;
+    struct queue_account accounts[MAX_CREDENTIALS] = {0};
+    int account_count = -1;
+    if (!queue_load_from_file(queue, accounts, &account_count, config->cache_path)) {
+        return false;
+    }
+
+    int map[MAX_CREDENTIALS];
+    for (int i = 0; i < MAX_CREDENTIALS; i++) {
+        map[i] = -1;
+    }
+    const int credentials_count = (int)min(config->credentials_count, MAX_CREDENTIALS);
+    if (account_count < 0) {
+        for (int i = 0; i < credentials_count; i++) {
+            map[i] = i;
+        }
+    }
+    for (int i = 0; i < account_count; i++) {
+        for (int j = 0; j < credentials_count; j++) {
+            const struct api_credentials *cur = &config->credentials[j];
+            if ((int32_t)cur->end_point != accounts[i].end_point || strncmp(cur->account, accounts[i].account, USER_NAME_MAX) != 0) { continue; }
+            map[i] = j;
+            break;
+        }
+    }
+
+    unsigned evicted = 0;
+    for (int pos = 0; pos < queue->length; pos++) {
+        struct scrobble_delivery *delivery = &queue->deliveries[pos];
+        for (int i = 0; i < MAX_CREDENTIALS; i++) {
+            if (map[i] >= 0 || !(delivery->pending & (1U << i))) { continue; }
+
+            struct api_credentials removed = { .end_point = (enum api_type)accounts[i].end_point, };
+            strncpy(removed.account, accounts[i].account, USER_NAME_MAX);
+            scrobbler_dead_letter(s, &queue->entries[pos], &removed, dead_letter_evicted, 0);
+            evicted++;
+        }
+        delivery->pending = remap_mask(delivery->pending, map);
+        delivery->isolated = remap_mask(delivery->isolated, map);
+    }
+    queue_compact(queue);
+    if (evicted > 0) {
+        _info("scrobbler::queue: %u scrobbles of accounts no longer configured were dead lettered", evicted);
+    }
+    return true;
+}
+
+/*
+ * Replaces the credentials of the scrobbler with the ones in fresh, keeping the connections and the
+ * queued tracks of the accounts that didn't change.
+ * The credentials are matched by service and account name, and since the queue keeps the delivery state
+ * of each account at its position in the credentials array, the masks are moved to the new positions.
+ * Returns true if any account was added or changed.
+ */
+static bool scrobbler_reload(struct scrobbler *s, struct configuration *fresh)
+{
+    struct configuration *config = s->conf;
+    struct scrobble_queue *queue = &s->queue;
+
+    // NOTE(marius): the new position of each of the current credentials, or -1 if it was removed or changed
+    int map[MAX_CREDENTIALS];
+    bool changed[MAX_CREDENTIALS] = {0};
+    unsigned unchanged_count = 0, changed_count = 0, removed_count = 0;
+    for (int i = 0; i < MAX_CREDENTIALS; i++) {
+        map[i] = -1;
+    }
+    for (size_t i = 0; i < config->credentials_count; i++) {
+        const struct api_credentials *cur = &config->credentials[i];
+        for (size_t j = 0; j < fresh->credentials_count; j++) {
+            if (!credentials_same_account(cur, &fresh->credentials[j])) { continue; }
+            map[i] = (int)j;
+            changed[i] = !credentials_equal(cur, &fresh->credentials[j]);
+            break;
+        }
+        if (map[i] < 0) {
+            removed_count++;
+        } else if (changed[i]) {
+            changed_count++;
+        } else {
+            unchanged_count++;
+        }
+    }
+    const unsigned added_count = (unsigned)fresh->credentials_count - unchanged_count - changed_count;
+
+    // NOTE(marius): the requests of changed or removed accounts are cancelled, their tracks go back to the queue
+    for (int i = MAX_QUEUE_LENGTH - 1; i >= 0; i--) {
+        struct scrobbler_connection *conn = s->connections.entries[i];
+        if (NULL == conn || conn->credentials_idx < 0) { continue; }
+        if (map[conn->credentials_idx] >= 0 && !changed[conn->credentials_idx]) { continue; }
+
+        _debug("scrobbler::reload[%s]: cancelling request", get_api_type_label(conn->credentials.end_point));
+        scrobbler_connection_free(conn, true);
+        s->connections.entries[i] = NULL;
+        s->connections.length--;
+    }
+
+    for (int pos = 0; pos < queue->length; pos++) {
+        struct scrobble_delivery *delivery = &queue->deliveries[pos];
+        for (size_t i = 0; i < config->credentials_count; i++) {
+            if (map[i] >= 0 || !(delivery->pending & (1U << i))) { continue; }
+            scrobbler_dead_letter(s, &queue->entries[pos], &config->credentials[i], dead_letter_evicted, 0);
+        }
+        delivery->pending = remap_mask(delivery->pending, map);
+        delivery->in_flight = remap_mask(delivery->in_flight, map);
+        delivery->isolated = remap_mask(delivery->isolated, map);
+    }
+    queue_compact(queue);
+
+    struct scrobbler_service services[MAX_CREDENTIALS] = {0};
+    for (size_t i = 0; i < config->credentials_count; i++) {
+        if (map[i] < 0 || changed[i]) {
+            // NOTE(marius): the requests using the template were cancelled above
+            api_request_template_clean(&s->services[i].template);
+            continue;
+        }
+        memcpy(&services[map[i]], &s->services[i], sizeof(services[map[i]]));
+    }
+    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+        struct scrobbler_connection *conn = s->connections.entries[i];
+        if (NULL == conn || conn->credentials_idx < 0) { continue; }
+        conn->credentials_idx = map[conn->credentials_idx];
+    }
+
+    memcpy(s->services, services, sizeof(s->services));
+    // NOTE(marius): the previous credentials are handed over to the fresh configuration, which frees them
+    struct api_credentials *previous = config->credentials;
+    const size_t previous_count = config->credentials_count;
+    config->credentials = fresh->credentials;
+    config->credentials_count = fresh->credentials_count;
+    fresh->credentials = previous;
+    fresh->credentials_count = previous_count;
+    scrobbler_templates_build(s);
+
+    _info("scrobbler::reload: %u unchanged, %u changed, %u added, %u removed accounts", unchanged_count, changed_count, added_count, removed_count);
+    return changed_count > 0 || added_count > 0;
+}
+
+static void scrobbler_connection_acknowledge(struct scrobbler *s, struct scrobbler_connection *conn)
+{
+    if (NULL == s || NULL == conn) { return; }
+    if (conn->acknowledged || conn->track_count == 0 || conn->credentials_idx < 0) { return; }
+
+    struct scrobble_ack acks[MAX_QUEUE_LENGTH] = {0};
+    api_response_get_scrobble_acks(&conn->response, conn->credentials.end_point, acks, conn->track_count);
+
+    struct scrobble_queue *queue = &s->queue;
+    const unsigned bit = 1U << conn->credentials_idx;
+    unsigned accepted = 0, retried = 0, ignored = 0, isolated = 0;
+    for (unsigned i = 0; i < conn->track_count; i++) {
+        const int pos = queue_find(queue, conn->track_ids[i]);
+        if (pos < 0) { continue; }
+
+        struct scrobble_delivery *delivery = &queue->deliveries[pos];
+        delivery->in_flight &= ~bit;
+        switch (acks[i].status) {
+            case scrobble_ack_accepted:
+                delivery->pending &= ~bit;
+                accepted++;
+                break;
+            case scrobble_ack_ignored:
+                delivery->pending &= ~bit;
+                scrobbler_dead_letter(s, &queue->entries[pos], &conn->credentials, dead_letter_ignored, acks[i].code);
+                ignored++;
+                break;
+            case scrobble_ack_rejected:
+                delivery->pending &= ~bit;
+                scrobbler_dead_letter(s, &queue->entries[pos], &conn->credentials, dead_letter_rejected, acks[i].code);
+                ignored++;
+                break;
+            case scrobble_ack_isolate:
+                delivery->isolated |= bit;
+                isolated++;
+                retried++;
+                break;
+            case scrobble_ack_retry:
+            default:
+                retried++;
+                break;
+        }
+    }
+    conn->acknowledged = true;
+    _info(" api::acknowledged[%s]: accepted %u, retrying %u, ignored %u", get_api_type_label(conn->credentials.end_point), accepted, retried, ignored);
 
-        curl_multi_add_handle(s->handle, conn->handle);
+    queue_compact(queue);
+    if (s->drain_started > 0 && scrobbler_queue_is_empty(queue)) {
+        s->drain_duration = monotonic_milliseconds() - s->drain_started;
+        s->drain_started = 0;
+        _info("scrobbler::backlog: drained in %.3lfs", s->drain_duration / 1000.0);
     }
+    scrobbler_service_update(s, conn->credentials_idx, isolated == 0 && retried == conn->track_count);
+    // NOTE(marius): the service is free to receive the tracks that were queued while this batch was in flight
+    scrobbler_send_queue(s, api_build_request_scrobble);
 }
 
 #endif // MPRIS_SCROBBLER_SCROBBLER_H
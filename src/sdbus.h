@@ -26,6 +26,7 @@
 #define MPRIS_METHOD_PAUSE         "Pause"
 #define MPRIS_METHOD_STOP          "Stop"
 #define MPRIS_METHOD_PLAY_PAUSE    "PlayPause"
+#define MPRIS_SIGNAL_SEEKED        "Seeked"
 
 #define MPRIS_PNAME_PLAYBACKSTATUS "PlaybackStatus"
 #define MPRIS_PNAME_CANCONTROL     "CanControl"
@@ -36,6 +37,7 @@
 #define MPRIS_PNAME_CANSEEK        "CanSeek"
 #define MPRIS_PNAME_SHUFFLE        "Shuffle"
 #define MPRIS_PNAME_POSITION       "Position"
+#define MPRIS_PNAME_RATE           "Rate"
 #define MPRIS_PNAME_VOLUME         "Volume"
 #define MPRIS_PNAME_LOOPSTATUS     "LoopStatus"
 #define MPRIS_PNAME_METADATA       "Metadata"
@@ -71,6 +73,19 @@
 #define DBUS_SIGNAL_PROPERTIES_CHANGED   "PropertiesChanged"
 #define DBUS_SIGNAL_NAME_OWNER_CHANGED   "NameOwnerChanged"
 
+#define LOGIND_PATH                         "/org/freedesktop/login1"
+#define LOGIND_INTERFACE                    "org.freedesktop.login1.Manager"
+#define LOGIND_SIGNAL_PREPARE_FOR_SLEEP     "PrepareForSleep"
+
+#define NETWORK_MANAGER_PATH                "/org/freedesktop/NetworkManager"
+#define NETWORK_MANAGER_INTERFACE           "org.freedesktop.NetworkManager"
+#define NETWORK_MANAGER_SIGNAL_STATE_CHANGED "StateChanged"
+#define NETWORK_MANAGER_STATE_UNKNOWN       0
+#define NETWORK_MANAGER_STATE_CONNECTED_GLOBAL 70
+
+#define SYSTEM_SLEEP_MATCH      "type='signal',interface='" LOGIND_INTERFACE "',member='" LOGIND_SIGNAL_PREPARE_FOR_SLEEP "',path='" LOGIND_PATH "'"
+#define SYSTEM_NETWORK_MATCH    "type='signal',interface='" NETWORK_MANAGER_INTERFACE "',member='" NETWORK_MANAGER_SIGNAL_STATE_CHANGED "',path='" NETWORK_MANAGER_PATH "'"
+
 static DBusMessage *send_dbus_message(DBusConnection *conn, DBusMessage *msg)
 {
     if (NULL == conn) { return NULL; }
@@ -462,7 +477,7 @@ static char *get_dbus_string_scalar(DBusMessage *message)
 }
 #endif
 
-static short load_valid_player_namespaces(DBusConnection *conn, struct mpris_player *players, const short max_player_count)
+static short load_valid_player_namespaces(DBusConnection *conn, struct mpris_player *players[MAX_PLAYERS], const short max_player_count)
 {
     short count = 0;
 
@@ -485,7 +500,14 @@ static short load_valid_player_namespaces(DBusConnection *conn, struct mpris_pla
             char value[MAX_PROPERTY_LENGTH + 1] = {0};
             extract_string_var(&arrayElementIter, value, &error);
             if (strncmp(value, mpris_namespace, strlen(mpris_namespace)) == 0) {
-                strncpy(players[count].mpris_name, value, MAX_PROPERTY_LENGTH+1);
+                if (NULL == players[count]) {
+                    players[count] = mpris_player_new();
+                }
+                if (NULL == players[count]) {
+                    _error("mem::player: unable to allocate");
+                    break;
+                }
+                strncpy(players[count]->mpris_name, value, MAX_PROPERTY_LENGTH+1);
                 count++;
             }
             dbus_message_iter_next(&arrayElementIter);
@@ -495,7 +517,7 @@ static short load_valid_player_namespaces(DBusConnection *conn, struct mpris_pla
     return count;
 }
 
-short load_player_namespaces(DBusConnection *conn, struct mpris_player *players, const short max_player_count)
+short load_player_namespaces(DBusConnection *conn, struct mpris_player *players[MAX_PLAYERS], const short max_player_count)
 {
     if (NULL == conn) { return -1; }
 
@@ -506,7 +528,7 @@ short load_player_namespaces(DBusConnection *conn, struct mpris_player *players,
     }
     // iterate over the namespaces and also load unique bus ids
     for (short i = 0; i < count; i++) {
-        struct mpris_player *player = &players[i];
+        struct mpris_player *player = players[i];
         // create a new method call and check for errors
         DBusMessage *reply = call_dbus_method(conn, player->mpris_name, MPRIS_PLAYER_PATH, DBUS_INTERFACE_PEER, DBUS_METHOD_PING);
         if (NULL != reply) {
@@ -555,6 +577,9 @@ static void print_mpris_properties(struct mpris_properties *properties, enum log
     if (whats_loaded & mpris_load_property_position) {
         _log(level, "   position: %" PRId64, properties->position);
     }
+    if (whats_loaded & mpris_load_property_rate) {
+        _log(level, "   rate: %.2f", properties->rate);
+    }
     if (whats_loaded & mpris_load_property_shuffle) {
         _log(level, "   shuffle: %s", (properties->shuffle ? "yes" : "no"));
     }
@@ -636,12 +661,12 @@ void print_mpris_player(struct mpris_player *pl, const enum log_levels level, co
 }
 
 #if 0
-static void print_mpris_players(struct mpris_player *players, int player_count, enum log_levels level)
+static void print_mpris_players(struct mpris_player *players[MAX_PLAYERS], int player_count, enum log_levels level)
 {
     for (int i = 0; i < player_count; i++) {
-        struct mpris_player pl = players[i];
-        _log(level, "  player[%d:%d]: %s %s", i, player_count, pl.mpris_name, pl.bus_id);
-        print_mpris_player(&pl, level, true);
+        struct mpris_player *pl = players[i];
+        _log(level, "  player[%d:%d]: %s %s", i, player_count, pl->mpris_name, pl->bus_id);
+        print_mpris_player(pl, level, true);
     }
 }
 #endif
@@ -715,6 +740,9 @@ static void load_properties(DBusMessageIter *rootIter, struct mpris_properties *
             extract_int64_var(&dictIter, &properties->position, &err);
             changes->position_changed = true;
             changes->loaded_state |= mpris_load_property_position;
+        } else if (!strncmp(key, MPRIS_PNAME_RATE, strlen(MPRIS_PNAME_RATE))) {
+            extract_double_var(&dictIter, &properties->rate, &err);
+            changes->loaded_state |= mpris_load_property_rate;
         } else if (!strncmp(key, MPRIS_PNAME_SHUFFLE, strlen(MPRIS_PNAME_SHUFFLE))) {
             extract_boolean_var(&dictIter, &properties->shuffle, &err);
             changes->loaded_state |= mpris_load_property_shuffle;
@@ -737,6 +765,7 @@ static void load_properties(DBusMessageIter *rootIter, struct mpris_properties *
     if (changes->loaded_state != mpris_load_nothing) {
         time(&changes->timestamp);
     }
+    mpris_properties_hash(properties);
     if (dbus_error_is_set(&err)) {
         _warn("dbus::iterator_error: %s", err.message);
         dbus_error_free(&err);
@@ -752,6 +781,17 @@ static void load_properties(DBusMessageIter *rootIter, struct mpris_properties *
         } \
     }
 
+// NOTE(marius): the string fields are compared by length and hash first, and copied together with them
+#define _copy_field_if_changed(a, b, field, whats_loaded, bitflag) \
+    if (whats_loaded & bitflag) { \
+        if (!_field_equals(a, b, field)) { \
+            _cpy((a).field, (b).field); \
+            _cpy((a).hashes.field, (b).hashes.field); \
+        } else { \
+            _neg(whats_loaded, bitflag); \
+        } \
+    }
+
 static void load_properties_if_changed(struct mpris_properties *oldp, const struct mpris_properties *newp, struct mpris_event *changed)
 {
     long int whats_loaded = changed->loaded_state;
@@ -761,27 +801,28 @@ static void load_properties_if_changed(struct mpris_properties *oldp, const stru
     _copy_if_changed(oldp->can_control, newp->can_control, whats_loaded, mpris_load_property_can_control);
     _copy_if_changed(oldp->can_play, newp->can_play, whats_loaded, mpris_load_property_can_play);
     _copy_if_changed(oldp->can_seek, newp->can_seek, whats_loaded, mpris_load_property_can_seek);
-    _copy_if_changed(oldp->loop_status, newp->loop_status, whats_loaded, mpris_load_property_loop_status);
-    _copy_if_changed(oldp->playback_status, newp->playback_status, whats_loaded, mpris_load_property_playback_status);
+    _copy_field_if_changed(*oldp, *newp, loop_status, whats_loaded, mpris_load_property_loop_status);
+    _copy_field_if_changed(*oldp, *newp, playback_status, whats_loaded, mpris_load_property_playback_status);
     _copy_if_changed(oldp->position, newp->position, whats_loaded, mpris_load_property_position);
+    _copy_if_changed(oldp->rate, newp->rate, whats_loaded, mpris_load_property_rate);
     _copy_if_changed(oldp->shuffle, newp->shuffle, whats_loaded, mpris_load_property_shuffle);
     _copy_if_changed(oldp->volume, newp->volume, whats_loaded, mpris_load_property_volume);
     _copy_if_changed(oldp->metadata.bitrate, newp->metadata.bitrate, whats_loaded, mpris_load_metadata_bitrate);
-    _copy_if_changed(oldp->metadata.art_url, newp->metadata.art_url, whats_loaded, mpris_load_metadata_art_url);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, art_url, whats_loaded, mpris_load_metadata_art_url);
     _copy_if_changed(oldp->metadata.length, newp->metadata.length, whats_loaded, mpris_load_metadata_length);
-    _copy_if_changed(oldp->metadata.track_id, newp->metadata.track_id, whats_loaded, mpris_load_metadata_track_id);
-    _copy_if_changed(oldp->metadata.album, newp->metadata.album, whats_loaded, mpris_load_metadata_album);
-    _copy_if_changed(oldp->metadata.album_artist, newp->metadata.album_artist, whats_loaded, mpris_load_metadata_album_artist);
-    _copy_if_changed(oldp->metadata.artist, newp->metadata.artist, whats_loaded, mpris_load_metadata_artist);
-    _copy_if_changed(oldp->metadata.comment, newp->metadata.comment, whats_loaded, mpris_load_metadata_comment);
-    _copy_if_changed(oldp->metadata.title, newp->metadata.title, whats_loaded, mpris_load_metadata_title);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, track_id, whats_loaded, mpris_load_metadata_track_id);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, album, whats_loaded, mpris_load_metadata_album);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, album_artist, whats_loaded, mpris_load_metadata_album_artist);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, artist, whats_loaded, mpris_load_metadata_artist);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, comment, whats_loaded, mpris_load_metadata_comment);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, title, whats_loaded, mpris_load_metadata_title);
     _copy_if_changed(oldp->metadata.track_number, newp->metadata.track_number, whats_loaded, mpris_load_metadata_track_number);
-    _copy_if_changed(oldp->metadata.url, newp->metadata.url, whats_loaded, mpris_load_metadata_url);
-    _copy_if_changed(oldp->metadata.genre, newp->metadata.genre, whats_loaded, mpris_load_metadata_genre);
-    _copy_if_changed(oldp->metadata.mb_track_id, newp->metadata.mb_track_id, whats_loaded, mpris_load_metadata_mb_track_id);
-    _copy_if_changed(oldp->metadata.mb_album_id, newp->metadata.mb_album_id, whats_loaded, mpris_load_metadata_mb_album_id);
-    _copy_if_changed(oldp->metadata.mb_artist_id, newp->metadata.mb_artist_id, whats_loaded, mpris_load_metadata_mb_artist_id);
-    _copy_if_changed(oldp->metadata.mb_album_artist_id, newp->metadata.mb_album_artist_id, whats_loaded, mpris_load_metadata_mb_album_artist_id);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, url, whats_loaded, mpris_load_metadata_url);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, genre, whats_loaded, mpris_load_metadata_genre);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, mb_track_id, whats_loaded, mpris_load_metadata_mb_track_id);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, mb_album_id, whats_loaded, mpris_load_metadata_mb_album_id);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, mb_artist_id, whats_loaded, mpris_load_metadata_mb_artist_id);
+    _copy_field_if_changed(oldp->metadata, newp->metadata, mb_album_artist_id, whats_loaded, mpris_load_metadata_mb_album_artist_id);
     changed->loaded_state = whats_loaded;
 }
 
@@ -929,7 +970,7 @@ static enum identity_load_status load_player_identity_from_message(DBusMessage *
     return loaded;
 }
 
-static bool load_properties_from_message(DBusMessage *msg, struct mpris_properties *data, struct mpris_event *changes, const struct mpris_player players[MAX_PLAYERS], const int players_count)
+static bool load_properties_from_message(DBusMessage *msg, struct mpris_properties *data, struct mpris_event *changes, struct mpris_player *const players[MAX_PLAYERS], const int players_count)
 {
     if (NULL == msg) {
         _warn("dbus::invalid_signal_message(%p)", msg);
@@ -945,9 +986,9 @@ static bool load_properties_from_message(DBusMessage *msg, struct mpris_properti
         memcpy(&changes->sender_bus_id, bus_id, strlen(bus_id));
     }
     for (int i = 0; i < players_count; i++) {
-        const struct mpris_player player = players[i];
-        if ( !strncmp(player.bus_id, changes->sender_bus_id, sizeof(changes->sender_bus_id)) && player.ignored) {
-            _trace("dbus::ignored_player: %s", player.name);
+        const struct mpris_player *player = players[i];
+        if ( !strncmp(player->bus_id, changes->sender_bus_id, sizeof(changes->sender_bus_id)) && player->ignored) {
+            _trace("dbus::ignored_player: %s", player->name);
             return false;
         }
     }
@@ -1083,30 +1124,25 @@ static void toggle_watch(DBusWatch *watch, void *data)
     }
 }
 
-static short mpris_player_remove(struct mpris_player *players, short player_count, struct mpris_player player)
+static short mpris_player_remove(struct mpris_player *players[MAX_PLAYERS], short player_count, const struct mpris_player *player)
 {
     if (NULL == players) { return -1; }
     if (player_count == 0) { return 0; }
 
     int idx = -1;
     for (int i = 0; i < player_count; i++) {
-        struct mpris_player *to_remove = &players[i];
-        if (strncmp(to_remove->bus_id, player.bus_id, strlen(player.bus_id)) == 0) {
+        if (strncmp(players[i]->bus_id, player->bus_id, strlen(player->bus_id)) == 0) {
             idx = i;
-            // free player and decrease player count
-            mpris_player_free(to_remove);
             break;
         }
     }
+    if (idx < 0) { return player_count; }
 
-    for (int i = idx + 1; i < player_count; i++) {
-        struct mpris_player *to_move = &players[i];
-        if (NULL == to_move) {
-            continue;
-        }
-        memcpy(to_move, &players[player_count-1], sizeof(struct mpris_player));
-    }
+    // free player and move the last loaded one in its place
+    mpris_player_release(players[idx]);
     player_count--;
+    players[idx] = players[player_count];
+    players[player_count] = NULL;
     return player_count;
 }
 
@@ -1361,10 +1397,18 @@ static void print_properties_if_changed(struct mpris_properties *oldp, struct mp
     }
 }
 
+#ifdef DEBUG
+static bool handle_system_message(struct state*, DBusMessage*);
+#endif
 static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message, void *data)
 {
     bool handled = false;
     struct state *s = data;
+#ifdef DEBUG
+    if (handle_system_message(s, message)) {
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+#endif
     if (dbus_message_is_signal(message, DBUS_INTERFACE_PROPERTIES, DBUS_SIGNAL_PROPERTIES_CHANGED)) {
         if (strncmp(dbus_message_get_path(message), MPRIS_PLAYER_PATH, strlen(MPRIS_PLAYER_PATH)) == 0) {
             struct mpris_properties properties = {0};
@@ -1374,7 +1418,7 @@ static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message,
             const bool loaded_something = load_properties_from_message(message, &properties, &changed, s->players, s->player_count);
             if (loaded_something) {
                 for (int i = 0; i < s->player_count; i++) {
-                    player = &(s->players[i]);
+                    player = s->players[i];
                     if (strncmp(player->bus_id, changed.sender_bus_id, strlen(changed.sender_bus_id)) != 0) {
                         continue;
                     }
@@ -1391,8 +1435,8 @@ static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message,
                 if (!handled) {
                     for (int i = s->player_count; i < MAX_PLAYERS; i++) {
                         // player is not yet in list
-                        player = &(s->players[i]);
-                        if (strlen(player->bus_id) == 0) {
+                        player = s->players[i];
+                        if (NULL == player || strlen(player->bus_id) == 0) {
                             continue;
                         }
                         if (strncmp(player->bus_id, changed.sender_bus_id, strlen(changed.sender_bus_id)) != 0) {
@@ -1412,12 +1456,15 @@ static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message,
                             player->changed.timestamp = changed.timestamp;
 
                             handled = true;
+                            // NOTE(marius): move the player next to the other loaded ones
+                            s->players[i] = s->players[s->player_count];
+                            s->players[s->player_count] = player;
                             s->player_count++;
                         }
                         break;
                     }
                 }
-                if (mpris_player_is_valid(player)) {
+                if (NULL != player && mpris_player_is_valid(player)) {
                     //print_mpris_player(player, log_tracing, false);
                     state_loaded_properties(conn, player, &player->properties, &player->changed);
                 }
@@ -1426,16 +1473,39 @@ static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message,
             }
         }
     }
+    if (dbus_message_is_signal(message, MPRIS_PLAYER_INTERFACE, MPRIS_SIGNAL_SEEKED)) {
+        // NOTE(marius): the signal carries the new position, so we don't need to ask the player for it
+        int64_t position = 0;
+        const char *sender = dbus_message_get_sender(message);
+        if (NULL != sender && dbus_message_get_args(message, NULL, DBUS_TYPE_INT64, &position, DBUS_TYPE_INVALID)) {
+            for (int i = 0; i < s->player_count; i++) {
+                struct mpris_player *player = s->players[i];
+                if (strncmp(player->bus_id, sender, MAX_PROPERTY_LENGTH) != 0) {
+                    continue;
+                }
+                player_playback_seeked(player, position);
+                handled = true;
+                break;
+            }
+        } else {
+            _warn("mpris_player::unable to load position from seeked signal");
+        }
+    }
     if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS, DBUS_SIGNAL_NAME_OWNER_CHANGED)) {
-        struct mpris_player temp_player = {0};
-        enum identity_load_status loaded_or_deleted = load_player_identity_from_message(message, &temp_player);
+        struct mpris_player *player = mpris_player_new();
+        enum identity_load_status loaded_or_deleted = identity_none;
+        if (NULL != player) {
+            loaded_or_deleted = load_player_identity_from_message(message, player);
+        }
 
         handled = (loaded_or_deleted != identity_none);
-        if (loaded_or_deleted == identity_loaded) {
+        if (loaded_or_deleted == identity_loaded && s->player_count >= MAX_PLAYERS) {
+            _warn("mpris_player::opened: exceeded max player count %d", MAX_PLAYERS);
+        } else if (loaded_or_deleted == identity_loaded) {
             // player was opened
-            // use the new pointer for initializing the player and stuff
-            struct mpris_player *player = &s->players[s->player_count];
-            memcpy(player, &temp_player, sizeof(struct mpris_player));
+            // the slot can hold a player which failed to load at start-up
+            mpris_player_release(s->players[s->player_count]);
+            s->players[s->player_count] = player;
 
             mpris_player_init(s->dbus, player, s->events, &s->scrobbler, s->config->ignore_players, s->config->ignore_players_count);
             if (mpris_player_is_valid(player)) {
@@ -1444,11 +1514,13 @@ static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message,
             }
             _info("mpris_player::opened[%d]: %s%s", s->player_count, player->mpris_name, player->bus_id);
             s->player_count++;
+            player = NULL;
         } else if (loaded_or_deleted == identity_removed) {
             // player was closed
-            s->player_count = mpris_player_remove(s->players, s->player_count, temp_player);
-            _info("mpris_player::closed[%d]: %s%s", s->player_count, temp_player.mpris_name, temp_player.bus_id);
+            s->player_count = mpris_player_remove(s->players, s->player_count, player);
+            _info("mpris_player::closed[%d]: %s%s", s->player_count, player->mpris_name, player->bus_id);
         }
+        free(player);
     }
     if (handled) {
         _trace2("dbus::filtered(%p:%p):%s %d %s -> %s %s::%s",
@@ -1466,9 +1538,150 @@ static DBusHandlerResult add_filter(DBusConnection *conn, DBusMessage *message,
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
+/*
+ * The scrobbler stops sending requests while the system goes to sleep or loses connectivity, and sends
+ * the tracks queued meanwhile when it comes back.
+ */
+static bool handle_system_message(struct state *s, DBusMessage *message)
+{
+    if (dbus_message_is_signal(message, LOGIND_INTERFACE, LOGIND_SIGNAL_PREPARE_FOR_SLEEP)) {
+        dbus_bool_t sleeping = false;
+        if (!dbus_message_get_args(message, NULL, DBUS_TYPE_BOOLEAN, &sleeping, DBUS_TYPE_INVALID)) {
+            _warn("dbus::system: invalid %s signal", LOGIND_SIGNAL_PREPARE_FOR_SLEEP);
+            return false;
+        }
+        if (sleeping) {
+            scrobbler_pause(&s->scrobbler, scrobbler_sleeping);
+        } else {
+            scrobbler_resume(&s->scrobbler, scrobbler_sleeping);
+        }
+        return true;
+    }
+    if (dbus_message_is_signal(message, NETWORK_MANAGER_INTERFACE, NETWORK_MANAGER_SIGNAL_STATE_CHANGED)) {
+        dbus_uint32_t network_state = NETWORK_MANAGER_STATE_UNKNOWN;
+        if (!dbus_message_get_args(message, NULL, DBUS_TYPE_UINT32, &network_state, DBUS_TYPE_INVALID)) {
+            _warn("dbus::system: invalid %s signal", NETWORK_MANAGER_SIGNAL_STATE_CHANGED);
+            return false;
+        }
+        _debug("dbus::system: network state %u", network_state);
+        // NOTE(marius): NetworkManager reports an unknown state when it doesn't manage the connections
+        if (network_state == NETWORK_MANAGER_STATE_UNKNOWN || network_state >= NETWORK_MANAGER_STATE_CONNECTED_GLOBAL) {
+            scrobbler_resume(&s->scrobbler, scrobbler_offline);
+        } else {
+            scrobbler_pause(&s->scrobbler, scrobbler_offline);
+        }
+        return true;
+    }
+    return false;
+}
+
+static DBusHandlerResult system_filter(DBusConnection *conn, DBusMessage *message, void *data)
+{
+    if (handle_system_message(data, message)) {
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void handle_system_watch(int fd, short events, void *data)
+{
+    assert(data);
+
+    struct state *state = data;
+    DBusWatch *watch = state->dbus->system_watch;
+
+    unsigned flags = 0;
+    if (events & EV_READ) { flags |= DBUS_WATCH_READABLE; }
+
+    if (dbus_watch_handle(watch, flags) == false) {
+       _error("dbus::system::handle_event_failed: fd=%d, watch=%p ev=%d", fd, (void*)watch, events);
+       return;
+    }
+    dispatch(-1, events, state->dbus->system);
+}
+
+static unsigned add_system_watch(DBusWatch *watch, void *data)
+{
+    if (!dbus_watch_get_enabled(watch)) { return true;}
+
+    struct state *state = data;
+    state->dbus->system_watch = watch;
+
+    const int fd = dbus_watch_get_unix_fd(watch);
+    const unsigned flags = dbus_watch_get_flags(watch);
+
+    short cond = EV_PERSIST;
+    if (flags & DBUS_WATCH_READABLE) { cond |= EV_READ; }
+
+    evutil_make_socket_nonblocking(fd);
+    struct event *event = event_new(state->events.base, fd, cond, handle_system_watch, state);
+    if (NULL == event) { return false; }
+    event_add(event, NULL);
+
+    dbus_watch_set_data(watch, event, NULL);
+    _trace2("dbus::system::add_watch: watch=%p data=%p", (void*)watch, data);
+    return true;
+}
+
+static void toggle_system_watch(DBusWatch *watch, void *data)
+{
+    if (dbus_watch_get_enabled(watch)) {
+        add_system_watch(watch, data);
+    } else {
+        remove_watch(watch, data);
+    }
+}
+
+/*
+ * Not having a system bus, or logind and NetworkManager, is not an error, the scrobbler is then never paused.
+ */
+static void dbus_system_init(struct state *state)
+{
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    DBusConnection *conn = dbus_bus_get_private(DBUS_BUS_SYSTEM, &err);
+    if (NULL == conn) {
+        _warn("dbus::system: unable to connect, %s", dbus_error_is_set(&err) ? err.message : "unknown error");
+        goto _exit;
+    }
+    state->dbus->system = conn;
+    dbus_connection_set_exit_on_disconnect(conn, false);
+
+    const char *matches[] = { SYSTEM_SLEEP_MATCH, SYSTEM_NETWORK_MATCH };
+    for (size_t i = 0; i < array_count(matches); i++) {
+        dbus_bus_add_match(conn, matches[i], &err);
+        _trace("dbus::system::add_match: %s", matches[i]);
+        if (dbus_error_is_set(&err)) {
+            _warn("dbus::system::add_match: %s", err.message);
+            dbus_error_free(&err);
+        }
+    }
+    if (!dbus_connection_add_filter(conn, system_filter, state, NULL)) {
+        _warn("dbus::system::add_filter: failed");
+        goto _exit;
+    }
+    if (!dbus_connection_set_watch_functions(conn, add_system_watch, remove_watch, toggle_system_watch, state, NULL)) {
+        _warn("dbus::system::add_watch_functions: failed");
+        goto _exit;
+    }
+    // NOTE(marius): the signals received while adding the matches are already queued
+    dispatch(-1, 0, conn);
+
+_exit:
+    if (dbus_error_is_set(&err)) {
+        dbus_error_free(&err);
+    }
+}
+
 void dbus_close(struct state *state)
 {
     if (NULL == state->dbus) { return; }
+    if (NULL != state->dbus->system) {
+        _trace2("mem::free::dbus_connection(%p)", state->dbus->system);
+        dbus_connection_close(state->dbus->system);
+        dbus_connection_unref(state->dbus->system);
+    }
     if (NULL != state->dbus->conn) {
         _trace2("mem::free::dbus_connection(%p)", state->dbus->conn);
         dbus_connection_flush(state->dbus->conn);
@@ -1507,6 +1720,14 @@ struct dbus *dbus_connection_init(struct state *state)
         dbus_error_free(&err);
         goto _cleanup;
     }
+    const char *seeked_signal = "type='signal',interface='" MPRIS_PLAYER_INTERFACE "',member='" MPRIS_SIGNAL_SEEKED "',path='" MPRIS_PLAYER_PATH "'";
+    dbus_bus_add_match(conn, seeked_signal, &err);
+    _trace("dbus::add_match: %s", seeked_signal);
+    if (dbus_error_is_set(&err)) {
+        _error("dbus::add_match: %s", err.message);
+        dbus_error_free(&err);
+        goto _cleanup;
+    }
     const char *names_signal = "type='signal',interface='" DBUS_INTERFACE_DBUS "',member='" DBUS_SIGNAL_NAME_OWNER_CHANGED "',path='" DBUS_PATH_DBUS "'";
     dbus_bus_add_match(conn, names_signal, &err);
     _trace("dbus::add_match: %s", names_signal);
@@ -1531,6 +1752,14 @@ struct dbus *dbus_connection_init(struct state *state)
     dbus_connection_set_exit_on_disconnect(conn, false);
     state->dbus->conn = conn;
 
+#ifdef DEBUG
+    // NOTE(marius): debug builds accept the system signals on the session bus too, so they can be
+    //  simulated with dbus-send
+    dbus_bus_add_match(conn, SYSTEM_SLEEP_MATCH, NULL);
+    dbus_bus_add_match(conn, SYSTEM_NETWORK_MATCH, NULL);
+#endif
+    dbus_system_init(state);
+
     return state->dbus;
 _cleanup:
     if (dbus_error_is_set(&err)) {
@@ -6,11 +6,37 @@
 
 #include <pthread.h>
 #include <event2/thread.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define CONFIG_WATCH_EVENTS         (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+#define CONFIG_WATCH_DEBOUNCE_USEC  250000
+#define SUSPEND_THRESHOLD_MSEC      1000.0
+
+static void send_now_playing(struct timer_wheel_entry *, void *);
+static void config_watch_free(const struct config_watch *watch)
+{
+    if (NULL != watch->changed) { event_free(watch->changed); }
+    if (NULL != watch->debounce) { event_free(watch->debounce); }
+    if (watch->fd >= 0) { close(watch->fd); }
+}
+
+static void event_timers_free(struct event_timers *timers)
+{
+    if (NULL == timers) { return; }
+    if (NULL != timers->tick) {
+        _trace2("mem::free::event(%p):timers", timers->tick);
+        event_free(timers->tick);
+    }
+    free(timers);
+}
 
-static void send_now_playing(evutil_socket_t, short, void *);
 void events_free(const struct events *ev)
 {
     if (NULL == ev) { return; }
+    config_watch_free(&ev->watch);
+    event_timers_free(ev->timers);
     _trace2("mem::free::event(%p):SIGINT", ev->sigint);
     event_free(ev->sigint);
     _trace2("mem::free::event(%p):SIGTERM", ev->sigterm);
@@ -47,9 +73,181 @@ static void log_event(const int severity, const char *msg)
     _log(level, "libevent: %s", msg);
 }
 
+void reload_configuration(struct state *, const unsigned);
+static void config_watch_reload(evutil_socket_t fd, short event, void *data)
+{
+    assert(data);
+    struct state *state = data;
+    struct config_watch *watch = &state->events.watch;
+
+    const unsigned targets = watch->pending;
+    watch->pending = reload_none;
+    reload_configuration(state, targets);
+}
+
+static bool config_watch_matches(const struct inotify_event *event, const int wd, const char *path)
+{
+    if (wd < 0 || event->wd != wd || event->len == 0) { return false; }
+
+    char path_copy[FILE_PATH_MAX+1] = {0};
+    memcpy(path_copy, path, min(FILE_PATH_MAX, strlen(path)));
+    return strncmp(event->name, basename(path_copy), event->len) == 0;
+}
+
+/*
+ * Editors and the signon binary can write the files in several steps, so we wait for the writes to
+ * settle before reloading, and only the files that were written get loaded again.
+ */
+static void config_watch_changed(evutil_socket_t fd, short event, void *data)
+{
+    assert(data);
+    struct state *state = data;
+    struct config_watch *watch = &state->events.watch;
+
+    _Alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event *ev = (const struct inotify_event*)ptr;
+            if (config_watch_matches(ev, watch->config_wd, state->config->config_path)) {
+                watch->pending |= reload_config;
+            }
+            if (config_watch_matches(ev, watch->credentials_wd, state->config->credentials_path)) {
+                watch->pending |= reload_credentials;
+            }
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (watch->pending == reload_none) { return; }
+
+    _trace("events::config_changed: %s%s", (watch->pending & reload_config) ? "config " : "", (watch->pending & reload_credentials) ? "credentials" : "");
+    const struct timeval debounce = { .tv_sec = 0, .tv_usec = CONFIG_WATCH_DEBOUNCE_USEC, };
+    evtimer_add(watch->debounce, &debounce);
+}
+
+static int config_watch_add(const int fd, const char *path)
+{
+    char folder[FILE_PATH_MAX+1] = {0};
+    memcpy(folder, path, min(FILE_PATH_MAX, strlen(path)));
+    const int wd = inotify_add_watch(fd, dirname(folder), CONFIG_WATCH_EVENTS);
+    if (wd < 0) {
+        _warn("events::config_watch: unable to watch %s, send SIGHUP to reload", folder);
+    }
+    return wd;
+}
+
+static void config_watch_init(struct events *ev, struct state *s)
+{
+    struct config_watch *watch = &ev->watch;
+    watch->config_wd = -1;
+    watch->credentials_wd = -1;
+    watch->pending = reload_none;
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        _warn("events::config_watch: inotify is not available, send SIGHUP to reload");
+        return;
+    }
+    watch->config_wd = config_watch_add(watch->fd, s->config->config_path);
+    watch->credentials_wd = config_watch_add(watch->fd, s->config->credentials_path);
+
+    watch->changed = event_new(ev->base, watch->fd, EV_READ | EV_PERSIST, config_watch_changed, s);
+    watch->debounce = evtimer_new(ev->base, config_watch_reload, s);
+    if (NULL == watch->changed || event_add(watch->changed, NULL) < 0) {
+        _error("mem::add_event(config_watch): failed");
+        return;
+    }
+    _trace2("mem::added_event(config_watch): %d", watch->fd);
+}
+
+static inline uint64_t event_timers_now(void)
+{
+    return (uint64_t)monotonic_milliseconds() / TIMER_WHEEL_TICK_MSEC;
+}
+
+/*
+ * The libevent timer is armed only for the next tick the wheel needs to handle, so an idle daemon
+ * doesn't wake up.
+ */
+static void event_timers_schedule(struct event_timers *timers)
+{
+    uint64_t next = 0;
+    if (!timer_wheel_next_expiry(&timers->wheel, &next)) {
+        evtimer_del(timers->tick);
+        return;
+    }
+    const uint64_t now = event_timers_now();
+    const uint64_t ticks = next > now ? next - now : 0;
+    const struct timeval timeout = {
+        .tv_sec = (time_t)(ticks * TIMER_WHEEL_TICK_MSEC / 1000),
+        .tv_usec = (suseconds_t)(ticks * TIMER_WHEEL_TICK_MSEC % 1000) * 1000,
+    };
+    evtimer_add(timers->tick, &timeout);
+}
+
+static void event_timers_add(struct event_timers *timers, struct timer_wheel_entry *entry, timer_wheel_cb callback, void *data, const double seconds)
+{
+    timer_wheel_cancel(&timers->wheel, entry);
+    timer_wheel_entry_init(entry, callback, data);
+
+    // NOTE(marius): the wheel lags behind the clock until the libevent timer fires, so we account for it
+    //  here instead of advancing the wheel, which would run other callbacks from this one
+    uint64_t delay = timer_wheel_msec_to_ticks(seconds * 1000.0);
+    const uint64_t now = event_timers_now();
+    if (now > timers->wheel.now) {
+        delay += now - timers->wheel.now;
+    }
+    timer_wheel_add(&timers->wheel, entry, delay);
+    event_timers_schedule(timers);
+}
+
+void resend_now_playing (struct state*);
+/*
+ * CLOCK_MONOTONIC stops while the system is suspended, so the deadlines are not reached sooner on resume,
+ * but the now playing status the services have expired in the meantime.
+ */
+static void event_timers_tick(evutil_socket_t fd, short event, void *data)
+{
+    assert(data);
+    struct state *state = data;
+    struct event_timers *timers = state->events.timers;
+
+    const double suspended = boottime_milliseconds() - monotonic_milliseconds();
+    const bool resumed = suspended - timers->suspended > SUSPEND_THRESHOLD_MSEC;
+    if (resumed) {
+        _info("events::timers: resumed after %.2lfs of suspend", (suspended - timers->suspended) / 1000.0);
+    }
+    timers->suspended = suspended;
+
+    const size_t fired = timer_wheel_advance(&timers->wheel, event_timers_now());
+    _trace2("events::timers: fired %zu, pending %zu", fired, timers->wheel.count);
+    if (resumed) {
+        resend_now_playing(state);
+    }
+    event_timers_schedule(timers);
+}
+
+static void event_timers_init(struct events *ev, struct state *s)
+{
+    ev->timers = calloc(1, sizeof(struct event_timers));
+    if (NULL == ev->timers) {
+        _error("mem::init_timers: failure");
+        return;
+    }
+    timer_wheel_init(&ev->timers->wheel, event_timers_now());
+    ev->timers->suspended = boottime_milliseconds() - monotonic_milliseconds();
+    ev->timers->tick = evtimer_new(ev->base, event_timers_tick, s);
+    if (NULL == ev->timers->tick) {
+        _error("mem::add_event(timers): failed");
+        return;
+    }
+    _trace2("mem::inited_timers(%p)", ev->timers);
+}
+
 void events_init(struct events *ev, struct state *s)
 {
     if (NULL == ev) { return; }
+    ev->watch.fd = -1;
 
 #if defined(LIBEVENT_DEBUG) && LIBEVENT_DEBUG
     event_enable_debug_mode();
@@ -88,9 +286,31 @@ void events_init(struct events *ev, struct state *s)
         _error("mem::add_event(SIGHUP): failed");
         return;
     }
+    event_timers_init(ev, s);
+    config_watch_init(ev, s);
+}
+
+/*
+ * The services show a track as playing for the duration sent with it, counted from when they receive it,
+ * so the notification needs to be sent again only when the playback outlasts that: after a pause, when
+ * seeking back, when playing slower, or for the long tracks which outlast NOW_PLAYING_MAX_TTL.
+ * Returns the seconds until the notification is due, or a negative value if the services show the track
+ * until it ends.
+ */
+static double now_playing_due_in(const struct mpris_player *player, const struct scrobble *track)
+{
+    const struct player_playback *playback = &player->playback;
+
+    const double now = monotonic_milliseconds();
+    const double remaining = ((double)track->length - playback->position) / playback->rate * 1000.0;
+    if (playback->now_playing_until >= now + remaining) {
+        return -1;
+    }
+    const double due = (playback->now_playing_until - now) / 1000.0 - (double)NOW_PLAYING_REFRESH_MARGIN;
+    return due > 0 ? due : 0;
 }
 
-static void send_now_playing(evutil_socket_t fd, short event, void *data)
+static void send_now_playing(struct timer_wheel_entry *timer, void *data)
 {
     assert(data);
     struct event_payload *state = data;
@@ -104,7 +324,6 @@ static void send_now_playing(evutil_socket_t fd, short event, void *data)
 
     if (track->position > (double)track->length) {
         _trace2("events::now_playing: track position out of bounds %d > %ld", track->position, (double)track->length);
-        event_del(&state->event);
         return;
     }
 
@@ -112,27 +331,60 @@ static void send_now_playing(evutil_socket_t fd, short event, void *data)
     assert(player);
     if (!mpris_player_is_valid(player)) {
         _debug("events::now_playing: invalid player %s", player->mpris_name);
-        event_del(&state->event);
         return;
     }
 
     struct scrobbler *scrobbler = player->scrobbler;
     assert(scrobbler);
 
+    struct player_playback *playback = &player->playback;
+    if (playback->state != player_playing) {
+        _trace("events::now_playing[%s]: skipping, player is %s", player->name, get_player_state_label(playback->state));
+        return;
+    }
+    player_playback_advance(player);
+    track->position = playback->position;
+    track->play_time = playback->play_time;
+
+    double due = now_playing_due_in(player, track);
+    if (due < 0) {
+        _trace("events::now_playing[%s]: skipping, still showing until the end of the track", player->name);
+        return;
+    }
+    if (due > 0) {
+        add_event_now_playing(player, track, due);
+        return;
+    }
+
+    // NOTE(marius): the refreshes and the forced resends of the same track are expected, but another player announcing it isn't
+    const uint64_t fingerprint = scrobble_fingerprint(track);
+    const uint64_t owner = fingerprint_owner(player->mpris_name);
+    if (playback->now_playing_until == 0 && !playback->now_playing_forced &&
+        fingerprint_cache_seen(&scrobbler->fingerprints, fingerprint, track->start_time, track->length, fingerprint_now_playing, owner)) {
+        _info("scrobbler::now_playing[%s]: skipping duplicate %s//%s//%s", player->name, track->title, track->artist[0], track->album);
+        return;
+    }
+
     _trace("events::triggered(%p:%p):now_playing", state, track);
     print_scrobble(track, log_debug);
 
     const struct scrobble *tracks[1] = {track};
     _info("scrobbler::now_playing[%s]: %s//%s//%s", player->name, track->title, track->artist[0], track->album);
     // TODO(marius): this requires the number of tracks to be passed down, to avoid dependency on arrlen
-    api_request_do(scrobbler, tracks, 1, now_playing_is_valid, api_build_request_now_playing);
+    api_request_do(scrobbler, tracks, 1, now_playing_is_valid, api_build_request_now_playing, request_now_playing);
+    fingerprint_cache_mark(&scrobbler->fingerprints, fingerprint, track->start_time, track->length, fingerprint_now_playing, owner);
+    playback->now_playing_forced = false;
+
+    const double ttl = min((double)track->length, (double)NOW_PLAYING_MAX_TTL);
+    playback->now_playing_until = monotonic_milliseconds() + ttl * 1000.0;
 
-    if (track->position + NOW_PLAYING_DELAY < (double)track->length) {
-        add_event_now_playing(player, track, NOW_PLAYING_DELAY);
+    due = now_playing_due_in(player, track);
+    if (due >= 0) {
+        add_event_now_playing(player, track, due);
     }
 }
 
-static bool add_event_now_playing(struct mpris_player *player, const struct scrobble *track, const time_t delay)
+static bool add_event_now_playing(struct mpris_player *player, const struct scrobble *track, const double delay)
 {
     assert(NULL != player);
     assert(mpris_player_is_valid(player));
@@ -146,29 +398,18 @@ static bool add_event_now_playing(struct mpris_player *player, const struct scro
         return false;
     }
 
-    const struct timeval now_playing_tv = { .tv_sec = delay };
-
     struct event_payload *payload = &player->now_playing;
-    scrobble_copy(&payload->scrobble, track);
-
-    if (event_initialized(&payload->event)) {
-        event_del(&payload->event);
-    }
-    event_assign(&payload->event, player->evbase, -1, EV_TIMEOUT, send_now_playing, payload);
-    if (!event_initialized(&payload->event)) {
-        _warn("events::add_event_failed(%p):now_playing", &payload->event);
-        return false;
+    if (track != &payload->scrobble) {
+        scrobble_copy(&payload->scrobble, track);
     }
 
-    _debug("events::add_event:now_playing[%s] in %2.2lfs, elapsed %2.2lfs", player->name, timeval_to_seconds(now_playing_tv), (double)track->position);
-    event_add(&payload->event, &now_playing_tv);
-    payload->scrobble.position += (double)delay;
-    payload->scrobble.play_time += (double)delay;
+    _debug("events::add_event:now_playing[%s] in %2.2lfs, elapsed %2.2lfs", player->name, delay, track->position);
+    event_timers_add(player->timers, &payload->timer, send_now_playing, payload, delay);
 
     return true;
 }
 
-static void queue(evutil_socket_t fd, short event, void *data)
+static void queue(struct timer_wheel_entry *timer, void *data)
 {
     assert (data);
     struct event_payload *state = data;
@@ -185,17 +426,26 @@ static void queue(evutil_socket_t fd, short event, void *data)
         return;
     }
 
-    const struct scrobble *scrobble = &state->scrobble;
+    struct scrobble *scrobble = &state->scrobble;
     assert(NULL != scrobble && !scrobble_is_empty(scrobble));
     //print_scrobble(scrobble, log_tracing);
 
+    // NOTE(marius): the timer is only an estimate, the play time decides if the track can be scrobbled
+    player_playback_advance(player);
+    if (!playback_scrobble_is_due(scrobble->length, player->playback.play_time)) {
+        _debug("events::queue[%s]: played only %.2lfs, rescheduling", player->name, player->playback.play_time);
+        add_event_queue(player, scrobble);
+        return;
+    }
+    player->playback.queued = true;
+    scrobble->play_time = player->playback.play_time;
+
     _trace("events::triggered(%p:%p):queue", state, scrobbler->queue);
     scrobbles_append(scrobbler, scrobble);
 
-    int queue_count = scrobbler->queue.length;
-    if (queue_count > 0) {
-        queue_count -= (int)scrobbler_consume_queue(scrobbler);
-        _debug("events::new_queue_length: %zu", queue_count);
+    if (scrobbler->queue.length > 0) {
+        const unsigned sent = scrobbler_consume_queue(scrobbler);
+        _debug("events::queue_sent: %u, queue length: %zu", sent, scrobbler->queue.length);
     }
 }
 
@@ -210,26 +460,19 @@ static bool add_event_queue(struct mpris_player *player, const struct scrobble *
     }
 
     struct event_payload *payload = &player->queue;
-    scrobble_copy(&payload->scrobble, track);
+    if (track != &payload->scrobble) {
+        scrobble_copy(&payload->scrobble, track);
+    }
 
     assert(!scrobble_is_empty(track));
 
-    if (event_initialized(&payload->event)) {
-        event_del(&payload->event);
-    }
-    event_assign(&payload->event, player->evbase, -1, EV_TIMEOUT, queue, payload);
-    if (!event_initialized(&payload->event)) {
-        _warn("events::add_event_failed(%p):queue", &payload->event);
-    }
-
     // This is the event that adds a scrobble to the queue after the correct amount of time
-    // round to the second
-    const struct timeval timer = {
-        .tv_sec = (time_t)(min_scrobble_delay_seconds(track)/1),
-    };
+    // the remaining play time is converted to wall clock time using the playback rate
+    // NOTE(marius): the play time of the player is the only one accounted, track->play_time is just a copy of it
+    const double remaining = playback_scrobble_due_in(track->length, player->playback.play_time, player->playback.rate);
 
-    _debug("events::add_event:queue[%s] in %2.2lfs", player->name, timeval_to_seconds(timer));
-    event_add(&payload->event, &timer);
+    _debug("events::add_event:queue[%s] in %2.2lfs", player->name, remaining);
+    event_timers_add(player->timers, &payload->timer, queue, payload, remaining);
 
     return true;
 }
@@ -300,12 +543,57 @@ void resend_now_playing (struct state *state)
         _error("events::invalid_state");
         return;
     }
-    // NOTE(marius): cancel any pending connections
-    scrobbler_connections_clean(&state->scrobbler.connections, true);
     for (int i = 0; i < state->player_count; i++) {
-        struct mpris_player *player = &state->players[i];
+        struct mpris_player *player = state->players[i];
         check_player(player);
     }
 }
 
+static void load_config(struct configuration*);
+static void load_credentials(struct configuration*);
+static void configuration_clean(struct configuration*);
+/*
+ * The new configuration is loaded separately and swapped in only after it was read completely, and only
+ * the accounts that changed lose their requests in flight.
+ */
+void reload_configuration(struct state *state, const unsigned targets)
+{
+    if (targets == reload_none) { return; }
+
+    struct timeval start, end, elapsed;
+    evutil_gettimeofday(&start, NULL);
+
+    struct configuration *config = state->config;
+    // NOTE(marius): the files are loaded in a copy of the configuration, the only allocation is the credentials
+    //  array, which scrobbler_reload swaps with the current one, and configuration_clean frees the one left over
+    struct configuration loaded;
+    memcpy(&loaded, config, sizeof(struct configuration));
+    struct configuration *fresh = &loaded;
+    fresh->wrote_pid = false;
+    fresh->credentials = NULL;
+    fresh->credentials_count = 0;
+
+    bool changed = false;
+    if (targets & reload_config) {
+        load_config(fresh);
+        memcpy((char*)config->ignore_players, fresh->ignore_players, sizeof(config->ignore_players));
+        config->ignore_players_count = fresh->ignore_players_count;
+        config->http2 = fresh->http2;
+        config->http2_streams = fresh->http2_streams;
+        scrobbler_http_setup(&state->scrobbler);
+    }
+    if (targets & reload_credentials) {
+        load_credentials(fresh);
+        changed = scrobbler_reload(&state->scrobbler, fresh);
+    }
+    configuration_clean(fresh);
+
+    if (changed) {
+        resend_now_playing(state);
+    }
+    evutil_gettimeofday(&end, NULL);
+    evutil_timersub(&end, &start, &elapsed);
+    _info("main::reload: done in %.3lfms", timeval_to_seconds(elapsed) * 1000.0);
+}
+
 #endif // MPRIS_SCROBBLER_SEVENTS_H
@@ -13,6 +13,11 @@
 #include <unistd.h>
 #define STB_DS_IMPLEMENTATION
 #include "stb_ds.h"
+#include "timer_wheel.h"
+#include "arena.h"
+#include "hash.h"
+#include "fingerprint.h"
+#include "playback.h"
 #include "structs.h"
 #include "sstrings.h"
 #include "utils.h"
@@ -23,6 +28,7 @@
 #include "sdbus.h"
 #include "sevents.h"
 #include "configuration.h"
+#include "import.h"
 
 #define HELP_MESSAGE        "MPRIS scrobbler user signon, version %s\n\n" \
 "Usage:\n %s COMMAND SERVICE - Execute COMMAND for SERVICE\n\n" \
@@ -31,7 +37,13 @@
 "\t" ARG_COMMAND_TOKEN "\t\tGet the authentication token for SERVICE.\n" \
 "\t" ARG_COMMAND_SESSION "\t\tActivate a new session for SERVICE. SERVICE must have a valid token.\n" \
 "\t" ARG_COMMAND_ENABLE "\t\tActivate SERVICE for submitting tracks.\n" \
-"\t" ARG_COMMAND_DISABLE "\t\tDeactivate submitting tracks to SERVICE.\n\n" \
+"\t" ARG_COMMAND_DISABLE "\t\tDeactivate submitting tracks to SERVICE.\n" \
+"\t" ARG_COMMAND_DEAD_LETTER "\tManage the scrobbles that were rejected, SERVICE is optional:\n" \
+"\t  " ARG_DEAD_LETTER_LIST "\t\t\tList the rejected scrobbles.\n" \
+"\t  " ARG_DEAD_LETTER_FIX " ID KEY=VALUE\tChange the artist, title, album, mbid, length or timestamp of scrobble ID.\n" \
+"\t  " ARG_DEAD_LETTER_REMOVE " ID\t\tDiscard scrobble ID.\n" \
+"\t  " ARG_DEAD_LETTER_RESUBMIT "\t\tSubmit the rejected scrobbles again, in batches.\n" \
+"\t" ARG_COMMAND_IMPORT " FILE\tSubmit the listens from a JSONL or .scrobbler.log FILE, SERVICE is optional.\n\n" \
 "Services:\n" \
 "\t" ARG_LASTFM "\t\tlast.fm\n" \
 "\t" ARG_LIBREFM "\t\tlibre.fm\n" \
@@ -42,6 +54,11 @@ HELP_OPTIONS \
 ""
 
 #define XDG_OPEN "/usr/bin/xdg-open \"%s\""
+#define DEAD_LETTER_RESUBMIT_DELAY_SECONDS 1
+
+#define IMPORT_MIN_ROUND_MILLISECONDS   250 // at most four requests per second to each service
+#define IMPORT_RETRY_DELAY_SECONDS      5
+#define IMPORT_MAX_RETRIES              6
 #define MAX_OPEN_CMD_LENGTH MAX_URL_LENGTH + 22 // The max URL length and the XDG_OPEN command length
 
 static void print_help(const char *name)
@@ -218,6 +235,414 @@ static bool set_token(struct api_credentials *creds)
     return true;
 }
 
+static bool dead_letter_matches(const struct dead_letter *letter, const enum api_type service, const char *account)
+{
+    if (letter->state != DEAD_LETTER_STATE_PENDING) { return false; }
+    if (service == api_unknown) { return true; }
+    return service == letter->end_point && (NULL == account || strncmp(account, letter->account, USER_NAME_MAX) == 0);
+}
+
+static bool dead_letter_list(const struct configuration *config, const enum api_type service, const char *account)
+{
+    FILE *file = fopen(config->dead_letter_path, "r");
+    if (NULL == file) {
+        _info("signon::dead_letter: no rejected scrobbles");
+        return true;
+    }
+
+    size_t count = 0;
+    char *line = calloc(1, DEAD_LETTER_MAX_LINE);
+    struct dead_letter letter = {0};
+    while (dead_letter_next(file, line, &letter)) {
+        if (!dead_letter_matches(&letter, service, account)) { continue; }
+
+        char service_label[MAX_PROPERTY_LENGTH+1] = {0};
+        snprintf(service_label, MAX_PROPERTY_LENGTH, "%s%s%s", get_api_type_group(letter.end_point), strlen(letter.account) > 0 ? ":" : "", letter.account);
+        char played_at[MAX_PROPERTY_LENGTH+1] = {0};
+        strftime(played_at, MAX_PROPERTY_LENGTH, "%Y-%m-%d %H:%M", localtime(&letter.scrobble.start_time));
+        fprintf(stdout, "%6zu %-16s %-8s %3d  %s  %s // %s // %s\n", letter.id, service_label,
+            get_dead_letter_reason_label(letter.reason), letter.code, played_at,
+            letter.scrobble.title, letter.scrobble.artist[0], letter.scrobble.album);
+        count++;
+    }
+    free(line);
+    fclose(file);
+
+    _info("signon::dead_letter: %zu rejected scrobbles", count);
+    return true;
+}
+
+static bool dead_letter_fix(const struct configuration *config, const size_t id, const char fields[MAX_DEAD_LETTER_FIELDS][MAX_PROPERTY_LENGTH+1], const short field_count)
+{
+    struct dead_letter letter = {0};
+    if (!dead_letter_read(config->dead_letter_path, id, &letter)) {
+        _error("signon::dead_letter_fix[%zu]: unable to find scrobble", id);
+        return false;
+    }
+    if (letter.state != DEAD_LETTER_STATE_PENDING) {
+        _error("signon::dead_letter_fix[%zu]: scrobble is %s", id, get_dead_letter_state_label(letter.state));
+        return false;
+    }
+    if (field_count == 0) {
+        _error("signon::dead_letter_fix[%zu]: nothing to change", id);
+        return false;
+    }
+    for (short i = 0; i < field_count; i++) {
+        if (!dead_letter_set_field(&letter, fields[i])) {
+            _error("signon::dead_letter_fix[%zu]: invalid field %s", id, fields[i]);
+            return false;
+        }
+    }
+
+    const size_t new_id = dead_letter_append(config->dead_letter_path, &letter);
+    if (new_id == 0 || !dead_letter_set_state(config->dead_letter_path, id, DEAD_LETTER_STATE_SUPERSEDED)) {
+        _error("signon::dead_letter_fix[%zu]: unable to save scrobble", id);
+        return false;
+    }
+    _info("signon::dead_letter_fix[%zu]: saved as %zu", id, new_id);
+    return true;
+}
+
+static bool dead_letter_remove(const struct configuration *config, const size_t id)
+{
+    struct dead_letter letter = {0};
+    if (!dead_letter_read(config->dead_letter_path, id, &letter)) {
+        _error("signon::dead_letter_remove[%zu]: unable to find scrobble", id);
+        return false;
+    }
+    if (!dead_letter_set_state(config->dead_letter_path, id, DEAD_LETTER_STATE_REMOVED)) {
+        _error("signon::dead_letter_remove[%zu]: unable to save scrobble", id);
+        return false;
+    }
+    _info("signon::dead_letter_remove[%zu]: ok", id);
+    return true;
+}
+
+static unsigned dead_letter_submit_batch(const struct configuration *config, const struct api_credentials *creds, struct dead_letter *batch, const unsigned count)
+{
+    const struct scrobble *tracks[MAX_QUEUE_LENGTH] = {0};
+    for (unsigned i = 0; i < count; i++) {
+        tracks[i] = &batch[i].scrobble;
+    }
+
+    struct api_request_template template = {0};
+    api_request_template_init(&template, creds);
+
+    struct scrobbler_connection *conn = scrobbler_connection_new();
+    scrobbler_connection_init(conn, NULL, *creds, 0);
+    if (!api_build_request_scrobble(&conn->request, tracks, count, creds, &template, NULL, &conn->arena)) {
+        scrobbler_connection_free(conn, true);
+        api_request_template_clean(&template);
+        if (count == 1) {
+            _warn("signon::dead_letter_resubmit[%zu]: unable to build the request for %s//%s//%s", batch[0].id,
+                batch[0].scrobble.title, batch[0].scrobble.artist[0], batch[0].scrobble.album);
+            return 0;
+        }
+        // NOTE(marius): the batch doesn't fit in a request, so the tracks are sent one by one
+        unsigned accepted = 0;
+        for (unsigned i = 0; i < count; i++) {
+            accepted += dead_letter_submit_batch(config, creds, &batch[i], 1);
+        }
+        return accepted;
+    }
+    build_curl_request(conn);
+    request_call(conn);
+
+    struct scrobble_ack acks[MAX_QUEUE_LENGTH] = {0};
+    api_response_get_scrobble_acks(&conn->response, creds->end_point, acks, count);
+    scrobbler_connection_free(conn, true);
+    api_request_template_clean(&template);
+
+    unsigned accepted = 0;
+    for (unsigned i = 0; i < count; i++) {
+        switch (acks[i].status) {
+            case scrobble_ack_accepted:
+                dead_letter_set_state(config->dead_letter_path, batch[i].id, DEAD_LETTER_STATE_RESUBMITTED);
+                accepted++;
+                break;
+            case scrobble_ack_isolate:
+                // NOTE(marius): the service rejected the whole batch, so we find the culprits by sending the tracks one by one
+                accepted += dead_letter_submit_batch(config, creds, &batch[i], 1);
+                break;
+            default:
+                _warn("signon::dead_letter_resubmit[%zu]: %s(%d) %s//%s//%s", batch[i].id, get_api_type_label(creds->end_point),
+                    acks[i].code, batch[i].scrobble.title, batch[i].scrobble.artist[0], batch[i].scrobble.album);
+                break;
+        }
+    }
+    return accepted;
+}
+
+static bool dead_letter_resubmit(const struct configuration *config, const enum api_type service, const char *account)
+{
+    bool status = true;
+    for (size_t i = 0; i < config->credentials_count; i++) {
+        const struct api_credentials *creds = &config->credentials[i];
+        if (service != api_unknown && creds->end_point != service) { continue; }
+        if (NULL != account && strncmp(creds->account, account, USER_NAME_MAX) != 0) { continue; }
+        if (!credentials_valid(creds)) {
+            _warn("signon::dead_letter_resubmit[%s]: invalid service", get_api_type_label(creds->end_point));
+            continue;
+        }
+
+        FILE *file = fopen(config->dead_letter_path, "r");
+        if (NULL == file) { break; }
+
+        struct dead_letter *batch = calloc(MAX_QUEUE_LENGTH, sizeof(struct dead_letter));
+        char *line = calloc(1, DEAD_LETTER_MAX_LINE);
+        unsigned count = 0, total = 0, accepted = 0;
+        struct dead_letter letter = {0};
+        while (true) {
+            const bool more = dead_letter_next(file, line, &letter);
+            if (more && dead_letter_matches(&letter, creds->end_point, creds->account)) {
+                if (!scrobble_is_valid(&letter.scrobble, creds)) {
+                    _warn("signon::dead_letter_resubmit[%zu]: skipping invalid scrobble, use fix", letter.id);
+                    continue;
+                }
+                memcpy(&batch[count], &letter, sizeof(letter));
+                count++;
+            }
+            if (count > 0 && (count == MAX_QUEUE_LENGTH || !more)) {
+                if (total > 0) { sleep(DEAD_LETTER_RESUBMIT_DELAY_SECONDS); }
+                accepted += dead_letter_submit_batch(config, creds, batch, count);
+                total += count;
+                count = 0;
+            }
+            if (!more) { break; }
+        }
+        free(line);
+        free(batch);
+        fclose(file);
+
+        _info("signon::dead_letter_resubmit[%s]: accepted %u of %u", get_api_type_label(creds->end_point), accepted, total);
+        status = status && accepted == total;
+    }
+    return status;
+}
+
+static bool dead_letter_command(const struct configuration *config, const struct parsed_arguments *arguments)
+{
+    if (!dead_letter_index_check(config->dead_letter_path)) {
+        return false;
+    }
+    const char *account = strlen(arguments->account) > 0 ? arguments->account : NULL;
+    switch (arguments->dead_letter_command) {
+        case dead_letter_command_fix:
+            return dead_letter_fix(config, arguments->dead_letter_id, arguments->dead_letter_fields, arguments->dead_letter_field_count);
+        case dead_letter_command_remove:
+            return dead_letter_remove(config, arguments->dead_letter_id);
+        case dead_letter_command_resubmit:
+            return dead_letter_resubmit(config, arguments->service, account);
+        case dead_letter_command_list:
+        case dead_letter_command_none:
+        default:
+            return dead_letter_list(config, arguments->service, account);
+    }
+}
+
+static unsigned bits_count(unsigned mask)
+{
+    unsigned count = 0;
+    for (; mask > 0; mask >>= 1) {
+        count += mask & 1U;
+    }
+    return count;
+}
+
+static bool queue_is_in_flight(const struct scrobble_queue *queue)
+{
+    for (int pos = 0; pos < queue->length; pos++) {
+        if (queue->deliveries[pos].in_flight != 0) { return true; }
+    }
+    return false;
+}
+
+/*
+ * The work left in the queue: every pending delivery counts twice, and once it's isolated, once.
+ * It decreases with every track that gets acknowledged and every batch that gets split.
+ */
+static unsigned queue_weight(const struct scrobble_queue *queue)
+{
+    unsigned weight = 0;
+    for (int pos = 0; pos < queue->length; pos++) {
+        const struct scrobble_delivery *delivery = &queue->deliveries[pos];
+        weight += 2 * bits_count(delivery->pending & ~delivery->isolated) + bits_count(delivery->pending & delivery->isolated);
+    }
+    return weight;
+}
+
+static void wait_milliseconds(const double milliseconds)
+{
+    if (milliseconds <= 0) { return; }
+    const struct timespec delay = {
+        .tv_sec = (time_t)(milliseconds / 1000),
+        .tv_nsec = (long)((long long)milliseconds % 1000 * 1000000),
+    };
+    nanosleep(&delay, NULL);
+}
+
+// NOTE(marius): the offset in the imported file of each track in the queue, so we know where to resume from
+struct import_offset {
+    unsigned long id;
+    long offset;
+};
+
+static void import_offset_set(struct import_offset offsets[MAX_QUEUE_LENGTH], const unsigned long id, const long offset)
+{
+    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+        if (offsets[i].id != 0) { continue; }
+        offsets[i].id = id;
+        offsets[i].offset = offset;
+        return;
+    }
+}
+
+static long import_offset_get(const struct import_offset offsets[MAX_QUEUE_LENGTH], const unsigned long id)
+{
+    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+        if (offsets[i].id == id) { return offsets[i].offset; }
+    }
+    return 0;
+}
+
+static bool import_file(struct configuration *config, const struct parsed_arguments *arguments)
+{
+    bool status = false;
+    const char *file_path = arguments->import_path;
+
+    unsigned pending = 0;
+    for (size_t i = 0; i < config->credentials_count; i++) {
+        const struct api_credentials *cur = &config->credentials[i];
+        if (arguments->service != api_unknown && cur->end_point != arguments->service) { continue; }
+        if (strlen(arguments->account) > 0 && strncmp(cur->account, arguments->account, USER_NAME_MAX) != 0) { continue; }
+        if (!credentials_valid(cur)) { continue; }
+        pending |= 1U << i;
+    }
+    if (pending == 0) {
+        _error("signon::import: no valid services");
+        return status;
+    }
+
+    FILE *file = fopen(file_path, "r");
+    if (NULL == file) {
+        _error("signon::import: unable to open %s", file_path);
+        return status;
+    }
+
+    char checkpoint_path[FILE_PATH_MAX+1] = {0};
+    import_checkpoint_path(config, checkpoint_path);
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t read = getline(&line, &line_size, file);
+    const enum import_format format = import_detect_format(read > 0 ? line : NULL);
+    if (format == import_format_unknown) {
+        _error("signon::import: unknown file format %s", file_path);
+        goto _close;
+    }
+    const bool local_time = format == import_format_rockbox && NULL != strstr(line, ROCKBOX_TIMEZONE_UNKNOWN);
+    rewind(file);
+
+    const long start_offset = import_checkpoint_load(checkpoint_path, file_path);
+    if (start_offset > 0) {
+        _info("signon::import: resuming %s from offset %ld", file_path, start_offset);
+        fseek(file, start_offset, SEEK_SET);
+    }
+
+    struct event_base *evbase = event_base_new();
+    struct scrobbler *scrobbler = calloc(1, sizeof(struct scrobbler));
+    scrobbler_init(scrobbler, config, evbase);
+
+    struct scrobble_queue *queue = &scrobbler->queue;
+    struct json_tokener *tokener = json_tokener_new();
+    struct import_offset offsets[MAX_QUEUE_LENGTH] = {0};
+    struct scrobble track = {0};
+    const size_t dead_letters = dead_letter_count(config->dead_letter_path);
+    size_t total = 0, skipped = 0, invalid = 0;
+    unsigned failures = 0;
+    double next_round = 0;
+    bool at_end = false;
+
+    _info("signon::import: %s file %s", get_import_format_label(format), file_path);
+    while (true) {
+        while (!at_end && queue->length < MAX_QUEUE_LENGTH) {
+            const long offset = ftell(file);
+            read = getline(&line, &line_size, file);
+            if (read < 0) {
+                at_end = true;
+                break;
+            }
+
+            enum import_entry_status entry = import_entry_skipped;
+            if (format == import_format_rockbox) {
+                entry = import_parse_rockbox(line, &track, local_time);
+            } else if (read > 1) {
+                entry = import_parse_listen(tokener, line, (size_t)read, &track);
+            }
+            if (entry == import_entry_skipped) {
+                skipped++;
+                continue;
+            }
+            if (entry == import_entry_invalid) {
+                _warn("signon::import: invalid entry at offset %ld", offset);
+                invalid++;
+                continue;
+            }
+            queue_append(queue, &track, pending);
+            import_offset_set(offsets, queue->last_id, offset);
+            total++;
+        }
+        if (queue->length == 0) { break; }
+
+        wait_milliseconds(next_round - monotonic_milliseconds());
+        next_round = monotonic_milliseconds() + IMPORT_MIN_ROUND_MILLISECONDS;
+
+        const unsigned weight = queue_weight(queue);
+        scrobbler_send_queue(scrobbler, api_build_request_scrobble);
+        while (queue_is_in_flight(queue)) {
+            event_base_loop(evbase, EVLOOP_ONCE);
+        }
+        scrobbler_connections_clean(&scrobbler->connections, true);
+
+        // NOTE(marius): everything before the oldest track still in the queue was handled
+        const long checkpoint = queue->length > 0 ? import_offset_get(offsets, queue->deliveries[0].id) : ftell(file);
+        import_checkpoint_save(checkpoint_path, file_path, checkpoint);
+        for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+            if (offsets[i].id != 0 && queue_find(queue, offsets[i].id) < 0) {
+                memset(&offsets[i], 0x0, sizeof(offsets[i]));
+            }
+        }
+
+        if (queue->length > 0 && queue_weight(queue) >= weight) {
+            failures++;
+            if (failures > IMPORT_MAX_RETRIES) {
+                _error("signon::import: giving up after %u retries, run the import again to resume", IMPORT_MAX_RETRIES);
+                goto _clean;
+            }
+            _warn("signon::import: no progress, retrying in %us", IMPORT_RETRY_DELAY_SECONDS * failures);
+            next_round = monotonic_milliseconds() + IMPORT_RETRY_DELAY_SECONDS * failures * 1000.0;
+        } else {
+            failures = 0;
+        }
+        _info("signon::import: %zu read, %d queued", total, queue->length);
+    }
+    status = true;
+    unlink(checkpoint_path);
+
+_clean:
+    fprintf(stdout, "Imported %zu listens from %s: %zu rejected, %zu invalid entries, %zu skipped.\n", total - (size_t)queue->length,
+        file_path, dead_letter_count(config->dead_letter_path) - dead_letters, invalid, skipped);
+
+    json_tokener_free(tokener);
+    scrobbler_clean(scrobbler);
+    free(scrobbler);
+    event_base_free(evbase);
+_close:
+    free(line);
+    fclose(file);
+    return status;
+}
+
 int main (const int argc, char *argv[])
 {
     int status = EXIT_FAILURE;
@@ -229,7 +654,7 @@ int main (const int argc, char *argv[])
         status = EXIT_SUCCESS;
         goto _exit;
     }
-    if(arguments.service == api_unknown && !arguments.reload) {
+    if(arguments.service == api_unknown && !arguments.reload && !arguments.dead_letter && !arguments.import) {
         _error("signon::debug: no service selected");
         status = EXIT_FAILURE;
         goto _exit;
@@ -245,6 +670,16 @@ int main (const int argc, char *argv[])
         reload_daemon(&config);
         goto _exit;
     }
+    if (arguments.import) {
+        status = import_file(&config, &arguments) ? EXIT_SUCCESS : EXIT_FAILURE;
+        configuration_clean(&config);
+        goto _exit;
+    }
+    if (arguments.dead_letter) {
+        status = dead_letter_command(&config, &arguments) ? EXIT_SUCCESS : EXIT_FAILURE;
+        configuration_clean(&config);
+        goto _exit;
+    }
 
     const size_t count = config.credentials_count;
     if (count == 0) {
@@ -254,6 +689,7 @@ int main (const int argc, char *argv[])
     struct api_credentials *creds = NULL;
     for (size_t i = 0; i < count; i++) {
         if (config.credentials[i].end_point != arguments.service) { continue; }
+        if (strncmp(config.credentials[i].account, arguments.account, USER_NAME_MAX) != 0) { continue; }
 
         creds = &config.credentials[i];
         found = true;
@@ -262,6 +698,7 @@ int main (const int argc, char *argv[])
     if (NULL == creds) {
         creds = api_credentials_new();
         creds->end_point = arguments.service;
+        strncpy(creds->account, arguments.account, USER_NAME_MAX);
         const char *key = api_get_application_key(creds->end_point);
         memcpy((char*)creds->api_key, key, min(MAX_SECRET_LENGTH, strlen(key)));
         const char *secret = api_get_application_secret(creds->end_point);
@@ -299,23 +736,20 @@ int main (const int argc, char *argv[])
             get_session(creds);
         }
     }
-    if (!found) {
-        memcpy(&config.credentials[config.credentials_count], creds, sizeof(struct api_credentials));
-        config.credentials_count++;
+    if (!found && config.credentials_count >= MAX_CREDENTIALS) {
+        _error("signon::config_error: only %d accounts are supported", MAX_CREDENTIALS);
+        success = false;
+    } else if (!found) {
+        arrput(config.credentials, *creds);
+        config.credentials_count = arrlenu(config.credentials);
     }
 #if 0
     print_application_config(config);
 #endif
 
     if (success) {
+        // NOTE(marius): a running daemon watches the credentials file and reloads it by itself
         if (write_credentials_file(&config) == 0) {
-            if (
-                (arguments.get_token && arguments.service == api_listenbrainz) ||
-                arguments.get_session ||
-                arguments.disable || arguments.enable
-            ) {
-                reload_daemon(&config);
-            }
             status = EXIT_SUCCESS;
         } else {
             _warn("signon::config_error: unable to write to configuration file");
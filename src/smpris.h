@@ -65,15 +65,45 @@ static bool mpris_player_is_valid(const struct mpris_player *player)
     return strlen(player->mpris_name) > 1 && strlen(player->name) > 0 && NULL != player->scrobbler;
 }
 
+#define _load_field_hash(s, field) \
+    hash_field_load(&(s).hashes.field, (const char*)(s).field, sizeof((s).field)/(MAX_PROPERTY_LENGTH+1), MAX_PROPERTY_LENGTH+1)
+
+#define _field_equals(a, b, field) \
+    hash_field_equals((const char*)(a).field, &(a).hashes.field, (const char*)(b).field, &(b).hashes.field, MAX_PROPERTY_LENGTH+1)
+
+/*
+ * Loads the lengths and hashes of the string properties, it needs to be called after the values change,
+ * the equality checks rely on them.
+ */
+static void mpris_properties_hash(struct mpris_properties *p)
+{
+    struct mpris_metadata *m = &p->metadata;
+    _load_field_hash(*m, track_id);
+    _load_field_hash(*m, album);
+    _load_field_hash(*m, title);
+    _load_field_hash(*m, url);
+    _load_field_hash(*m, art_url);
+    _load_field_hash(*m, genre);
+    _load_field_hash(*m, comment);
+    _load_field_hash(*m, artist);
+    _load_field_hash(*m, album_artist);
+    _load_field_hash(*m, mb_track_id);
+    _load_field_hash(*m, mb_album_id);
+    _load_field_hash(*m, mb_artist_id);
+    _load_field_hash(*m, mb_album_artist_id);
+    _load_field_hash(*p, loop_status);
+    _load_field_hash(*p, playback_status);
+}
+
 static bool mpris_metadata_equals(const struct mpris_metadata *s, const struct mpris_metadata *p)
 {
+    // NOTE(marius): the numeric fields are the cheapest to check, so they go first
     bool result = (
-        (!_is_zero(s->title) && !_is_zero(p->title) && _eq(s->title, p->title)) &&
-        (!_is_zero(s->album) && !_is_zero(p->album) && _eq(s->album, p->album)) &&
-        (!_is_zero(s->artist) && !_is_zero(p->artist) && _eq(s->artist, p->artist)) &&
         (s->length == p->length) &&
-        (s->track_number == p->track_number) /*&&
-        (s->start_time == p->start_time)*/
+        (s->track_number == p->track_number) &&
+        (s->hashes.title.len[0] > 0 && _field_equals(*s, *p, title)) &&
+        (s->hashes.album.len[0] > 0 && _field_equals(*s, *p, album)) &&
+        (s->hashes.artist.len[0] > 0 && _field_equals(*s, *p, artist))
     );
     _trace2("mpris::check_metadata(%p:%p) %s", s, p, result ? "same" : "different");
 
@@ -87,8 +117,8 @@ static bool mpris_properties_equals(const struct mpris_properties *sp, const str
     if (sp == pp) { return true; }
 
     const bool result = mpris_metadata_equals(&sp->metadata, &pp->metadata) &&
-        strlen(sp->playback_status)+strlen(pp->playback_status) > 0 &&
-        _eq(sp->playback_status, pp->playback_status);
+        sp->hashes.playback_status.len[0] > 0 &&
+        _field_equals(*sp, *pp, playback_status);
 
     _trace2("mpris::check_properties(%p:%p) %s", sp, pp, result ? "same" : "different");
     return result;
@@ -101,7 +131,18 @@ static inline bool mpris_event_changed_playback_status(const struct mpris_event
 
 static inline bool mpris_event_changed_track(const struct mpris_event *ev)
 {
-    return ev->loaded_state > mpris_load_property_position;
+    return ev->loaded_state >= mpris_load_metadata_bitrate;
+}
+
+static inline bool mpris_event_changed_rate(const struct mpris_event *ev)
+{
+    return ev->loaded_state & mpris_load_property_rate;
+}
+
+static double mpris_properties_rate(const struct mpris_properties *p)
+{
+    // NOTE(marius): players which don't support changing the rate can omit the property
+    return p->rate > 0 ? p->rate : 1.0;
 }
 
 static inline bool mpris_event_changed_volume(const struct mpris_event *ev)
@@ -13,7 +13,20 @@
 #endif
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The length, compare and trim loops check 16 bytes at a time with SSE2 when it's available, which is
+ * always the case on x86_64. Defining GRRRS_NO_SIMD forces the scalar versions.
+ * The copies and the zero-fills are left to memcpy/memset, which libc already vectorises.
+ */
+#if defined(__SSE2__) && !defined(GRRRS_NO_SIMD)
+#define GRRRS_SSE2 1
+#include <emmintrin.h>
+#endif
 
 #ifndef grrrs_std_alloc
 #include <stdlib.h>
@@ -43,6 +56,8 @@
 #define _OKP(A) (NULL != (A))
 #define _GRRRS_NULL_TOP_PTR (ptrdiff_t)(-2 * (ptrdiff_t)sizeof(uint32_t))
 
+#define GRRRS_TRIM_SIMD_CHARS 8
+
 #define _grrr_sizeof(C) (sizeof(struct grrr_string) + ((size_t)(C+1) * sizeof(char)))
 
 #define grrrs_from_string(A) (_VOID(A) ? \
@@ -89,14 +104,12 @@ static struct grrr_string *_grrrs_new_empty(const size_t cap)
 
     result->len = 0;
     result->cap = (uint32_t)cap;
-    for (size_t i = 0; i <= cap; i++) {
-        result->data[i] = '\0';
-    }
+    memset(result->data, '\0', cap + 1);
 
     return result;
 }
 
-internal uint32_t __strlen(const char *s)
+internal uint32_t __strlen_scalar(const char *s)
 {
     if (_VOID(s)) { return 0; }
 
@@ -107,6 +120,43 @@ internal uint32_t __strlen(const char *s)
     return result;
 }
 
+#ifdef GRRRS_SSE2
+/*
+ * The loads are aligned to 16 bytes, so they never cross into the next page even when they read past the
+ * terminator. The bytes in front of the string in the first block are shifted out of the mask.
+ */
+__attribute__((no_sanitize_address))
+internal uint32_t __strlen_sse2(const char *s)
+{
+    if (_VOID(s)) { return 0; }
+
+    const __m128i zero = _mm_setzero_si128();
+    const unsigned misalignment = (unsigned)((uintptr_t)s & 15);
+    const char *block = s - misalignment;
+
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)block), zero));
+    mask >>= misalignment;
+    if (mask != 0) { return (uint32_t)__builtin_ctz(mask); }
+
+    while (true) {
+        block += 16;
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)block), zero));
+        if (mask != 0) {
+            return (uint32_t)(block - s) + (uint32_t)__builtin_ctz(mask);
+        }
+    }
+}
+#endif
+
+internal uint32_t __strlen(const char *s)
+{
+#ifdef GRRRS_SSE2
+    return __strlen_sse2(s);
+#else
+    return __strlen_scalar(s);
+#endif
+}
+
 static void __cstrncpy(char *dest, const char *src, uint32_t len)
 {
     if (_VOID(dest)) {
@@ -115,9 +165,7 @@ static void __cstrncpy(char *dest, const char *src, uint32_t len)
     if (_VOID(src)) {
         return;
     }
-    for (uint32_t i = 0; i < len; i++) {
-        dest[i] = src[i];
-    }
+    memcpy(dest, src, len);
     dest[len] = '\0';
 }
 
@@ -178,7 +226,20 @@ static int __grrrs_cmp(const struct grrr_string *s1, const struct grrr_string *s
     if (s1->len != s2->len) {
         return (int32_t)s1->len - (int32_t)s2->len;
     }
-    for (uint32_t i = 0; i < s1->len; i++) {
+    uint32_t i = 0;
+#ifdef GRRRS_SSE2
+    // NOTE(marius): the first block with a difference or a NULL falls through to the scalar loop, which
+    // reports it the same as before
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= s1->len; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(s1->data + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(s2->data + i));
+        const __m128i nulls = _mm_or_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero));
+        const __m128i equal = _mm_andnot_si128(nulls, _mm_cmpeq_epi8(a, b));
+        if (_mm_movemask_epi8(equal) != 0xFFFF) { break; }
+    }
+#endif
+    for (; i < s1->len; i++) {
         if (s1->data[i] == '\0') {
             GRRRS_ERR("NULL value in string data before length[%" PRIu32 ":%" PRIu32 "]", i, s1->len);
         }
@@ -212,9 +273,9 @@ internal struct grrr_string *__grrrs_resize(struct grrr_string *gs, uint32_t new
         gs->data[new_cap] = '\0';
     }
 
-    for (unsigned i = gs->cap; i <= new_cap; i++) {
+    if (new_cap >= gs->cap) {
         // ensure that the new capacity is zeroed
-        gs->data[i] = '\0';
+        memset(gs->data + gs->cap, '\0', (size_t)(new_cap - gs->cap) + 1);
     }
     gs->cap = new_cap;
 
@@ -228,10 +289,113 @@ static void *_grrrs_resize(void *s, uint32_t new_cap)
     return __grrrs_resize(gs, new_cap)->data;
 }
 
+/*
+ * The characters to trim, as a lookup table for the scalar loops, and as a list for the SIMD ones, which
+ * compare every block against each character. Sets larger than GRRRS_TRIM_SIMD_CHARS use only the table.
+ */
+struct grrrs_trim_set {
+    bool table[256];
+    uint32_t len;
+    char chars[GRRRS_TRIM_SIMD_CHARS];
+};
+
+internal void __grrrs_trim_set_init(struct grrrs_trim_set *set, const char *c)
+{
+    memset(set, 0x0, sizeof(*set));
+    for (; *c != '\0'; c++) {
+        const unsigned char t = (unsigned char)*c;
+        if (set->table[t]) { continue; }
+        set->table[t] = true;
+        if (set->len < GRRRS_TRIM_SIMD_CHARS) {
+            set->chars[set->len] = *c;
+        }
+        set->len++;
+    }
+}
+
+/*
+ * The number of characters from the start of s that are in the trim set.
+ */
+internal uint32_t __grrrs_span_scalar(const char *s, const uint32_t len, const struct grrrs_trim_set *set)
+{
+    uint32_t i = 0;
+    while (i < len && set->table[(unsigned char)s[i]]) { i++; }
+    return i;
+}
+
+/*
+ * The number of characters from the end of s that are in the trim set.
+ */
+internal uint32_t __grrrs_rspan_scalar(const char *s, const uint32_t len, const struct grrrs_trim_set *set)
+{
+    uint32_t i = len;
+    while (i > 0 && set->table[(unsigned char)s[i-1]]) { i--; }
+    return len - i;
+}
+
+#ifdef GRRRS_SSE2
+/*
+ * Bit i of the result is set when byte i of the block isn't in the trim set.
+ */
+internal unsigned __grrrs_trim_set_miss_sse2(const struct grrrs_trim_set *set, const __m128i block)
+{
+    __m128i match = _mm_setzero_si128();
+    for (uint32_t k = 0; k < set->len; k++) {
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8(set->chars[k])));
+    }
+    return ~(unsigned)_mm_movemask_epi8(match) & 0xFFFF;
+}
+
+internal uint32_t __grrrs_span_sse2(const char *s, const uint32_t len, const struct grrrs_trim_set *set)
+{
+    uint32_t i = 0;
+    if (set->len <= GRRRS_TRIM_SIMD_CHARS) {
+        for (; i + 16 <= len; i += 16) {
+            const unsigned miss = __grrrs_trim_set_miss_sse2(set, _mm_loadu_si128((const __m128i*)(s + i)));
+            if (miss != 0) { return i + (uint32_t)__builtin_ctz(miss); }
+        }
+    }
+    return i + __grrrs_span_scalar(s + i, len - i, set);
+}
+
+internal uint32_t __grrrs_rspan_sse2(const char *s, const uint32_t len, const struct grrrs_trim_set *set)
+{
+    uint32_t i = len;
+    if (set->len <= GRRRS_TRIM_SIMD_CHARS) {
+        for (; i >= 16; i -= 16) {
+            const unsigned miss = __grrrs_trim_set_miss_sse2(set, _mm_loadu_si128((const __m128i*)(s + i - 16)));
+            if (miss != 0) {
+                // the last byte that isn't trimmed is the highest bit set
+                const uint32_t last = i - 16 + (uint32_t)(31 - __builtin_clz(miss));
+                return len - last - 1;
+            }
+        }
+    }
+    return (len - i) + __grrrs_rspan_scalar(s, i, set);
+}
+#endif
+
+internal uint32_t __grrrs_span(const char *s, const uint32_t len, const struct grrrs_trim_set *set)
+{
+#ifdef GRRRS_SSE2
+    return __grrrs_span_sse2(s, len, set);
+#else
+    return __grrrs_span_scalar(s, len, set);
+#endif
+}
+
+internal uint32_t __grrrs_rspan(const char *s, const uint32_t len, const struct grrrs_trim_set *set)
+{
+#ifdef GRRRS_SSE2
+    return __grrrs_rspan_sse2(s, len, set);
+#else
+    return __grrrs_rspan_scalar(s, len, set);
+#endif
+}
+
 static void *_grrrs_trim_left(char *s, const char *c)
 {
     char *result = s;
-    char *to_trim = NULL;
     if (_VOID(s)) { return result; }
 
     struct grrr_string *gs = _grrrs_ptr(s);
@@ -240,54 +404,18 @@ static void *_grrrs_trim_left(char *s, const char *c)
         gs->len = __strlen(s);
     }
 
-    if (_VOID(c)) {
-        to_trim = _grrrs_new_from_cstring(" \t\r\n")->data;
-    } else {
-        to_trim = _grrrs_new_from_cstring(c)->data;
-    }
-    const uint32_t len_to_trim = grrrs_len(to_trim);
-
-    int32_t trim_end = -1;
-    uint32_t new_len = gs->len;
-    for (uint32_t i = 0; i < gs->len; i++) {
-        for (uint32_t j = 0; j < len_to_trim; j++) {
-            const char t = to_trim[j];
-            if (gs->data[i] == '\0') {
-                break;
-            }
-            if (gs->data[i] == t) {
-                new_len--;
-                break;
-            }
-            if (j == len_to_trim - 1) {
-                trim_end = (int32_t)i;
-            }
-        }
-        if (trim_end >= 0) {
-            break;
-        }
-    }
-    if (new_len == gs->len) {
-        goto _to_trim_free;
-    }
-
-    char *temp = grrrs_std_alloc((new_len+1)*sizeof(char));
-    if (trim_end < 0) { trim_end = 0; }
+    struct grrrs_trim_set set;
+    __grrrs_trim_set_init(&set, _VOID(c) ? " \t\r\n" : c);
 
-    for (uint32_t k = 0; k < new_len; k++) {
-        temp[k] = gs->data[(uint32_t)trim_end + k];
-    }
-    for (uint32_t k = 0; k < new_len; k++) {
-        gs->data[k] = temp[k];
-    }
-    for (uint32_t k = new_len; k < gs->len; k++) {
-        gs->data[k] = '\0';
+    const uint32_t trimmed = __grrrs_span(gs->data, gs->len, &set);
+    if (trimmed == 0) {
+        return result;
     }
-    gs->len = (uint32_t)new_len;
-    grrrs_std_free(temp);
 
-_to_trim_free:
-    _grrrs_free(to_trim);
+    const uint32_t new_len = gs->len - trimmed;
+    memmove(gs->data, gs->data + trimmed, new_len);
+    memset(gs->data + new_len, '\0', trimmed);
+    gs->len = new_len;
 
     return result;
 }
@@ -295,7 +423,6 @@ _to_trim_free:
 static void *_grrrs_trim_right(char *s, const char *c)
 {
     char *result = s;
-    char *to_trim = NULL;
     if (_VOID(s)) { return result; }
 
     struct grrr_string *gs = _grrrs_ptr(s);
@@ -304,46 +431,16 @@ static void *_grrrs_trim_right(char *s, const char *c)
         gs->len = __strlen(s);
     }
 
-    if (_VOID(c)) {
-        to_trim = _grrrs_new_from_cstring("\r \t\n")->data;
-    } else {
-        to_trim = _grrrs_new_from_cstring(c)->data;
-    }
-    uint32_t len_to_trim = grrrs_len(to_trim);
-
-    //assert(gs->len, len(gs->data);
-
-    int8_t stop = 0;
-    int32_t new_len = (int32_t)gs->len;
-    for (int32_t i = (int32_t)gs->len - 1; i >= 0; i--) {
-        for (uint32_t j = 0; j < len_to_trim; j++) {
-            const char t = to_trim[j];
-            // if we encounter \0 on the right side, we consider the string terminated
-            // and we save the new length
-            if (gs->data[i] == '\0') {
-                new_len = i + 1;
-                break;
-            }
-            if (gs->data[i] == t) {
-                gs->data[i] = '\0';
-                new_len--;
-                break;
-            }
-            if (j == len_to_trim - 1) {
-                stop = 1;
-            }
-        }
-        if (stop) {
-            break;
-        }
-    }
-    if (new_len == (int32_t)gs->len) {
-        goto _to_trim_free;
+    struct grrrs_trim_set set;
+    __grrrs_trim_set_init(&set, _VOID(c) ? "\r \t\n" : c);
+
+    const uint32_t trimmed = __grrrs_rspan(gs->data, gs->len, &set);
+    if (trimmed == 0) {
+        return result;
     }
-    gs->len = (uint32_t)new_len;
 
-_to_trim_free:
-    _grrrs_free(to_trim);
+    gs->len -= trimmed;
+    memset(gs->data + gs->len, '\0', trimmed);
 
     return result;
 }
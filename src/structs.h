@@ -29,6 +29,13 @@
 #define ARG_COMMAND_ENABLE      "enable"
 #define ARG_COMMAND_DISABLE     "disable"
 #define ARG_COMMAND_SESSION     "session"
+#define ARG_COMMAND_DEAD_LETTER "deadletter"
+#define ARG_COMMAND_IMPORT      "import"
+
+#define ARG_DEAD_LETTER_LIST        "list"
+#define ARG_DEAD_LETTER_FIX         "fix"
+#define ARG_DEAD_LETTER_REMOVE      "remove"
+#define ARG_DEAD_LETTER_RESUBMIT    "resubmit"
 
 #define HELP_OPTIONS        "Options:\n"\
 "\t" ARG_HELP_LONG "\t\t\tDisplay this help.\n" \
@@ -73,6 +80,7 @@ struct api_credentials {
     char token[MAX_SECRET_LENGTH + 1];
     char session_key[MAX_SECRET_LENGTH + 1];
     char url[MAX_URL_LENGTH + 1];
+    char account[USER_NAME_MAX + 1];
     enum api_type end_point;
     bool enabled;
     bool authenticated;
@@ -93,7 +101,8 @@ struct env_variables {
 };
 
 #define MAX_PLAYERS 10
-#define MAX_CREDENTIALS 10
+// NOTE(marius): the scrobble queue keeps the delivery state of each credential in the bits of an unsigned
+#define MAX_CREDENTIALS 16
 
 struct configuration {
     const char name[USER_NAME_MAX+1];
@@ -101,16 +110,37 @@ struct configuration {
     const char config_path[FILE_PATH_MAX+1];
     const char credentials_path[FILE_PATH_MAX+1];
     const char cache_path[FILE_PATH_MAX+1];
+    const char dead_letter_path[FILE_PATH_MAX+1];
+    const char fingerprints_path[FILE_PATH_MAX+1];
     const char ignore_players[MAX_PLAYERS][MAX_PROPERTY_LENGTH+1];
-    struct api_credentials credentials[MAX_CREDENTIALS];
+    struct api_credentials *credentials; // stb_ds array, grown as the credentials are loaded
     struct env_variables env;
     size_t credentials_count;
+    long http2_streams; // the requests multiplexed on one connection
+    bool http2;
     bool wrote_pid;
     bool env_loaded;
     short ignore_players_count;
 };
 
 #define MAX_PROPERTY_COUNT 8
+// NOTE(marius): the lengths and hashes of the string fields, loaded together with the values by mpris_properties_hash
+struct mpris_metadata_hashes {
+    struct hash_field track_id;
+    struct hash_field album;
+    struct hash_field title;
+    struct hash_field url;
+    struct hash_field art_url;
+    struct hash_field genre;
+    struct hash_field comment;
+    struct hash_field artist;
+    struct hash_field album_artist;
+    struct hash_field mb_track_id;
+    struct hash_field mb_album_id;
+    struct hash_field mb_artist_id;
+    struct hash_field mb_album_artist_id;
+};
+
 struct mpris_metadata {
     uint64_t length; // mpris specific
     unsigned track_number;
@@ -131,11 +161,18 @@ struct mpris_metadata {
     char mb_album_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
     char mb_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
     char mb_album_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    struct mpris_metadata_hashes hashes;
+};
+
+struct mpris_properties_hashes {
+    struct hash_field loop_status;
+    struct hash_field playback_status;
 };
 
 struct mpris_properties {
     struct mpris_metadata metadata;
     double volume;
+    double rate;
     int64_t position;
     bool can_control;
     bool can_go_next;
@@ -147,14 +184,54 @@ struct mpris_properties {
     char player_name[MAX_PROPERTY_LENGTH+1];
     char loop_status[MAX_PROPERTY_LENGTH+1];
     char playback_status[MAX_PROPERTY_LENGTH+1];
+    struct mpris_properties_hashes hashes;
+};
+
+enum reload_targets {
+    reload_none = 0,
+    reload_config = 1 << 0,
+    reload_credentials = 1 << 1,
+};
+
+struct config_watch {
+    int fd;
+    int config_wd;
+    int credentials_wd;
+    unsigned pending;
+    struct event *changed;
+    struct event *debounce;
+};
+
+// NOTE(marius): the players' deadlines share a timer wheel which is driven by a single libevent timer
+struct event_timers {
+    struct timer_wheel wheel;
+    struct event *tick;
+    double suspended; // milliseconds spent in suspend, the difference between CLOCK_BOOTTIME and CLOCK_MONOTONIC
 };
 
 struct events {
     struct event_base *base;
+    struct event_timers *timers;
     struct event *sigint;
     struct event *sigterm;
     struct event *sighup;
     struct event dispatch;
+    struct config_watch watch;
+};
+
+#define MAX_FULL_ARTIST_LENGTH          (MAX_PROPERTY_COUNT * (MAX_PROPERTY_LENGTH + 1))
+
+// NOTE(marius): the values the request builders derive from the metadata, kept in the track cache
+struct scrobble_details {
+    bool loaded;
+    unsigned short full_artist_len;
+    unsigned short esc_full_artist_len;
+    unsigned short esc_title_len;
+    unsigned short esc_album_len;
+    char full_artist[MAX_FULL_ARTIST_LENGTH]; // the artists joined by VALUE_SEPARATOR
+    char esc_full_artist[ESCAPE_URL_MAX_LENGTH(MAX_FULL_ARTIST_LENGTH)];
+    char esc_title[ESCAPE_URL_MAX_LENGTH(MAX_PROPERTY_LENGTH)];
+    char esc_album[ESCAPE_URL_MAX_LENGTH(MAX_PROPERTY_LENGTH)];
 };
 
 struct scrobble {
@@ -179,6 +256,20 @@ struct scrobble {
     char mb_spotify_id[MAX_PROPERTY_LENGTH+1]; // spotify id for listenbrainz
 };
 
+#define TRACK_CACHE_SIZE                8
+
+// NOTE(marius): the details of a track, found by the hash of the values they're derived from
+struct track_cache_entry {
+    uint64_t key;       // the hash of the artists, title and album, 0 for the empty entries
+    uint64_t used;      // the use count when it was last used, the least recently used entry is replaced
+    struct scrobble_details details;
+};
+
+struct track_cache {
+    uint64_t uses;
+    struct track_cache_entry entries[TRACK_CACHE_SIZE];
+};
+
 enum playback_state {
     killed = 0U,
     stopped = 1U << 0U,
@@ -200,22 +291,24 @@ enum mpris_load_types {
     // from here the loaded information is relevant for a scrobble change
     mpris_load_property_position = 1U << 9U,
     mpris_load_property_playback_status = 1U << 10U,
-    mpris_load_metadata_bitrate = 1U << 11U,
-    mpris_load_metadata_art_url = 1U << 12U,
-    mpris_load_metadata_length = 1U << 13U,
-    mpris_load_metadata_track_id = 1U << 14U,
-    mpris_load_metadata_album = 1U << 15U,
-    mpris_load_metadata_album_artist = 1U << 16U,
-    mpris_load_metadata_artist = 1U << 17U,
-    mpris_load_metadata_comment = 1U << 18U,
-    mpris_load_metadata_title = 1U << 19U,
-    mpris_load_metadata_track_number = 1U << 20U,
-    mpris_load_metadata_url = 1U << 21U,
-    mpris_load_metadata_genre = 1U << 22U,
-    mpris_load_metadata_mb_track_id = 1U << 23U,
-    mpris_load_metadata_mb_album_id = 1U << 24U,
-    mpris_load_metadata_mb_artist_id = 1U << 25U,
-    mpris_load_metadata_mb_album_artist_id = 1U << 26U,
+    mpris_load_property_rate = 1U << 11U,
+    // from here the loaded information belongs to the track
+    mpris_load_metadata_bitrate = 1U << 12U,
+    mpris_load_metadata_art_url = 1U << 13U,
+    mpris_load_metadata_length = 1U << 14U,
+    mpris_load_metadata_track_id = 1U << 15U,
+    mpris_load_metadata_album = 1U << 16U,
+    mpris_load_metadata_album_artist = 1U << 17U,
+    mpris_load_metadata_artist = 1U << 18U,
+    mpris_load_metadata_comment = 1U << 19U,
+    mpris_load_metadata_title = 1U << 20U,
+    mpris_load_metadata_track_number = 1U << 21U,
+    mpris_load_metadata_url = 1U << 22U,
+    mpris_load_metadata_genre = 1U << 23U,
+    mpris_load_metadata_mb_track_id = 1U << 24U,
+    mpris_load_metadata_mb_album_id = 1U << 25U,
+    mpris_load_metadata_mb_artist_id = 1U << 26U,
+    mpris_load_metadata_mb_album_artist_id = 1U << 27U,
     mpris_load_all = (1U << 31U) - 1, // all bits are set for our max enum val
 };
 
@@ -234,12 +327,15 @@ struct dbus {
     DBusConnection *conn;
     DBusWatch *watch;
     DBusTimeout *timeout;
+    // NOTE(marius): the system bus is used only for the logind and NetworkManager signals
+    DBusConnection *system;
+    DBusWatch *system_watch;
 };
 
 struct event_payload {
     struct mpris_player *parent;
     struct scrobble scrobble;
-    struct event event;
+    struct timer_wheel_entry timer;
 };
 
 #define MAX_HEADER_LENGTH               256
@@ -247,6 +343,9 @@ struct event_payload {
 #define MAX_HEADER_VALUE_LENGTH         512
 #define MAX_BODY_SIZE                   16384
 
+#define MAX_QUEUE_LENGTH 32
+#define MAX_WAIT_SECONDS 10
+
 struct http_header {
     char name[MAX_HEADER_NAME_LENGTH];
     char value[MAX_HEADER_VALUE_LENGTH];
@@ -270,6 +369,7 @@ typedef enum http_request_types {
 struct http_request {
     char body[MAX_BODY_SIZE+1];
     struct http_header **headers;
+    struct curl_slist *shared_headers; // owned by the request template of the account
     size_t body_length;
     time_t time;
     struct api_endpoint *end_point;
@@ -277,6 +377,37 @@ struct http_request {
     http_request_type request_type;
 };
 
+// NOTE(marius): the parts of the requests that depend only on the account, they're built when the
+//  credentials are loaded, so the requests need only to add the track information
+struct api_request_template {
+    CURLU *url;                 // the endpoint, with the query parameters common to all the requests
+    struct curl_slist *headers; // sent with every request
+    char api_key[3 * MAX_SECRET_LENGTH + 1];     // url escaped
+    char session_key[3 * MAX_SECRET_LENGTH + 1]; // url escaped
+};
+
+// NOTE(marius): the lower values are started first
+enum request_class {
+    request_auth = 0,
+    request_scrobble,
+    request_now_playing,
+};
+#define REQUEST_CLASS_COUNT 3
+
+struct request_class_stats {
+    unsigned sent;
+    unsigned shed;      // dropped before being started
+    unsigned preempted; // aborted to make room for a higher class
+    unsigned connects;  // new connections the transfers had to open
+    double wait_total;  // milliseconds spent waiting to be started
+    double wait_max;
+};
+
+struct request_scheduler {
+    unsigned running;
+    struct request_class_stats stats[REQUEST_CLASS_COUNT];
+};
+
 struct scrobbler_connection {
     char error[CURL_ERROR_SIZE+1];
     struct event ev;
@@ -288,37 +419,133 @@ struct scrobbler_connection {
     struct curl_slist **headers;
     struct http_request request;
     struct http_response response;
+    struct arena arena; // the transient allocations made while building the request
     CURL *handle;
     curl_socket_t sockfd;
     bool should_free;
+    bool acknowledged;
+    bool waiting;   // queued in the scheduler, not yet added to the multi handle
+    bool running;   // added to the multi handle, and not done
+    enum request_class priority;
+    double queued_at; // monotonic milliseconds
     int action;
     int idx;
+    int credentials_idx;
 #ifdef RETRY_ENABLED
     int retries;
 #endif
+    unsigned track_count;
+    unsigned long track_ids[MAX_QUEUE_LENGTH];
 };
 
-#define MAX_QUEUE_LENGTH 32
-#define MAX_WAIT_SECONDS 10
-
 struct scrobble_connections {
     int length;
     struct scrobbler_connection *entries[MAX_QUEUE_LENGTH];
 };
 
+enum scrobble_ack_status {
+    scrobble_ack_retry = 0, // no usable answer for the track, it gets resent
+    scrobble_ack_accepted,
+    scrobble_ack_ignored,   // the service refused the track, resending won't help
+    scrobble_ack_rejected,  // the service refused the whole request, resending won't help
+    scrobble_ack_isolate,   // the batch was refused, resend the track on its own
+};
+
+struct scrobble_ack {
+    enum scrobble_ack_status status;
+    int code; // service specific reason for ignoring the track
+};
+
+enum dead_letter_reason {
+    dead_letter_invalid = 1, // the scrobble failed our own validation
+    dead_letter_ignored,     // the service ignored the scrobble
+    dead_letter_rejected,    // the service rejected the request containing the scrobble
+    dead_letter_evicted,     // the queue was full and the scrobble was the oldest entry
+};
+
+struct dead_letter {
+    size_t id;
+    char state;
+    enum api_type end_point;
+    enum dead_letter_reason reason;
+    int code;
+    time_t rejected_at;
+    char account[USER_NAME_MAX + 1];
+    struct scrobble scrobble;
+};
+
+// NOTE(marius): the bit masks are indexed by the position of the credentials in the configuration
+struct scrobble_delivery {
+    unsigned long id;
+    unsigned pending;   // services which didn't acknowledge the scrobble yet
+    unsigned in_flight; // services which have a request containing the scrobble
+    unsigned isolated;  // services which need the scrobble to be sent on its own
+};
+
 struct scrobble_queue {
     int length;
-    struct scrobble entries[MAX_QUEUE_LENGTH];
+    unsigned long last_id;
+    struct scrobble_delivery deliveries[MAX_QUEUE_LENGTH];
+    struct scrobble *entries; // stb_ds array, grown on append up to MAX_QUEUE_LENGTH
+};
+
+// NOTE(marius): the account of each bit of the delivery masks, as saved in the queue file
+struct queue_account {
+    int32_t end_point;
+    char account[USER_NAME_MAX + 1];
+};
+
+// NOTE(marius): the delivery state of each service, indexed by the position of the credentials in the configuration
+struct scrobbler_service {
+    unsigned failures;
+    time_t retry_at;
+    struct api_request_template template;
+};
+
+enum scrobbler_pause {
+    scrobbler_running = 0,
+    scrobbler_offline = 1 << 0,
+    scrobbler_sleeping = 1 << 1,
 };
 
 struct scrobbler {
     int still_running;
+    unsigned paused;        // the scrobbler_pause reasons for not sending the queue
+    double drain_started;   // monotonic milliseconds when the backlog started to be sent after a pause
+    double drain_duration;  // milliseconds it took for the last backlog to be acknowledged
     CURLM *handle;
     struct event_base *evbase;
     struct configuration *conf;
     struct event timer_event;
+    struct event backoff_event;
     struct scrobble_connections connections;
+    struct request_scheduler scheduler;
+    struct scrobbler_service services[MAX_CREDENTIALS];
     struct scrobble_queue queue;
+    struct fingerprint_cache fingerprints; // the tracks announced or queued recently, from any player
+    struct track_cache *tracks; // the details of the tracks sent recently, allocated with the first request
+};
+
+enum player_state {
+    player_stopped = 0,
+    player_playing,
+    player_paused,
+    player_seeking,       // transient, the position jumped while playing
+    player_track_changed, // transient, a new track started playing
+};
+
+// NOTE(marius): the play time is how much of the current track was listened to, it advances with the playback
+//  rate like the position, but seeking doesn't change it
+struct player_playback {
+    enum player_state state;
+    bool loaded;  // the event payloads hold the current track
+    bool queued;  // the current track was added to the scrobble queue
+    double rate;
+    double play_time;
+    double position;
+    double updated_at; // monotonic milliseconds
+    double now_playing_until; // monotonic milliseconds, when the services stop showing the current track
+    bool now_playing_forced;  // the now playing is sent again after a suspend or a reload, even if another player announced it
 };
 
 struct mpris_player {
@@ -331,8 +558,9 @@ struct mpris_player {
     struct mpris_properties properties;
     struct event_payload now_playing;
     struct event_payload queue;
+    struct player_playback playback;
     struct scrobbler *scrobbler;
-    struct event_base *evbase;
+    struct event_timers *timers;
     struct mpris_properties **history;
 };
 
@@ -342,7 +570,8 @@ struct state {
     struct events events;
     struct scrobbler scrobbler;
     short player_count;
-    struct mpris_player players[MAX_PLAYERS];
+    // NOTE(marius): the players are allocated when they show up on the bus, the loaded ones are first
+    struct mpris_player *players[MAX_PLAYERS];
 };
 
 enum log_levels
@@ -364,6 +593,28 @@ enum binary_type {
 #define URL_ARG_MAX 2048
 #define NAME_ARG_MAX 128
 
+enum dead_letter_command {
+    dead_letter_command_none = 0,
+    dead_letter_command_list,
+    dead_letter_command_fix,
+    dead_letter_command_remove,
+    dead_letter_command_resubmit,
+};
+
+#define MAX_DEAD_LETTER_FIELDS 8
+
+enum import_format {
+    import_format_unknown = 0,
+    import_format_jsonl,
+    import_format_rockbox,
+};
+
+enum import_entry_status {
+    import_entry_ok = 0,
+    import_entry_skipped,
+    import_entry_invalid,
+};
+
 struct parsed_arguments {
     char name[NAME_ARG_MAX + 1];
     char url[URL_ARG_MAX + 1];
@@ -374,6 +625,14 @@ struct parsed_arguments {
     bool disable;
     bool enable;
     bool reload;
+    bool dead_letter;
+    enum dead_letter_command dead_letter_command;
+    size_t dead_letter_id;
+    short dead_letter_field_count;
+    char dead_letter_fields[MAX_DEAD_LETTER_FIELDS][MAX_PROPERTY_LENGTH + 1];
+    bool import;
+    char import_path[FILE_PATH_MAX + 1];
+    char account[USER_NAME_MAX + 1];
     enum binary_type binary;
     enum log_levels log_level;
     enum api_type service;
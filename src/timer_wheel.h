@@ -0,0 +1,211 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_TIMER_WHEEL_H
+#define MPRIS_SCROBBLER_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Hierarchical timer wheel, the time is counted in ticks from a monotonic clock.
+ *
+ * Every level has TIMER_WHEEL_SLOTS slots, a slot on level N covering TIMER_WHEEL_SLOTS^N ticks. A timer
+ * is linked in the lowest level that can hold its distance from the current tick, and it's moved one
+ * level down (cascaded) when the wheel reaches the slot it's in. Adding and cancelling a timer are O(1),
+ * and the entries are intrusive lists so the wheel never allocates.
+ *
+ * With the default values the wheel spans 2^24 ticks, about 46 hours, the timers that expire later are
+ * parked in the last slot and linked again when it's reached.
+ */
+
+#define TIMER_WHEEL_SLOT_BITS       6
+#define TIMER_WHEEL_SLOTS           (1U << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK       (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS          4
+#define TIMER_WHEEL_SPAN            (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+#define TIMER_WHEEL_TICK_MSEC       10
+
+struct timer_wheel_entry;
+typedef void (*timer_wheel_cb)(struct timer_wheel_entry*, void*);
+
+struct timer_wheel_entry {
+    struct timer_wheel_entry *next;
+    struct timer_wheel_entry **prev; // the link pointing to this entry, NULL when the timer is not pending
+    uint64_t expires;
+    timer_wheel_cb callback;
+    void *data;
+};
+
+struct timer_wheel {
+    uint64_t now;
+    size_t count;
+    struct timer_wheel_entry *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+static void timer_wheel_init(struct timer_wheel *wheel, const uint64_t now)
+{
+    memset(wheel, 0x0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+static void timer_wheel_entry_init(struct timer_wheel_entry *entry, timer_wheel_cb callback, void *data)
+{
+    memset(entry, 0x0, sizeof(*entry));
+    entry->callback = callback;
+    entry->data = data;
+}
+
+static inline bool timer_wheel_entry_pending(const struct timer_wheel_entry *entry)
+{
+    return NULL != entry->prev;
+}
+
+static inline uint64_t timer_wheel_msec_to_ticks(const double msec)
+{
+    if (msec <= 0) { return 0; }
+    const uint64_t ticks = (uint64_t)msec / TIMER_WHEEL_TICK_MSEC;
+    return (msec > (double)(ticks * TIMER_WHEEL_TICK_MSEC)) ? ticks + 1 : ticks;
+}
+
+static inline void timer_wheel_list_push(struct timer_wheel_entry **head, struct timer_wheel_entry *entry)
+{
+    entry->next = *head;
+    entry->prev = head;
+    if (NULL != entry->next) { entry->next->prev = &entry->next; }
+    *head = entry;
+}
+
+static inline void timer_wheel_list_unlink(struct timer_wheel_entry *entry)
+{
+    *entry->prev = entry->next;
+    if (NULL != entry->next) { entry->next->prev = entry->prev; }
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static void timer_wheel_link(struct timer_wheel *wheel, struct timer_wheel_entry *entry)
+{
+    // NOTE(marius): the current tick was already handled, so an expired timer fires on the next one
+    uint64_t expires = entry->expires > wheel->now ? entry->expires : wheel->now + 1;
+    if (expires - wheel->now >= TIMER_WHEEL_SPAN) {
+        expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+    }
+    const uint64_t delta = expires - wheel->now;
+
+    unsigned level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    const unsigned slot = (unsigned)(expires >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+    timer_wheel_list_push(&wheel->slots[level][slot], entry);
+}
+
+static void timer_wheel_cancel(struct timer_wheel *wheel, struct timer_wheel_entry *entry)
+{
+    if (!timer_wheel_entry_pending(entry)) { return; }
+    timer_wheel_list_unlink(entry);
+    wheel->count--;
+}
+
+static void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_entry *entry, const uint64_t delay)
+{
+    timer_wheel_cancel(wheel, entry);
+    entry->expires = wheel->now + delay;
+    timer_wheel_link(wheel, entry);
+    wheel->count++;
+}
+
+/*
+ * The slot is detached from the wheel before its entries are handled, so the callbacks can add or
+ * cancel any timer, including the one that fired.
+ */
+static inline void timer_wheel_detach(struct timer_wheel_entry **slot, struct timer_wheel_entry **head)
+{
+    *head = *slot;
+    *slot = NULL;
+    if (NULL != *head) { (*head)->prev = head; }
+}
+
+static void timer_wheel_cascade(struct timer_wheel *wheel, const unsigned level)
+{
+    const unsigned slot = (unsigned)(wheel->now >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+
+    struct timer_wheel_entry *head = NULL;
+    timer_wheel_detach(&wheel->slots[level][slot], &head);
+    while (NULL != head) {
+        struct timer_wheel_entry *entry = head;
+        timer_wheel_list_unlink(entry);
+        // NOTE(marius): the timers expiring on this tick go in the level 0 slot that's handled right after the cascade
+        if (entry->expires <= wheel->now) {
+            timer_wheel_list_push(&wheel->slots[0][wheel->now & TIMER_WHEEL_SLOT_MASK], entry);
+            continue;
+        }
+        timer_wheel_link(wheel, entry);
+    }
+}
+
+/*
+ * Moves the wheel forward to the tick in `now`, and calls the callbacks of the timers that expired.
+ * Returns the number of timers that fired.
+ */
+static size_t timer_wheel_advance(struct timer_wheel *wheel, const uint64_t now)
+{
+    size_t fired = 0;
+    while (wheel->now < now) {
+        // NOTE(marius): when nothing is pending we can skip ahead
+        if (wheel->count == 0) {
+            wheel->now = now;
+            break;
+        }
+        wheel->now++;
+        for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((wheel->now & ((1ULL << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) == 0) {
+                timer_wheel_cascade(wheel, level);
+            }
+        }
+
+        struct timer_wheel_entry *head = NULL;
+        timer_wheel_detach(&wheel->slots[0][wheel->now & TIMER_WHEEL_SLOT_MASK], &head);
+        while (NULL != head) {
+            struct timer_wheel_entry *entry = head;
+            timer_wheel_list_unlink(entry);
+            wheel->count--;
+            fired++;
+            if (NULL != entry->callback) {
+                entry->callback(entry, entry->data);
+            }
+        }
+    }
+    return fired;
+}
+
+/*
+ * Returns the next tick at which the wheel needs to be advanced, this is either when a timer expires, or
+ * when a higher level slot needs to be cascaded, whichever comes first.
+ */
+static bool timer_wheel_next_expiry(const struct timer_wheel *wheel, uint64_t *next)
+{
+    if (wheel->count == 0) { return false; }
+
+    bool found = false;
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        const unsigned shift = TIMER_WHEEL_SLOT_BITS * level;
+        const uint64_t current = wheel->now >> shift;
+        for (uint64_t k = 1; k <= TIMER_WHEEL_SLOTS; k++) {
+            if (NULL == wheel->slots[level][(current + k) & TIMER_WHEEL_SLOT_MASK]) { continue; }
+
+            const uint64_t tick = (current + k) << shift;
+            if (!found || tick < *next) {
+                *next = tick;
+                found = true;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+#endif // MPRIS_SCROBBLER_TIMER_WHEEL_H
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 enum log_levels _log_level;
@@ -165,6 +166,40 @@ static void array_log_with_label(char *output, char arr[MAX_PROPERTY_COUNT][MAX_
     }
 }
 
+// NOTE(marius): unlike the wall clock this doesn't jump when the system time is changed
+static double monotonic_milliseconds(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+// NOTE(marius): this keeps counting while the system is suspended, where available
+static double boottime_milliseconds(void)
+{
+    struct timespec now = {0};
+#ifdef CLOCK_BOOTTIME
+    clock_gettime(CLOCK_BOOTTIME, &now);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+static const char *get_request_class_label(const enum request_class priority)
+{
+    switch (priority) {
+        case request_auth:
+            return "auth";
+        case request_scrobble:
+            return "scrobble";
+        case request_now_playing:
+            return "now_playing";
+        default:
+            return "unknown";
+    }
+}
+
 static const char *get_api_type_label(const enum api_type end_point)
 {
     switch (end_point) {
@@ -180,8 +215,7 @@ static const char *get_api_type_label(const enum api_type end_point)
     }
 }
 
-void resend_now_playing (struct state *);
-bool load_configuration(struct configuration*, const char*);
+void reload_configuration(struct state *, const unsigned);
 static void sighandler(const evutil_socket_t signum, short events, void *user_data)
 {
     if (events) { events = 0; }
@@ -205,8 +239,7 @@ static void sighandler(const evutil_socket_t signum, short events, void *user_da
     _info("main::signal_received: %s", signal_name);
 
     if (signum == SIGHUP) {
-        load_configuration(s->config, APPLICATION_NAME);
-        resend_now_playing(s);
+        reload_configuration(s, reload_config | reload_credentials);
     }
     if (signum == SIGINT || signum == SIGTERM) {
         event_base_loopexit(eb, NULL);
@@ -222,6 +255,52 @@ static void free_arguments(struct parsed_arguments *args)
 #define VERBOSE_TRACE  "vv"
 #define VERBOSE_DEBUG  "v"
 
+// NOTE(marius): a service can be followed by the name of one of its accounts: lastfm:name
+static void parse_service_account(struct parsed_arguments *args, const char *arg)
+{
+    const char *account = strchr(arg, ':');
+    if (NULL == account) { return; }
+
+    strncpy(args->account, account + 1, USER_NAME_MAX);
+}
+
+static bool parse_dead_letter_argument(struct parsed_arguments *args, const char *arg)
+{
+    // NOTE(marius): the sub-commands are matched exactly, as "list" is a prefix of "listenbrainz"
+    if (args->dead_letter_command == dead_letter_command_none) {
+        if (strcmp(arg, ARG_DEAD_LETTER_LIST) == 0) {
+            args->dead_letter_command = dead_letter_command_list;
+            return true;
+        }
+        if (strcmp(arg, ARG_DEAD_LETTER_FIX) == 0) {
+            args->dead_letter_command = dead_letter_command_fix;
+            return true;
+        }
+        if (strcmp(arg, ARG_DEAD_LETTER_REMOVE) == 0) {
+            args->dead_letter_command = dead_letter_command_remove;
+            return true;
+        }
+        if (strcmp(arg, ARG_DEAD_LETTER_RESUBMIT) == 0) {
+            args->dead_letter_command = dead_letter_command_resubmit;
+            return true;
+        }
+    }
+    if (NULL != strchr(arg, '=')) {
+        if (args->dead_letter_field_count >= MAX_DEAD_LETTER_FIELDS) {
+            _warn("main::argument_error: too many fields, ignoring %s", arg);
+            return true;
+        }
+        strncpy(args->dead_letter_fields[args->dead_letter_field_count], arg, MAX_PROPERTY_LENGTH);
+        args->dead_letter_field_count++;
+        return true;
+    }
+    if (strspn(arg, "0123456789") == strlen(arg)) {
+        args->dead_letter_id = (size_t)strtoull(arg, NULL, 10);
+        return true;
+    }
+    return false;
+}
+
 static void parse_command_line(struct parsed_arguments *args, enum binary_type which_bin, int argc, char *argv[])
 {
     args->get_token = false;
@@ -231,6 +310,11 @@ static void parse_command_line(struct parsed_arguments *args, enum binary_type w
     args->disable = false;
     args->enable = false;
     args->reload = false;
+    args->dead_letter = false;
+    args->dead_letter_command = dead_letter_command_none;
+    args->dead_letter_id = 0;
+    args->dead_letter_field_count = 0;
+    args->import = false;
     args->service = api_unknown;
     args->log_level = log_warning | log_error;
 
@@ -252,17 +336,34 @@ static void parse_command_line(struct parsed_arguments *args, enum binary_type w
         switch (char_arg) {
             case 1:
                 if (which_bin == daemon_bin) { break; }
+                if (args->dead_letter && parse_dead_letter_argument(args, optarg)) { break; }
+                if (args->import && strlen(args->import_path) == 0) {
+                    // NOTE(marius): the file name could start with a service or command name, so we don't match it
+                    memcpy(args->import_path, optarg, min(FILE_PATH_MAX, strlen(optarg)));
+                    break;
+                }
+                if (strncmp(optarg, ARG_COMMAND_IMPORT, strlen(ARG_COMMAND_IMPORT)) == 0) {
+                    args->import = true;
+                    break;
+                }
+                if (strncmp(optarg, ARG_COMMAND_DEAD_LETTER, strlen(ARG_COMMAND_DEAD_LETTER)) == 0) {
+                    args->dead_letter = true;
+                    break;
+                }
                 if (strncmp(optarg, ARG_COMMAND_RELOAD, strlen(ARG_COMMAND_RELOAD)) == 0) {
                     args->reload = true;
                 }
                 if (strncmp(optarg, ARG_LASTFM, strlen(ARG_LASTFM)) == 0) {
                     args->service = api_lastfm;
+                    parse_service_account(args, optarg);
                 }
                 if (strncmp(optarg, ARG_LIBREFM, strlen(ARG_LIBREFM)) == 0) {
                     args->service = api_librefm;
+                    parse_service_account(args, optarg);
                 }
                 if (strncmp(optarg, ARG_LISTENBRAINZ, strlen(ARG_LISTENBRAINZ)) == 0) {
                     args->service = api_listenbrainz;
+                    parse_service_account(args, optarg);
                 }
                 if (strncmp(optarg, ARG_COMMAND_TOKEN, strlen(ARG_COMMAND_TOKEN)) == 0) {
                     args->get_token = true;
@@ -0,0 +1,105 @@
+#include <snow/snow.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+
+#define BENCHMARK_ITERATIONS    20000
+#define BENCHMARK_TRACKS        32
+#define BENCHMARK_BODY_SIZE     16384
+
+static const char *fields[] = {
+    "The Dark Side of the Moon (50th Anniversary Remaster)",
+    "Pink Floyd",
+    "Us and Them",
+    "a0ba2b7c-9f4b-4d56-b2a4-3e6f7a7d0d4f",
+};
+#define BENCHMARK_FIELDS (sizeof(fields)/sizeof(fields[0]))
+
+// NOTE(marius): it does what curl_easy_escape does, one heap allocation for every escaped value
+static char *heap_url_escape(const char *str, const size_t len, unsigned *allocations)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    char *result = malloc(3 * len + 1);
+    (*allocations)++;
+
+    size_t pos = 0;
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char c = (unsigned char)str[i];
+        if (escape_url_is_clean(c)) {
+            result[pos++] = (char)c;
+            continue;
+        }
+        result[pos++] = '%';
+        result[pos++] = hex[c >> 4];
+        result[pos++] = hex[c & 0x0f];
+    }
+    result[pos] = '\0';
+    return result;
+}
+
+static size_t build_body_heap(char *body, unsigned *allocations)
+{
+    size_t len = 0;
+    for (int t = 0; t < BENCHMARK_TRACKS; t++) {
+        for (size_t f = 0; f < BENCHMARK_FIELDS; f++) {
+            char *escaped = heap_url_escape(fields[f], strlen(fields[f]), allocations);
+            len += (size_t)snprintf(body + len, BENCHMARK_BODY_SIZE - len, "f%zu[%d]=%s&", f, t, escaped);
+            free(escaped);
+        }
+    }
+    return len;
+}
+
+static size_t build_body_arena(char *body, struct arena *arena)
+{
+    size_t len = 0;
+    for (int t = 0; t < BENCHMARK_TRACKS; t++) {
+        for (size_t f = 0; f < BENCHMARK_FIELDS; f++) {
+            const char *escaped = arena_url_escape(arena, fields[f], strlen(fields[f]));
+            len += (size_t)snprintf(body + len, BENCHMARK_BODY_SIZE - len, "f%zu[%d]=%s&", f, t, escaped);
+        }
+    }
+    return len;
+}
+
+static double elapsed_ms(const clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+describe(arena_benchmark) {
+    static char body[BENCHMARK_BODY_SIZE] = {0};
+
+    it ("escapes the fields of a scrobble batch on the heap and in an arena") {
+        unsigned heap_allocations = 0;
+        size_t heap_len = 0;
+        clock_t start = clock();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            heap_len = build_body_heap(body, &heap_allocations);
+        }
+        const double heap = elapsed_ms(start);
+
+        unsigned arena_blocks = 0;
+        size_t arena_len = 0;
+        start = clock();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            // NOTE(marius): every request gets its own arena, like the connections do
+            struct arena arena;
+            arena_init(&arena);
+            arena_len = build_body_arena(body, &arena);
+            arena_blocks += arena.blocks;
+            arena_free(&arena);
+        }
+        const double in_arena = elapsed_ms(start);
+
+        fprintf(stdout, "heap: %.2lfms, %.1lf allocations/request; arena: %.2lfms, %.1lf allocations/request for %d requests of %d tracks\n",
+                heap, (double)heap_allocations / BENCHMARK_ITERATIONS, in_arena, (double)arena_blocks / BENCHMARK_ITERATIONS,
+                BENCHMARK_ITERATIONS, BENCHMARK_TRACKS);
+        asserteq(heap_len, arena_len);
+        asserteq(heap_allocations, BENCHMARK_ITERATIONS * BENCHMARK_TRACKS * BENCHMARK_FIELDS);
+    };
+};
+
+snow_main();
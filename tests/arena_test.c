@@ -0,0 +1,70 @@
+#include <snow/snow.h>
+
+#include "arena.h"
+
+describe(arena) {
+    it ("hands out aligned memory from the same block") {
+        struct arena arena;
+        arena_init(&arena);
+
+        char *first = arena_alloc(&arena, 3);
+        char *second = arena_alloc(&arena, 5);
+        asserteq((uintptr_t)first % ARENA_ALIGNMENT, 0);
+        asserteq((uintptr_t)second % ARENA_ALIGNMENT, 0);
+        asserteq(second - first, ARENA_ALIGNMENT);
+        asserteq(arena.allocations, 2);
+        asserteq(arena.allocated, 8);
+        asserteq(arena.blocks, 1);
+
+        arena_free(&arena);
+        asserteq(arena.head, NULL);
+    };
+
+    it ("adds blocks when the current one is full") {
+        struct arena arena;
+        arena_init(&arena);
+
+        for (int i = 0; i < 3; i++) {
+            assertneq(arena_alloc(&arena, ARENA_BLOCK_SIZE / 2), NULL);
+        }
+        asserteq(arena.blocks, 2);
+
+        char *large = arena_alloc(&arena, 3 * ARENA_BLOCK_SIZE);
+        assertneq(large, NULL);
+        memset(large, 'a', 3 * ARENA_BLOCK_SIZE);
+        asserteq(arena.blocks, 3);
+
+        arena_reset(&arena);
+        asserteq(arena.allocations, 0);
+        asserteq(arena.allocated, 0);
+        assertneq(arena.head, NULL);
+        asserteq(arena.head->next, NULL);
+        asserteq(arena.head->used, 0);
+
+        // NOTE(marius): the block kept on reset is reused
+        arena_alloc(&arena, 16);
+        asserteq(arena.blocks, 3);
+
+        arena_free(&arena);
+    };
+
+    it ("url escapes like curl_easy_escape") {
+        struct arena arena;
+        arena_init(&arena);
+
+        const char *plain = "Abc-09._~";
+        asserteq_str(arena_url_escape(&arena, plain, strlen(plain)), "Abc-09._~");
+
+        const char *reserved = "a b&c=d/e?f+g%";
+        asserteq_str(arena_url_escape(&arena, reserved, strlen(reserved)), "a%20b%26c%3Dd%2Fe%3Ff%2Bg%25");
+
+        const char *utf8 = "Bj\xc3\xb6rk";
+        asserteq_str(arena_url_escape(&arena, utf8, strlen(utf8)), "Bj%C3%B6rk");
+
+        asserteq_str(arena_url_escape(&arena, "", 0), "");
+
+        arena_free(&arena);
+    };
+};
+
+snow_main();
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+#include <snow/snow.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+
+#define MAX_PROPERTY_LENGTH     384
+#define MAX_PROPERTY_COUNT      8
+#define MAX_BODY_SIZE           16384
+#define FILE_PATH_MAX           4096
+#define USER_NAME_MAX           32
+#define VALUE_SEPARATOR         ", "
+#define MAX_FULL_ARTIST_LENGTH  (MAX_PROPERTY_COUNT * (MAX_PROPERTY_LENGTH + 1))
+
+#define min(a, b) (((a) <= (b)) ? a : b)
+#define _error(...)
+#define _warn(...)
+#define _info(...)
+
+// NOTE(marius): the fields of the structs in structs.h that the dead letter store uses
+enum api_type {
+    api_unknown = 0,
+    api_lastfm,
+    api_librefm,
+    api_listenbrainz,
+};
+
+enum dead_letter_reason {
+    dead_letter_invalid = 1,
+    dead_letter_ignored,
+    dead_letter_rejected,
+    dead_letter_evicted,
+};
+
+struct scrobble {
+    double play_time;
+    double length;
+    time_t start_time;
+    unsigned short track_number;
+    char url[MAX_PROPERTY_LENGTH+1];
+    char title[MAX_PROPERTY_LENGTH+1];
+    char album[MAX_PROPERTY_LENGTH+1];
+    char artist[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_track_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_album_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char player_name[MAX_PROPERTY_LENGTH+1];
+    char mb_spotify_id[MAX_PROPERTY_LENGTH+1];
+};
+
+struct dead_letter {
+    size_t id;
+    char state;
+    enum api_type end_point;
+    enum dead_letter_reason reason;
+    int code;
+    time_t rejected_at;
+    char account[USER_NAME_MAX + 1];
+    struct scrobble scrobble;
+};
+
+#include "deadletter.h"
+
+static size_t scrobble_join_artists(char *dest, const struct scrobble *s)
+{
+    dest[0] = '\0';
+    for (size_t i = 0; i < MAX_PROPERTY_COUNT; i++) {
+        if (s->artist[i][0] == '\0') { continue; }
+        if (dest[0] != '\0') { strcat(dest, VALUE_SEPARATOR); }
+        strcat(dest, s->artist[i]);
+    }
+    return strlen(dest);
+}
+
+bool configuration_folder_exists(const char *path)
+{
+    return access(path, F_OK) == 0;
+}
+
+bool configuration_folder_create(const char *path)
+{
+    (void)path;
+    return false;
+}
+
+static void load_letter(struct dead_letter *letter)
+{
+    memset(letter, 0x0, sizeof(*letter));
+    letter->state = DEAD_LETTER_STATE_PENDING;
+    letter->end_point = api_listenbrainz;
+    letter->reason = dead_letter_rejected;
+    letter->code = 400;
+    letter->rejected_at = 1700000100;
+    strcpy(letter->account, "user\twith\ttabs");
+
+    struct scrobble *track = &letter->scrobble;
+    track->start_time = 1700000000;
+    track->length = 215.5;
+    track->track_number = 7;
+    strcpy(track->artist[0], "Tab\tArtist");
+    strcpy(track->artist[1], "Back\\slash");
+    strcpy(track->title, "Line\nbreak\r\nand \\n literal");
+    strcpy(track->album, "Trailing backslash\\");
+    strcpy(track->mb_track_id[0], "0c1a7a5e-6d14-4b9b-a0e0-7a1c3b6f6a11");
+    strcpy(track->mb_spotify_id, "4uLU6hMCjMI75M1A2tKUQC");
+    strcpy(track->url, "https://example.com/?a=1\tb=2");
+    strcpy(track->player_name, "player\\\t");
+}
+
+static void assert_letters_equal(const struct dead_letter *a, const struct dead_letter *b)
+{
+    asserteq(a->state, b->state);
+    asserteq(a->end_point, b->end_point);
+    asserteq(a->reason, b->reason);
+    asserteq(a->code, b->code);
+    asserteq(a->rejected_at, b->rejected_at);
+    asserteq_str(a->account, b->account);
+
+    const struct scrobble *s = &a->scrobble, *p = &b->scrobble;
+    asserteq(s->start_time, p->start_time);
+    asserteq(s->length, p->length);
+    asserteq(s->track_number, p->track_number);
+    // NOTE(marius): the artists are stored joined, so they come back as a single value
+    char full_artist[MAX_FULL_ARTIST_LENGTH];
+    scrobble_join_artists(full_artist, s);
+    asserteq_str(p->artist[0], full_artist);
+    asserteq_str(s->title, p->title);
+    asserteq_str(s->album, p->album);
+    asserteq_str(s->mb_track_id[0], p->mb_track_id[0]);
+    asserteq_str(s->mb_spotify_id, p->mb_spotify_id);
+    asserteq_str(s->url, p->url);
+    asserteq_str(s->player_name, p->player_name);
+}
+
+static struct dead_letter letter, parsed;
+static char line[DEAD_LETTER_MAX_LINE];
+
+describe(dead_letter) {
+    it ("escapes the separators in the fields") {
+        load_letter(&letter);
+        FILE *file = tmpfile();
+        assertneq(file, NULL);
+        asserteq(dead_letter_write(file, &letter), true);
+        rewind(file);
+
+        assertneq(fgets(line, sizeof(line), file), NULL);
+        asserteq(fgetc(file), EOF);
+        fclose(file);
+
+        size_t tabs = 0;
+        for (const char *c = line; *c != '\0'; c++) {
+            if (*c == '\t') { tabs++; }
+        }
+        asserteq(tabs, DEAD_LETTER_FIELD_COUNT - 1);
+        asserteq(strchr(line, '\n'), line + strlen(line) - 1);
+        asserteq(strchr(line, '\r'), NULL);
+    };
+
+    it ("reads back the fields it wrote") {
+        load_letter(&letter);
+        FILE *file = tmpfile();
+        asserteq(dead_letter_write(file, &letter), true);
+        rewind(file);
+        assertneq(fgets(line, sizeof(line), file), NULL);
+        fclose(file);
+
+        asserteq(dead_letter_parse(line, &parsed), true);
+        assert_letters_equal(&letter, &parsed);
+        asserteq(parsed.scrobble.play_time, parsed.scrobble.length);
+    };
+
+    it ("reads the records without the account column") {
+        strcpy(line, "P\t3\t2\t0\t1700000100\t1700000000\t60.000\t1\tArtist\tTitle\tAlbum\t\t\t\t\t\tplayer\n");
+        asserteq(dead_letter_parse(line, &parsed), true);
+        asserteq_str(parsed.scrobble.title, "Title");
+        asserteq_str(parsed.scrobble.player_name, "player");
+        asserteq_str(parsed.account, "");
+
+        strcpy(line, "P\t3\t2\t0\t1700000100\n");
+        asserteq(dead_letter_parse(line, &parsed), false);
+    };
+
+    it ("appends and reads the records by id") {
+        char folder[] = "/tmp/mpris-scrobbler-test-XXXXXX";
+        assertneq(mkdtemp(folder), NULL);
+        char path[FILE_PATH_MAX+1] = {0};
+        snprintf(path, sizeof(path), "%s/dead_letters", folder);
+        char index_path[FILE_PATH_MAX+1] = {0};
+        dead_letter_index_path(index_path, path);
+
+        load_letter(&letter);
+        const size_t first = dead_letter_append(path, &letter);
+        strcpy(letter.scrobble.title, "Second\ttitle");
+        const size_t second = dead_letter_append(path, &letter);
+        assertneq(first, 0);
+        asserteq(second, first + 1);
+        asserteq(dead_letter_count(path), 2);
+
+        asserteq(dead_letter_read(path, second, &parsed), true);
+        assert_letters_equal(&letter, &parsed);
+
+        asserteq(dead_letter_set_state(path, first, DEAD_LETTER_STATE_REMOVED), true);
+        asserteq(dead_letter_read(path, first, &parsed), true);
+        asserteq(parsed.state, DEAD_LETTER_STATE_REMOVED);
+        asserteq_str(parsed.scrobble.title, "Line\nbreak\r\nand \\n literal");
+
+        unlink(index_path);
+        unlink(path);
+        rmdir(folder);
+    };
+};
+
+snow_main();
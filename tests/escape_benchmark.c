@@ -0,0 +1,91 @@
+#include <snow/snow.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "escape.h"
+
+#define BENCHMARK_ITERATIONS    200000
+
+static const char *values[] = {
+    "The Dark Side of the Moon (50th Anniversary Remaster)",
+    "Pink Floyd",
+    "Brain Damage / Eclipse",
+    "Sigur R\xc3\xb3s",
+    "a0ba2b7c-9f4b-4d56-b2a4-3e6f7a7d0d4f",
+    "Symphony No. 9 in D minor, Op. 125 \"Choral\": IV. Presto - Allegro assai - Allegro assai vivace (alla Marcia)",
+};
+#define BENCHMARK_VALUES (sizeof(values)/sizeof(values[0]))
+
+static double elapsed_ms(const clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static size_t run_url(const escape_scan_fn scan)
+{
+    escape_url_scan = scan;
+    char result[ESCAPE_URL_MAX_LENGTH(256)];
+    size_t total = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t v = 0; v < BENCHMARK_VALUES; v++) {
+            total += escape_url(result, values[v], strlen(values[v]));
+        }
+    }
+    return total;
+}
+
+static size_t run_json(const escape_scan_fn scan)
+{
+    escape_json_scan = scan;
+    char result[ESCAPE_JSON_MAX_LENGTH(256)];
+    size_t total = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t v = 0; v < BENCHMARK_VALUES; v++) {
+            total += escape_json(result, values[v], strlen(values[v]));
+        }
+    }
+    return total;
+}
+
+describe(escape_benchmark) {
+    it ("escapes track metadata with each kernel") {
+        const char *selected = escape_select();
+        const escape_scan_fn url_kernels[] = {
+            escape_url_clean_run_scalar,
+#ifdef ESCAPE_X86
+            escape_url_clean_run_sse2,
+            escape_url_scan,
+#endif
+        };
+        const escape_scan_fn json_kernels[] = {
+            escape_json_clean_run_scalar,
+#ifdef ESCAPE_X86
+            escape_json_clean_run_sse2,
+            escape_json_scan,
+#endif
+        };
+        const char *labels[] = { "scalar", "sse2", selected };
+
+        size_t url_total = 0, json_total = 0;
+        for (size_t k = 0; k < sizeof(url_kernels)/sizeof(url_kernels[0]); k++) {
+            clock_t start = clock();
+            const size_t url = run_url(url_kernels[k]);
+            const double url_ms = elapsed_ms(start);
+
+            start = clock();
+            const size_t json = run_json(json_kernels[k]);
+            const double json_ms = elapsed_ms(start);
+
+            fprintf(stdout, "%s: url %.2lfms, json %.2lfms for %d iterations of %zu values\n",
+                    labels[k], url_ms, json_ms, BENCHMARK_ITERATIONS, BENCHMARK_VALUES);
+            if (k > 0) {
+                asserteq(url, url_total);
+                asserteq(json, json_total);
+            }
+            url_total = url;
+            json_total = json;
+        }
+    };
+};
+
+snow_main();
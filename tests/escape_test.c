@@ -0,0 +1,66 @@
+#include <snow/snow.h>
+
+#include "escape.h"
+
+#define ESCAPE_TEST_LENGTH 100
+
+static void check_clean_runs(escape_scan_fn url, escape_scan_fn json)
+{
+    char str[ESCAPE_TEST_LENGTH] = {0};
+    for (int c = 0; c < 256; c++) {
+        // NOTE(marius): the character is moved through the whole string, so it's found in the vector loops and in the tails
+        for (size_t pos = 0; pos < ESCAPE_TEST_LENGTH; pos++) {
+            memset(str, 'a', sizeof(str));
+            str[pos] = (char)c;
+            const size_t url_expected = escape_url_is_clean((unsigned char)c) ? ESCAPE_TEST_LENGTH : pos;
+            const size_t json_expected = escape_json_is_clean((unsigned char)c) ? ESCAPE_TEST_LENGTH : pos;
+            asserteq(url(str, ESCAPE_TEST_LENGTH), url_expected);
+            asserteq(json(str, ESCAPE_TEST_LENGTH), json_expected);
+            // the bytes after the length don't count
+            asserteq(url(str, pos), pos);
+            asserteq(json(str, pos), pos);
+        }
+    }
+}
+
+describe(escape) {
+    it ("finds the characters to escape with the scalar kernels") {
+        check_clean_runs(escape_url_clean_run_scalar, escape_json_clean_run_scalar);
+    };
+
+#ifdef ESCAPE_X86
+    it ("finds the same characters with the SSE2 kernels") {
+        check_clean_runs(escape_url_clean_run_sse2, escape_json_clean_run_sse2);
+    };
+
+    it ("finds the same characters with the AVX2 kernels") {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) { return; }
+        check_clean_runs(escape_url_clean_run_avx2, escape_json_clean_run_avx2);
+    };
+#endif
+
+    it ("percent encodes like curl_easy_escape") {
+        char result[ESCAPE_URL_MAX_LENGTH(64)] = {0};
+        const char *plain = "Abc-09._~";
+        asserteq(escape_url(result, plain, strlen(plain)), strlen(plain));
+        asserteq_str(result, plain);
+
+        const char *reserved = "a b&c=d/e?f+g%";
+        escape_url(result, reserved, strlen(reserved));
+        asserteq_str(result, "a%20b%26c%3Dd%2Fe%3Ff%2Bg%25");
+
+        const char *utf8 = "Sigur R\xc3\xb3s - \xc3\x81g\xc3\xa6tis byrjun";
+        escape_url(result, utf8, strlen(utf8));
+        asserteq_str(result, "Sigur%20R%C3%B3s%20-%20%C3%81g%C3%A6tis%20byrjun");
+    };
+
+    it ("escapes JSON strings like json-c") {
+        char result[ESCAPE_JSON_MAX_LENGTH(64)] = {0};
+        const char *str = "with \"quotes\" and \\ back/slash, ctl\x01\x1f\t\n\r\b\f end, Bj\xc3\xb6rk";
+        escape_json(result, str, strlen(str));
+        asserteq_str(result, "with \\\"quotes\\\" and \\\\ back\\/slash, ctl\\u0001\\u001f\\t\\n\\r\\b\\f end, Bj\xc3\xb6rk");
+    };
+};
+
+snow_main();
@@ -0,0 +1,163 @@
+#include <snow/snow.h>
+#include <stdlib.h>
+
+#include "fingerprint.h"
+
+// NOTE(marius): a plain array kept in the least to most recently used order, to check the cache against
+struct reference_lru {
+    uint64_t entries[FINGERPRINT_CACHE_SIZE];
+    size_t count;
+};
+
+static void reference_add(struct reference_lru *lru, const uint64_t fingerprint)
+{
+    for (size_t i = 0; i < lru->count; i++) {
+        if (lru->entries[i] != fingerprint) { continue; }
+        memmove(&lru->entries[i], &lru->entries[i+1], (lru->count - i - 1) * sizeof(uint64_t));
+        lru->entries[lru->count - 1] = fingerprint;
+        return;
+    }
+    if (lru->count == FINGERPRINT_CACHE_SIZE) {
+        memmove(&lru->entries[0], &lru->entries[1], (lru->count - 1) * sizeof(uint64_t));
+        lru->count--;
+    }
+    lru->entries[lru->count++] = fingerprint;
+}
+
+static bool reference_has(const struct reference_lru *lru, const uint64_t fingerprint)
+{
+    for (size_t i = 0; i < lru->count; i++) {
+        if (lru->entries[i] == fingerprint) { return true; }
+    }
+    return false;
+}
+
+static struct fingerprint_cache cache, loaded;
+static struct reference_lru reference;
+
+describe(fingerprint) {
+    it ("normalises the values") {
+        const uint64_t a = fingerprint_add_value(HASH_SEED, "  The   Beatles ");
+        const uint64_t b = fingerprint_add_value(HASH_SEED, "the beatles");
+        const uint64_t c = fingerprint_add_value(HASH_SEED, "the beatle s");
+        asserteq(a, b);
+        assertneq(a, c);
+    };
+
+    it ("finds the listens that started close to each other") {
+        fingerprint_cache_init(&cache);
+        const uint64_t track = fingerprint_add_value(HASH_SEED, "Us and Them");
+        const time_t start = 1700000000;
+        const double length = 462;
+
+        fingerprint_cache_mark(&cache, track, start, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER);
+        asserteq(fingerprint_cache_seen(&cache, track, start + 5, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), true);
+        asserteq(fingerprint_cache_seen(&cache, track, start - 5, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), true);
+        asserteq(fingerprint_cache_seen(&cache, track, start, length, fingerprint_now_playing, FINGERPRINT_ANY_OWNER), false);
+        asserteq(fingerprint_cache_seen(&cache, track, start + FINGERPRINT_MATCH_WINDOW + 1, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), false);
+
+        const uint64_t other = fingerprint_add_value(HASH_SEED, "Brain Damage");
+        asserteq(fingerprint_cache_seen(&cache, other, start, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), false);
+
+        fingerprint_cache_mark(&cache, track, start, length, fingerprint_now_playing, FINGERPRINT_ANY_OWNER);
+        asserteq(cache.count, 1);
+        asserteq(fingerprint_cache_seen(&cache, track, start, length, fingerprint_now_playing, FINGERPRINT_ANY_OWNER), true);
+    };
+
+    it ("doesn't match a short track played again") {
+        fingerprint_cache_init(&cache);
+        const uint64_t track = fingerprint_add_value(HASH_SEED, "Her Majesty");
+        const time_t start = 1700000000;
+        const double length = 23;
+
+        fingerprint_cache_mark(&cache, track, start, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER);
+        asserteq(fingerprint_cache_seen(&cache, track, start + 3, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), true);
+        asserteq(fingerprint_cache_seen(&cache, track, start + 23, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), false);
+
+        // NOTE(marius): the second listen replaces the first one
+        fingerprint_cache_mark(&cache, track, start + 23, length, fingerprint_now_playing, FINGERPRINT_ANY_OWNER);
+        asserteq(fingerprint_cache_seen(&cache, track, start + 23, length, fingerprint_scrobbled, FINGERPRINT_ANY_OWNER), false);
+        asserteq(fingerprint_cache_seen(&cache, track, start + 23, length, fingerprint_now_playing, FINGERPRINT_ANY_OWNER), true);
+    };
+
+    it ("matches only the announcements of the other players") {
+        fingerprint_cache_init(&cache);
+        const uint64_t track = fingerprint_add_value(HASH_SEED, "Time");
+        const time_t start = 1700000000;
+        const double length = 413;
+        const uint64_t browser = fingerprint_owner("org.mpris.MediaPlayer2.firefox.instance42");
+        const uint64_t bridge = fingerprint_owner("org.mpris.MediaPlayer2.plasma-browser-integration");
+
+        fingerprint_cache_mark(&cache, track, start, length, fingerprint_now_playing, browser);
+        asserteq(fingerprint_cache_seen(&cache, track, start, length, fingerprint_now_playing, browser), false);
+        asserteq(fingerprint_cache_seen(&cache, track, start + 2, length, fingerprint_now_playing, bridge), true);
+
+        fingerprint_cache_mark(&cache, track, start + 2, length, fingerprint_now_playing, bridge);
+        asserteq(fingerprint_cache_seen(&cache, track, start, length, fingerprint_now_playing, browser), false);
+    };
+
+    it ("evicts the least recently used fingerprints") {
+        fingerprint_cache_init(&cache);
+        memset(&reference, 0x0, sizeof(reference));
+
+        srand(42);
+        for (int i = 0; i < 20000; i++) {
+            // NOTE(marius): a small range of values, so some of them are added again and move to the front
+            const uint64_t fingerprint = (uint64_t)(rand() % 600 + 1) * 0x9e3779b97f4a7c15ULL;
+            struct fingerprint_entry *entry = fingerprint_cache_add(&cache, fingerprint);
+            entry->flags |= fingerprint_scrobbled;
+            entry->start_time = 1700000000 + i;
+            entry->owner = fingerprint >> 3;
+            reference_add(&reference, fingerprint);
+        }
+        asserteq(cache.count, FINGERPRINT_CACHE_SIZE);
+
+        size_t position = reference.count;
+        for (uint16_t idx = cache.head; idx != FINGERPRINT_NONE; idx = cache.entries[idx].next) {
+            asserteq(cache.entries[idx].fingerprint, reference.entries[--position]);
+        }
+        asserteq(position, 0);
+        for (uint64_t v = 1; v <= 600; v++) {
+            const uint64_t fingerprint = v * 0x9e3779b97f4a7c15ULL;
+            asserteq(fingerprint_cache_get(&cache, fingerprint) != NULL, reference_has(&reference, fingerprint));
+        }
+    };
+
+    it ("saves and loads the fingerprints in order") {
+        FILE *file = tmpfile();
+        assertneq(file, NULL);
+        asserteq(fingerprint_cache_write(&cache, file), true);
+        rewind(file);
+
+        fingerprint_cache_init(&loaded);
+        asserteq(fingerprint_cache_read(&loaded, file), true);
+        fclose(file);
+
+        asserteq(loaded.count, cache.count);
+        uint16_t a = cache.head, b = loaded.head;
+        while (a != FINGERPRINT_NONE && b != FINGERPRINT_NONE) {
+            asserteq(cache.entries[a].fingerprint, loaded.entries[b].fingerprint);
+            asserteq(cache.entries[a].flags, loaded.entries[b].flags);
+            asserteq(cache.entries[a].owner, loaded.entries[b].owner);
+            asserteq(cache.entries[a].start_time, loaded.entries[b].start_time);
+            a = cache.entries[a].next;
+            b = loaded.entries[b].next;
+        }
+        asserteq(a, b);
+    };
+
+    it ("ignores the invalid files") {
+        FILE *file = tmpfile();
+        const uint16_t count = FINGERPRINT_CACHE_SIZE + 1;
+        fwrite(&count, sizeof(count), 1, file);
+        rewind(file);
+
+        fingerprint_cache_init(&loaded);
+        fingerprint_cache_add(&loaded, 1)->flags = fingerprint_scrobbled;
+        asserteq(fingerprint_cache_read(&loaded, file), false);
+        asserteq(loaded.count, 1);
+        fclose(file);
+    };
+};
+
+snow_main();
@@ -0,0 +1,141 @@
+#include <snow/snow.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "hash.h"
+
+#define BENCHMARK_ITERATIONS    200000
+#define BENCHMARK_LENGTH        385
+#define BENCHMARK_COUNT         8
+
+// NOTE(marius): the string fields of the mpris metadata, the same sizes as in structs.h
+struct benchmark_metadata {
+    char track_id[BENCHMARK_LENGTH];
+    char album[BENCHMARK_LENGTH];
+    char title[BENCHMARK_LENGTH];
+    char url[BENCHMARK_LENGTH];
+    char art_url[BENCHMARK_LENGTH];
+    char artist[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char album_artist[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char genre[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char comment[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char mb_track_id[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char mb_album_id[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char mb_artist_id[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+    char mb_album_artist_id[BENCHMARK_COUNT][BENCHMARK_LENGTH];
+};
+
+#define BENCHMARK_FIELDS 13
+struct benchmark_hashes {
+    struct hash_field fields[BENCHMARK_FIELDS];
+};
+
+static void field_offsets(const struct benchmark_metadata *m, const char *fields[BENCHMARK_FIELDS], size_t counts[BENCHMARK_FIELDS])
+{
+    const char *f[BENCHMARK_FIELDS] = {
+        m->track_id, m->album, m->title, m->url, m->art_url, (const char*)m->artist, (const char*)m->album_artist,
+        (const char*)m->genre, (const char*)m->comment, (const char*)m->mb_track_id, (const char*)m->mb_album_id,
+        (const char*)m->mb_artist_id, (const char*)m->mb_album_artist_id,
+    };
+    for (size_t i = 0; i < BENCHMARK_FIELDS; i++) {
+        fields[i] = f[i];
+        counts[i] = i < 5 ? 1 : BENCHMARK_COUNT;
+    }
+}
+
+static void load_metadata(struct benchmark_metadata *m, const char *title)
+{
+    memset(m, 0x0, sizeof(*m));
+    strcpy(m->track_id, "/org/mpris/MediaPlayer2/Track/42");
+    strcpy(m->album, "The Dark Side of the Moon (50th Anniversary Remaster)");
+    strcpy(m->title, title);
+    strcpy(m->url, "file:///home/user/Music/Pink%20Floyd/The%20Dark%20Side%20of%20the%20Moon/09.flac");
+    strcpy(m->art_url, "file:///home/user/.cache/art/cover.jpg");
+    strcpy(m->artist[0], "Pink Floyd");
+    strcpy(m->album_artist[0], "Pink Floyd");
+    strcpy(m->genre[0], "Progressive Rock");
+    strcpy(m->mb_track_id[0], "a0ba2b7c-9f4b-4d56-b2a4-3e6f7a7d0d4f");
+    strcpy(m->mb_album_id[0], "f5093c06-23e3-404f-aeaa-40f72885ee3a");
+    strcpy(m->mb_artist_id[0], "83d91898-7763-47d7-b03b-b92132375c47");
+    strcpy(m->mb_album_artist_id[0], "83d91898-7763-47d7-b03b-b92132375c47");
+}
+
+static double elapsed_ms(const clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// NOTE(marius): what _copy_if_changed did for every field, comparing the whole buffers
+static unsigned changes_memcmp(const struct benchmark_metadata *old, const struct benchmark_metadata *new)
+{
+    const char *a[BENCHMARK_FIELDS], *b[BENCHMARK_FIELDS];
+    size_t counts[BENCHMARK_FIELDS];
+    field_offsets(old, a, counts);
+    field_offsets(new, b, counts);
+
+    unsigned changed = 0;
+    for (size_t i = 0; i < BENCHMARK_FIELDS; i++) {
+        if (memcmp(a[i], b[i], counts[i] * BENCHMARK_LENGTH) != 0) { changed++; }
+    }
+    return changed;
+}
+
+// NOTE(marius): the new values are hashed when they are loaded, the old ones already are
+static unsigned changes_hashed(const struct benchmark_metadata *old, const struct benchmark_hashes *old_hashes,
+        const struct benchmark_metadata *new, struct benchmark_hashes *new_hashes)
+{
+    const char *a[BENCHMARK_FIELDS], *b[BENCHMARK_FIELDS];
+    size_t counts[BENCHMARK_FIELDS];
+    field_offsets(old, a, counts);
+    field_offsets(new, b, counts);
+
+    unsigned changed = 0;
+    for (size_t i = 0; i < BENCHMARK_FIELDS; i++) {
+        hash_field_load(&new_hashes->fields[i], b[i], counts[i], BENCHMARK_LENGTH);
+    }
+    for (size_t i = 0; i < BENCHMARK_FIELDS; i++) {
+        if (!hash_field_equals(a[i], &old_hashes->fields[i], b[i], &new_hashes->fields[i], BENCHMARK_LENGTH)) { changed++; }
+    }
+    return changed;
+}
+
+static struct benchmark_metadata old_metadata, new_metadata;
+
+describe(hash_benchmark) {
+    it ("checks the metadata of a signal for changes") {
+        struct benchmark_hashes old_hashes, new_hashes;
+        const char *titles[] = { "Brain Damage", "Eclipse" };
+
+        size_t memcmp_total = 0, hashed_total = 0;
+        double memcmp_ms = 0, hashed_ms = 0;
+        for (int t = 0; t < 2; t++) {
+            load_metadata(&old_metadata, titles[0]);
+            load_metadata(&new_metadata, titles[t]);
+
+            const char *a[BENCHMARK_FIELDS];
+            size_t counts[BENCHMARK_FIELDS];
+            field_offsets(&old_metadata, a, counts);
+            for (size_t i = 0; i < BENCHMARK_FIELDS; i++) {
+                hash_field_load(&old_hashes.fields[i], a[i], counts[i], BENCHMARK_LENGTH);
+            }
+
+            clock_t start = clock();
+            for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+                memcmp_total += changes_memcmp(&old_metadata, &new_metadata);
+            }
+            memcmp_ms += elapsed_ms(start);
+
+            start = clock();
+            for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+                hashed_total += changes_hashed(&old_metadata, &old_hashes, &new_metadata, &new_hashes);
+            }
+            hashed_ms += elapsed_ms(start);
+        }
+
+        fprintf(stdout, "memcmp: %.2lfms, hashed: %.2lfms for %d signals\n", memcmp_ms, hashed_ms, 2 * BENCHMARK_ITERATIONS);
+        asserteq(memcmp_total, BENCHMARK_ITERATIONS);
+        asserteq(hashed_total, memcmp_total);
+    };
+};
+
+snow_main();
@@ -0,0 +1,74 @@
+#include <snow/snow.h>
+
+#include "hash.h"
+
+#define TEST_VALUE_LENGTH   385
+
+static char values_a[HASH_FIELD_MAX_VALUES][TEST_VALUE_LENGTH];
+static char values_b[HASH_FIELD_MAX_VALUES][TEST_VALUE_LENGTH];
+
+static void load_values(char values[HASH_FIELD_MAX_VALUES][TEST_VALUE_LENGTH], const char *first, const char *second)
+{
+    memset(values, 0x0, HASH_FIELD_MAX_VALUES * TEST_VALUE_LENGTH);
+    strncpy(values[0], first, TEST_VALUE_LENGTH - 1);
+    strncpy(values[1], second, TEST_VALUE_LENGTH - 1);
+}
+
+describe(hash) {
+    it ("hashes the strings") {
+        asserteq(hash_string("", 0), 0);
+        asserteq(hash_string("Pink Floyd", 10), hash_string("Pink Floyd", 10));
+        assertneq(hash_string("Pink Floyd", 10), hash_string("Pink Floyd", 4));
+        assertneq(hash_string("a\0", 2), hash_string("a", 1));
+        assertneq(hash_string("Us and Them", 11), hash_string("Us and Then", 11));
+    };
+
+    it ("keeps a zeroed field consistent with its zeroed hash") {
+        struct hash_field loaded, zero = {0};
+        load_values(values_a, "", "");
+        hash_field_load(&loaded, (const char*)values_a, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        asserteq(memcmp(&loaded, &zero, sizeof(zero)), 0);
+    };
+
+    it ("loads the length of each value") {
+        struct hash_field field;
+        load_values(values_a, "Pink Floyd", "Roger Waters");
+        hash_field_load(&field, (const char*)values_a, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        asserteq(field.len[0], 10);
+        asserteq(field.len[1], 12);
+        asserteq(field.len[2], 0);
+        assertneq(field.hash, 0);
+    };
+
+    it ("compares the fields") {
+        struct hash_field fa, fb;
+        load_values(values_a, "Pink Floyd", "Roger Waters");
+        load_values(values_b, "Pink Floyd", "Roger Waters");
+        hash_field_load(&fa, (const char*)values_a, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        hash_field_load(&fb, (const char*)values_b, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        asserteq(hash_field_equals((const char*)values_a, &fa, (const char*)values_b, &fb, TEST_VALUE_LENGTH), true);
+
+        load_values(values_b, "Pink Floyd", "Roger Water");
+        hash_field_load(&fb, (const char*)values_b, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        asserteq(hash_field_equals((const char*)values_a, &fa, (const char*)values_b, &fb, TEST_VALUE_LENGTH), false);
+
+        // NOTE(marius): the same bytes split differently between the values
+        load_values(values_a, "ab", "c");
+        load_values(values_b, "a", "bc");
+        hash_field_load(&fa, (const char*)values_a, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        hash_field_load(&fb, (const char*)values_b, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        asserteq(hash_field_equals((const char*)values_a, &fa, (const char*)values_b, &fb, TEST_VALUE_LENGTH), false);
+    };
+
+    it ("checks the values when the hashes collide") {
+        struct hash_field fa, fb;
+        load_values(values_a, "Pink Floyd", "");
+        load_values(values_b, "Pink Flyod", "");
+        hash_field_load(&fa, (const char*)values_a, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        hash_field_load(&fb, (const char*)values_b, HASH_FIELD_MAX_VALUES, TEST_VALUE_LENGTH);
+        fb.hash = fa.hash;
+        asserteq(hash_field_equals((const char*)values_a, &fa, (const char*)values_b, &fb, TEST_VALUE_LENGTH), false);
+    };
+};
+
+snow_main();
@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include <snow/snow.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PROPERTY_LENGTH     384
+#define MAX_PROPERTY_COUNT      8
+#define FILE_PATH_MAX           4096
+#define TOKENIZED_CACHE_PATH    "%s/%s/%s"
+
+#define API_LISTENED_AT_NODE_NAME               "listened_at"
+#define API_METADATA_NODE_NAME                  "track_metadata"
+#define API_ARTIST_NAME_NODE_NAME               "artist_name"
+#define API_TRACK_NAME_NODE_NAME                "track_name"
+#define API_ALBUM_NAME_NODE_NAME                "release_name"
+#define API_ADDITIONAL_INFO_NODE_NAME           "additional_info"
+#define API_MUSICBRAINZ_RECORDING_ID_NODE_NAME  "recording_mbid"
+#define API_MUSICBRAINZ_ARTISTS_ID_NODE_NAME    "artist_mbids"
+#define API_MUSICBRAINZ_ALBUM_ID_NODE_NAME      "release_mbid"
+#define API_MUSICBRAINZ_SPOTIFY_ID_NODE_NAME    "spotify_id"
+#define API_DURATION_NODE_NAME                  "duration"
+#define API_URI_NODE_NAME                       "origin_url"
+#define API_PLAYER_NODE_NAME                    "media_player"
+
+#define min(a, b) (((a) <= (b)) ? a : b)
+#define _warn(...)
+
+// NOTE(marius): the fields of the structs in structs.h that the importers use
+enum import_format {
+    import_format_unknown = 0,
+    import_format_jsonl,
+    import_format_rockbox,
+};
+
+enum import_entry_status {
+    import_entry_ok = 0,
+    import_entry_skipped,
+    import_entry_invalid,
+};
+
+struct scrobble {
+    double length;
+    time_t start_time;
+    unsigned short track_number;
+    char url[MAX_PROPERTY_LENGTH+1];
+    char title[MAX_PROPERTY_LENGTH+1];
+    char album[MAX_PROPERTY_LENGTH+1];
+    char artist[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_track_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_album_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char player_name[MAX_PROPERTY_LENGTH+1];
+    char mb_spotify_id[MAX_PROPERTY_LENGTH+1];
+};
+
+struct configuration {
+    char name[MAX_PROPERTY_LENGTH+1];
+    struct {
+        char xdg_cache_home[FILE_PATH_MAX+1];
+    } env;
+};
+
+#include "import.h"
+
+static struct scrobble track;
+static char line[1024];
+
+static enum import_entry_status parse_rockbox(const char *value, const bool local_time)
+{
+    strncpy(line, value, sizeof(line) - 1);
+    return import_parse_rockbox(line, &track, local_time);
+}
+
+static enum import_entry_status parse_listen(struct json_tokener *tokener, const char *value)
+{
+    return import_parse_listen(tokener, value, strlen(value), &track);
+}
+
+describe(import) {
+    subdesc(rockbox) {
+        it ("detects the format from the header") {
+            asserteq(import_detect_format("#AUDIOSCROBBLER/1.1\n"), import_format_rockbox);
+            asserteq(import_detect_format("{\"listened_at\":1}\n"), import_format_jsonl);
+            asserteq(import_detect_format("Artist\tAlbum\n"), import_format_unknown);
+            asserteq(import_detect_format(NULL), import_format_unknown);
+        };
+
+        it ("skips the header lines") {
+            asserteq(parse_rockbox("#AUDIOSCROBBLER/1.1\n", false), import_entry_skipped);
+            asserteq(parse_rockbox("#TZ/UNKNOWN\n", false), import_entry_skipped);
+            asserteq(parse_rockbox("#CLIENT/Rockbox sansaclipplus $Revision$\n", false), import_entry_skipped);
+        };
+
+        it ("skips the tracks that were not listened") {
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tS\t1700000000\t\n", false), import_entry_skipped);
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tS\t1700000000\n", false), import_entry_skipped);
+        };
+
+        it ("rejects the lines with missing fields") {
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tL\n", false), import_entry_invalid);
+            asserteq(parse_rockbox("\n", false), import_entry_invalid);
+        };
+
+        it ("reads the listened tracks") {
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tL\t1700000000\tb1a9c0e9-d987-4042-ae91-78d6a3267d69\r\n", false), import_entry_ok);
+            asserteq_str(track.artist[0], "Artist");
+            asserteq_str(track.album, "Album");
+            asserteq_str(track.title, "Title");
+            asserteq(track.track_number, 3);
+            asserteq(track.length, 215.0);
+            asserteq(track.start_time, 1700000000);
+            asserteq_str(track.mb_track_id[0], "b1a9c0e9-d987-4042-ae91-78d6a3267d69");
+
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t\t180\tL\t1700000000\n", false), import_entry_ok);
+            asserteq(track.track_number, 0);
+            asserteq_str(track.mb_track_id[0], "");
+        };
+
+        it ("converts the local time stamps to UTC") {
+            const char *tz = getenv("TZ");
+            char saved_tz[64] = {0};
+            if (NULL != tz) { strncpy(saved_tz, tz, sizeof(saved_tz) - 1); }
+
+            // NOTE(marius): a fixed offset without daylight saving, five hours behind UTC
+            setenv("TZ", "EST5", 1);
+            tzset();
+
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tL\t1700000000\n", true), import_entry_ok);
+            asserteq(track.start_time, 1700000000 + 5 * 3600);
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tL\t1700000000\n", false), import_entry_ok);
+            asserteq(track.start_time, 1700000000);
+
+            setenv("TZ", "UTC0", 1);
+            tzset();
+            asserteq(parse_rockbox("Artist\tAlbum\tTitle\t3\t215\tL\t1700000000\n", true), import_entry_ok);
+            asserteq(track.start_time, 1700000000);
+
+            if (NULL != tz) { setenv("TZ", saved_tz, 1); } else { unsetenv("TZ"); }
+            tzset();
+        };
+    };
+
+    subdesc(listen) {
+        struct json_tokener *tokener = json_tokener_new();
+        defer(json_tokener_free(tokener));
+
+        it ("reads the listen metadata") {
+            asserteq(parse_listen(tokener, "{\"listened_at\":1700000000,\"track_metadata\":{\"artist_name\":\"Artist\","
+                "\"track_name\":\"Title\",\"release_name\":\"Album\",\"additional_info\":{\"duration\":215,\"tracknumber\":3,"
+                "\"recording_mbid\":\"b1a9c0e9-d987-4042-ae91-78d6a3267d69\",\"artist_mbids\":[\"a\",\"b\"],"
+                "\"media_player\":\"mpd\"}}}"), import_entry_ok);
+            asserteq(track.start_time, 1700000000);
+            asserteq_str(track.artist[0], "Artist");
+            asserteq_str(track.title, "Title");
+            asserteq_str(track.album, "Album");
+            asserteq(track.track_number, 3);
+            asserteq_str(track.mb_track_id[0], "b1a9c0e9-d987-4042-ae91-78d6a3267d69");
+            asserteq_str(track.mb_artist_id[0], "a");
+            asserteq_str(track.mb_artist_id[1], "b");
+            asserteq_str(track.player_name, "mpd");
+        };
+
+        it ("prefers the duration in seconds") {
+            asserteq(parse_listen(tokener, "{\"listened_at\":1,\"track_metadata\":{\"additional_info\":"
+                "{\"duration\":215,\"duration_ms\":100000}}}"), import_entry_ok);
+            asserteq(track.length, 215.0);
+        };
+
+        it ("falls back to the duration in milliseconds") {
+            asserteq(parse_listen(tokener, "{\"listened_at\":1,\"track_metadata\":{\"additional_info\":"
+                "{\"duration_ms\":215500}}}"), import_entry_ok);
+            asserteq(track.length, 215.5);
+        };
+
+        it ("leaves the length empty without a duration") {
+            asserteq(parse_listen(tokener, "{\"listened_at\":1,\"track_metadata\":{\"artist_name\":\"Artist\"}}"), import_entry_ok);
+            asserteq(track.length, 0.0);
+            asserteq(parse_listen(tokener, "{\"listened_at\":1,\"track_metadata\":{\"additional_info\":{}}}"), import_entry_ok);
+            asserteq(track.length, 0.0);
+        };
+
+        it ("rejects the invalid listens") {
+            asserteq(parse_listen(tokener, "{\"track_metadata\":{}}"), import_entry_invalid);
+            asserteq(parse_listen(tokener, "{\"listened_at\":1}"), import_entry_invalid);
+            asserteq(parse_listen(tokener, "{\"listened_at\":1,\"track_metadata\":[]}"), import_entry_invalid);
+            asserteq(parse_listen(tokener, "[1,2]"), import_entry_invalid);
+            asserteq(parse_listen(tokener, "{\"listened_at\":"), import_entry_invalid);
+        };
+    };
+};
+
+snow_main();
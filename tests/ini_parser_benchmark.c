@@ -0,0 +1,73 @@
+#include <snow/snow.h>
+#include <time.h>
+
+#define MAX_PROPERTY_LENGTH        512
+#define string_free free
+#define get_zero_string(len) calloc(1, (sizeof(char) + 1) * len)
+
+#define STB_DS_IMPLEMENTATION
+#include "sstrings.h"
+#include "stb_ds.h"
+#include "ini.h"
+
+#define BENCHMARK_GROUP_COUNT   16
+#define BENCHMARK_ITERATIONS    20000
+#define BENCHMARK_BUFFER_SIZE   8192
+
+static size_t build_credentials(char buff[BENCHMARK_BUFFER_SIZE])
+{
+    size_t len = 0;
+    for (int i = 0; i < BENCHMARK_GROUP_COUNT; i++) {
+        len += (size_t)snprintf(buff + len, BENCHMARK_BUFFER_SIZE - len,
+            "[listenbrainz:account%d]\n"
+            "enabled = true\n"
+            "username = tester%d\n"
+            "token = f00d-ale-c0ffee-41f-6419418c768a\n"
+            "url = https://api.listenbrainz.org\n"
+            "\n", i, i);
+    }
+    return len;
+}
+
+static void count_views(const struct ini_view *group, const struct ini_view *key, const struct ini_view *value, void *data)
+{
+    size_t *count = data;
+    if (NULL != key) { *count += value->len; }
+}
+
+static double elapsed_ms(const clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+describe(ini_parser_benchmark) {
+    char buff[BENCHMARK_BUFFER_SIZE] = {0};
+    const size_t buff_size = build_credentials(buff);
+
+    it ("parses into allocated groups and into views") {
+        clock_t start = clock();
+        int values = 0;
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            struct ini_config config = { .groups = NULL, };
+            values = ini_parse(buff, buff_size, &config);
+            ini_config_clean(&config);
+        }
+        const double allocated = elapsed_ms(start);
+
+        start = clock();
+        int views = 0;
+        size_t bytes = 0;
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            views = ini_parse_views(buff, buff_size, count_views, &bytes);
+        }
+        const double in_place = elapsed_ms(start);
+
+        fprintf(stdout, "ini_parse: %.2lfms, ini_parse_views: %.2lfms for %d iterations of %zu bytes\n",
+                allocated, in_place, BENCHMARK_ITERATIONS, buff_size);
+        asserteq(views, BENCHMARK_GROUP_COUNT * 4);
+        assertneq(values, 0);
+        assertneq(bytes, 0);
+    };
+};
+
+snow_main();
@@ -131,6 +131,31 @@ const struct test_pair tests[2] = {
     },
 };
 
+#define MAX_TEST_COUNT 10
+
+struct view_collector {
+    int group_count;
+    struct ini_view groups[MAX_TEST_COUNT];
+    int element_count[MAX_TEST_COUNT];
+    struct ini_view keys[MAX_TEST_COUNT][MAX_TEST_COUNT];
+    struct ini_view values[MAX_TEST_COUNT][MAX_TEST_COUNT];
+};
+
+static void collect_views(const struct ini_view *group, const struct ini_view *key, const struct ini_view *value, void *data)
+{
+    struct view_collector *collector = data;
+    if (NULL == key) {
+        if (collector->group_count >= MAX_TEST_COUNT) { return; }
+        collector->groups[collector->group_count++] = *group;
+        return;
+    }
+    const int i = collector->group_count - 1;
+    if (i < 0 || collector->element_count[i] >= MAX_TEST_COUNT) { return; }
+    const int j = collector->element_count[i]++;
+    collector->keys[i][j] = *key;
+    collector->values[i][j] = *value;
+}
+
 describe(ini_reader) {
     FILE *file = NULL;
 
@@ -202,6 +227,27 @@ describe(ini_reader) {
             }
             if (NULL != config.groups) { ini_config_clean(&config); }
         };
+
+        it ("parse mapped ini file into views") {
+            struct ini_file mapped = {0};
+            asserteq(ini_file_map(&mapped, path), true);
+
+            struct view_collector collector = {0};
+            ini_parse_views(mapped.data, mapped.size, collect_views, &collector);
+
+            asserteq(collector.group_count, group_count);
+            for (int i = 0; i < collector.group_count; i++) {
+                asserteq(ini_view_is(&collector.groups[i], test.groups[i].name), true);
+                asserteq(collector.element_count[i], test.groups[i].element_count);
+
+                for (int j = 0; j < collector.element_count[i]; j++) {
+                    asserteq(ini_view_is(&collector.keys[i][j], test.groups[i].elements[j].key), true);
+                    asserteq(ini_view_is(&collector.values[i][j], test.groups[i].elements[j].value), true);
+                }
+            }
+            ini_file_unmap(&mapped);
+            asserteq(mapped.data, NULL);
+        };
     }
 };
 
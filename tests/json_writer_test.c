@@ -0,0 +1,99 @@
+#include <snow/snow.h>
+
+#include "json_writer.h"
+
+// NOTE(marius): the expected documents are the output of json_object_to_json_string from json-c for the same values
+describe(json_writer) {
+    it ("writes a listenbrainz payload like json-c") {
+        char buffer[2048] = {0};
+        struct json_writer w;
+        json_writer_init(&w, buffer, sizeof(buffer));
+
+        json_writer_object_begin(&w);
+        json_writer_key_string(&w, "listen_type", "import");
+        json_writer_key(&w, "payload");
+        json_writer_array_begin(&w);
+        for (int i = 0; i < 2; i++) {
+            json_writer_object_begin(&w);
+            json_writer_key_int(&w, "listened_at", 1700000000 + i);
+            json_writer_key(&w, "track_metadata");
+            json_writer_object_begin(&w);
+            json_writer_key_string(&w, "release_name", "Homogenic");
+            json_writer_key_string(&w, "artist_name", "Bj\xc3\xb6rk");
+            json_writer_key_string(&w, "track_name", "J\xc3\xb3ga");
+            json_writer_key(&w, "additional_info");
+            json_writer_object_begin(&w);
+            json_writer_key_int(&w, "duration", 305);
+            json_writer_key(&w, "artist_mbids");
+            json_writer_array_begin(&w);
+            json_writer_string(&w, "87c5dedd-371d-4a53-9f7f-80522fb7f3cb");
+            json_writer_array_end(&w);
+            json_writer_key_string(&w, "origin_url", "https://example.com/track?id=1");
+            json_writer_object_end(&w);
+            json_writer_object_end(&w);
+            json_writer_object_end(&w);
+        }
+        json_writer_array_end(&w);
+        json_writer_object_end(&w);
+
+        asserteq(w.overflow, false);
+        asserteq(w.depth, 0);
+        asserteq_str(buffer, "{ \"listen_type\": \"import\", \"payload\": [ "
+            "{ \"listened_at\": 1700000000, \"track_metadata\": { \"release_name\": \"Homogenic\", \"artist_name\": \"Bj\xc3\xb6rk\", "
+            "\"track_name\": \"J\xc3\xb3ga\", \"additional_info\": { \"duration\": 305, \"artist_mbids\": [ \"87c5dedd-371d-4a53-9f7f-80522fb7f3cb\" ], "
+            "\"origin_url\": \"https:\\/\\/example.com\\/track?id=1\" } } }, "
+            "{ \"listened_at\": 1700000001, \"track_metadata\": { \"release_name\": \"Homogenic\", \"artist_name\": \"Bj\xc3\xb6rk\", "
+            "\"track_name\": \"J\xc3\xb3ga\", \"additional_info\": { \"duration\": 305, \"artist_mbids\": [ \"87c5dedd-371d-4a53-9f7f-80522fb7f3cb\" ], "
+            "\"origin_url\": \"https:\\/\\/example.com\\/track?id=1\" } } } ] }");
+        asserteq(w.length, strlen(buffer));
+    };
+
+    it ("escapes strings like json-c") {
+        char buffer[256] = {0};
+        struct json_writer w;
+        json_writer_init(&w, buffer, sizeof(buffer));
+
+        json_writer_array_begin(&w);
+        json_writer_string(&w, "with \"quotes\" and \\ back/slash");
+        json_writer_string(&w, "ctl\x01\x1f\t\n\r\b\f end");
+        json_writer_string(&w, "del\x7f");
+        json_writer_string(&w, "");
+        json_writer_array_end(&w);
+
+        asserteq_str(buffer, "[ \"with \\\"quotes\\\" and \\\\ back\\/slash\", \"ctl\\u0001\\u001f\\t\\n\\r\\b\\f end\", \"del\x7f\", \"\" ]");
+    };
+
+    it ("writes empty containers and negative numbers like json-c") {
+        char buffer[256] = {0};
+        struct json_writer w;
+        json_writer_init(&w, buffer, sizeof(buffer));
+
+        json_writer_object_begin(&w);
+        json_writer_key_int(&w, "duration", -5);
+        json_writer_key(&w, "empty_arr");
+        json_writer_array_begin(&w);
+        json_writer_array_end(&w);
+        json_writer_key(&w, "empty_obj");
+        json_writer_object_begin(&w);
+        json_writer_object_end(&w);
+        json_writer_object_end(&w);
+
+        asserteq_str(buffer, "{ \"duration\": -5, \"empty_arr\": [ ], \"empty_obj\": { } }");
+    };
+
+    it ("stops writing when the buffer is full") {
+        char buffer[16] = {0};
+        struct json_writer w;
+        json_writer_init(&w, buffer, sizeof(buffer));
+
+        json_writer_object_begin(&w);
+        json_writer_key_string(&w, "key", "a value that doesn't fit");
+        json_writer_object_end(&w);
+
+        asserteq(w.overflow, true);
+        asserteq(w.length < sizeof(buffer), true);
+        asserteq(strlen(buffer), w.length);
+    };
+};
+
+snow_main();
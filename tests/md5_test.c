@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <snow/snow.h>
+
+#include "md5.h"
+
+static void md5_hex(const uint8_t digest[16], char *result)
+{
+    for (size_t n = 0; n < 16; n++) {
+        snprintf(result + 2 * n, 3, "%02x", digest[n]);
+    }
+}
+
+static void md5_string(const char *message, char *result)
+{
+    uint8_t digest[16] = {0};
+    md5((const uint8_t*)message, strlen(message), digest);
+    md5_hex(digest, result);
+}
+
+describe(md5) {
+    it ("hashes the RFC 1321 test suite") {
+        char result[33] = {0};
+        md5_string("", result);
+        asserteq_str(result, "d41d8cd98f00b204e9800998ecf8427e");
+        md5_string("a", result);
+        asserteq_str(result, "0cc175b9c0f1b6a831c399e269772661");
+        md5_string("abc", result);
+        asserteq_str(result, "900150983cd24fb0d6963f7d28e17f72");
+        md5_string("message digest", result);
+        asserteq_str(result, "f96b697d7cb7938d525a2f31aaf161d0");
+        md5_string("abcdefghijklmnopqrstuvwxyz", result);
+        asserteq_str(result, "c3fcd3d76192e4007dfb496cca67e13b");
+        md5_string("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", result);
+        asserteq_str(result, "d174ab98d277d9f5a5611c2c9f419d9f");
+        md5_string("12345678901234567890123456789012345678901234567890123456789012345678901234567890", result);
+        asserteq_str(result, "57edf4a22be3c955ac49da2e2107b67a");
+    };
+
+    it ("gets the same digest when the message is hashed in pieces") {
+        char message[300] = {0};
+        for (size_t i = 0; i < sizeof(message) - 1; i++) {
+            message[i] = (char)('a' + i % 26);
+        }
+        const size_t length = strlen(message);
+
+        uint8_t expected[16] = {0};
+        md5((const uint8_t*)message, length, expected);
+
+        const size_t pieces[] = {1, 7, 55, 56, 63, 64, 65, 128};
+        for (size_t p = 0; p < sizeof(pieces)/sizeof(pieces[0]); p++) {
+            struct md5_context ctx;
+            md5_init(&ctx);
+            for (size_t offset = 0; offset < length; offset += pieces[p]) {
+                const size_t left = length - offset;
+                md5_update(&ctx, (const uint8_t*)message + offset, left < pieces[p] ? left : pieces[p]);
+            }
+            uint8_t digest[16] = {0};
+            md5_final(&ctx, digest);
+            asserteq_buf(digest, expected, sizeof(digest));
+        }
+    };
+};
+
+snow_main();
@@ -0,0 +1,43 @@
+#include <snow/snow.h>
+
+#include "playback.h"
+
+describe(playback) {
+    it ("needs half the track, up to four minutes") {
+        asserteq(playback_scrobble_threshold(300.0), 151.0);
+        asserteq(playback_scrobble_threshold(600.0), 241.0);
+        asserteq(playback_scrobble_threshold(60.0), 31.0);
+        asserteq(playback_scrobble_threshold(0.0), 0.0);
+    };
+
+    it ("counts the time played only once") {
+        // NOTE(marius): a track first seen at 60s, or resumed there after a pause
+        asserteq(playback_scrobble_due_in(300.0, 60.0, 1.0), 91.0);
+        asserteq(playback_scrobble_is_due(300.0, 60.0), false);
+
+        // listened for another 30s before pausing again, it's still not due
+        asserteq(playback_scrobble_is_due(300.0, 90.0), false);
+        asserteq(playback_scrobble_due_in(300.0, 90.0, 1.0), 61.0);
+
+        // resumed and played until the timer expired
+        asserteq(playback_scrobble_is_due(300.0, 150.0), false);
+        asserteq(playback_scrobble_is_due(300.0, 150.5), true);
+        asserteq(playback_scrobble_is_due(300.0, 151.0), true);
+        asserteq(playback_scrobble_due_in(300.0, 151.0, 1.0), 0.0);
+        asserteq(playback_scrobble_due_in(300.0, 200.0, 1.0), 0.0);
+    };
+
+    it ("resumes a long track part-way") {
+        asserteq(playback_scrobble_due_in(600.0, 200.0, 1.0), 41.0);
+        asserteq(playback_scrobble_is_due(600.0, 200.0), false);
+        asserteq(playback_scrobble_is_due(600.0, 241.0), true);
+    };
+
+    it ("scales the remaining time by the playback rate") {
+        asserteq(playback_scrobble_due_in(300.0, 60.0, 2.0), 45.5);
+        asserteq(playback_scrobble_due_in(300.0, 60.0, 0.5), 182.0);
+        asserteq(playback_scrobble_due_in(300.0, 60.0, 0.0), 91.0);
+    };
+};
+
+snow_main();
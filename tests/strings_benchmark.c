@@ -0,0 +1,83 @@
+#include <snow/snow.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "sstrings.h"
+
+#define BENCHMARK_ITERATIONS    200000
+
+static const char *values[] = {
+    "   username = marius\n",
+    "\tpassword = a0ba2b7c9f4b4d56b2a43e6f7a7d0d4f   \r\n",
+    "[libre.fm]",
+    "  url = https://libre.fm/2.0/                                 \n",
+    "token=                                                          ",
+};
+#define BENCHMARK_VALUES (sizeof(values)/sizeof(values[0]))
+
+static double elapsed_ms(const clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static size_t run_strlen(uint32_t (*len_fn)(const char*))
+{
+    size_t total = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t v = 0; v < BENCHMARK_VALUES; v++) {
+            total += len_fn(values[v]);
+        }
+    }
+    return total;
+}
+
+static size_t run_trim(uint32_t (*span_fn)(const char*, uint32_t, const struct grrrs_trim_set*),
+        uint32_t (*rspan_fn)(const char*, uint32_t, const struct grrrs_trim_set*))
+{
+    struct grrrs_trim_set set;
+    __grrrs_trim_set_init(&set, " \t\r\n");
+
+    uint32_t lengths[BENCHMARK_VALUES];
+    for (size_t v = 0; v < BENCHMARK_VALUES; v++) {
+        lengths[v] = __strlen(values[v]);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t v = 0; v < BENCHMARK_VALUES; v++) {
+            total += span_fn(values[v], lengths[v], &set) + rspan_fn(values[v], lengths[v], &set);
+        }
+    }
+    return total;
+}
+
+describe(strings_benchmark) {
+    it ("measures the length and trim loops") {
+        clock_t start = clock();
+        const size_t scalar_len = run_strlen(__strlen_scalar);
+        const double scalar_len_ms = elapsed_ms(start);
+
+        start = clock();
+        const size_t scalar_trim = run_trim(__grrrs_span_scalar, __grrrs_rspan_scalar);
+        const double scalar_trim_ms = elapsed_ms(start);
+
+        fprintf(stdout, "scalar: strlen %.2lfms, trim %.2lfms for %d iterations of %zu values\n",
+                scalar_len_ms, scalar_trim_ms, BENCHMARK_ITERATIONS, BENCHMARK_VALUES);
+#ifdef GRRRS_SSE2
+        start = clock();
+        const size_t sse2_len = run_strlen(__strlen_sse2);
+        const double sse2_len_ms = elapsed_ms(start);
+
+        start = clock();
+        const size_t sse2_trim = run_trim(__grrrs_span_sse2, __grrrs_rspan_sse2);
+        const double sse2_trim_ms = elapsed_ms(start);
+
+        fprintf(stdout, "sse2: strlen %.2lfms, trim %.2lfms for %d iterations of %zu values\n",
+                sse2_len_ms, sse2_trim_ms, BENCHMARK_ITERATIONS, BENCHMARK_VALUES);
+        asserteq(sse2_len, scalar_len);
+        asserteq(sse2_trim, scalar_trim);
+#endif
+    };
+};
+
+snow_main();
@@ -0,0 +1,182 @@
+#include <snow/snow.h>
+
+#include "timer_wheel.h"
+
+struct fired_timer {
+    uint64_t at;
+    int count;
+    struct timer_wheel *wheel;
+};
+
+static void record_fired(struct timer_wheel_entry *entry, void *data)
+{
+    (void)entry; // quiet -Wunused-parameter
+    struct fired_timer *fired = data;
+    fired->at = fired->wheel->now;
+    fired->count++;
+}
+
+static void cancel_other(struct timer_wheel_entry *entry, void *data)
+{
+    (void)entry; // quiet -Wunused-parameter
+    struct timer_wheel_entry *other = data;
+    struct fired_timer *fired = other->data;
+    timer_wheel_cancel(fired->wheel, other);
+}
+
+static void add_again(struct timer_wheel_entry *entry, void *data)
+{
+    struct fired_timer *fired = data;
+    fired->count++;
+    if (fired->count < 3) {
+        timer_wheel_add(fired->wheel, entry, 10);
+    }
+}
+
+describe(timer_wheel) {
+    it ("fires the timers on the tick they expire") {
+        struct timer_wheel wheel;
+        timer_wheel_init(&wheel, 1000);
+
+        const uint64_t delays[] = {1, 63, 64, 65, 4095, 4096, 70000, 300000};
+        const size_t count = sizeof(delays)/sizeof(delays[0]);
+        struct timer_wheel_entry entries[8];
+        struct fired_timer fired[8] = {0};
+        for (size_t i = 0; i < count; i++) {
+            fired[i].wheel = &wheel;
+            timer_wheel_entry_init(&entries[i], record_fired, &fired[i]);
+            timer_wheel_add(&wheel, &entries[i], delays[i]);
+        }
+        asserteq(wheel.count, count);
+
+        timer_wheel_advance(&wheel, 1000 + 400000);
+        asserteq(wheel.count, 0);
+        for (size_t i = 0; i < count; i++) {
+            asserteq(fired[i].count, 1);
+            asserteq(fired[i].at, 1000 + delays[i]);
+            asserteq(timer_wheel_entry_pending(&entries[i]), false);
+        }
+    };
+
+    it ("fires the cascaded timers on the tick they expire") {
+        struct timer_wheel wheel;
+        timer_wheel_init(&wheel, 1000);
+
+        // NOTE(marius): 1088 = 17 * 64 and 123584 = 1931 * 64, the timers are cascaded on the tick they expire
+        struct timer_wheel_entry entry;
+        struct fired_timer fired = {.wheel = &wheel};
+        timer_wheel_entry_init(&entry, record_fired, &fired);
+        timer_wheel_add(&wheel, &entry, 88);
+        timer_wheel_advance(&wheel, 1200);
+        asserteq(fired.count, 1);
+        asserteq(fired.at, 1088);
+
+        timer_wheel_init(&wheel, 123457);
+        fired.count = 0;
+        timer_wheel_add(&wheel, &entry, 127);
+        timer_wheel_advance(&wheel, 124000);
+        asserteq(fired.count, 1);
+        asserteq(fired.at, 123584);
+    };
+
+    it ("doesn't fire cancelled timers") {
+        struct timer_wheel wheel;
+        timer_wheel_init(&wheel, 0);
+
+        struct fired_timer fired = { .wheel = &wheel };
+        struct timer_wheel_entry entry;
+        timer_wheel_entry_init(&entry, record_fired, &fired);
+
+        timer_wheel_add(&wheel, &entry, 5000);
+        asserteq(timer_wheel_entry_pending(&entry), true);
+        timer_wheel_cancel(&wheel, &entry);
+        asserteq(timer_wheel_entry_pending(&entry), false);
+        asserteq(wheel.count, 0);
+
+        timer_wheel_advance(&wheel, 10000);
+        asserteq(fired.count, 0);
+    };
+
+    it ("moves a pending timer when it's added again") {
+        struct timer_wheel wheel;
+        timer_wheel_init(&wheel, 0);
+
+        struct fired_timer fired = { .wheel = &wheel };
+        struct timer_wheel_entry entry;
+        timer_wheel_entry_init(&entry, record_fired, &fired);
+
+        timer_wheel_add(&wheel, &entry, 100);
+        timer_wheel_add(&wheel, &entry, 20);
+        asserteq(wheel.count, 1);
+
+        timer_wheel_advance(&wheel, 200);
+        asserteq(fired.count, 1);
+        asserteq(fired.at, 20);
+    };
+
+    it ("lets the callbacks change the timers of the same slot") {
+        struct timer_wheel wheel;
+        timer_wheel_init(&wheel, 0);
+
+        struct fired_timer fired = { .wheel = &wheel };
+        struct timer_wheel_entry victim, killer;
+        timer_wheel_entry_init(&victim, record_fired, &fired);
+        timer_wheel_entry_init(&killer, cancel_other, &victim);
+
+        // NOTE(marius): the last one added is the first in the slot
+        timer_wheel_add(&wheel, &victim, 7);
+        timer_wheel_add(&wheel, &killer, 7);
+
+        timer_wheel_advance(&wheel, 10);
+        asserteq(fired.count, 0);
+        asserteq(wheel.count, 0);
+
+        struct fired_timer repeated = { .wheel = &wheel };
+        struct timer_wheel_entry entry;
+        timer_wheel_entry_init(&entry, add_again, &repeated);
+        timer_wheel_add(&wheel, &entry, 10);
+
+        timer_wheel_advance(&wheel, 100);
+        asserteq(repeated.count, 3);
+        asserteq(wheel.count, 0);
+    };
+
+    it ("computes the next tick the wheel needs to advance to") {
+        struct timer_wheel wheel;
+        timer_wheel_init(&wheel, 10);
+
+        uint64_t next = 0;
+        asserteq(timer_wheel_next_expiry(&wheel, &next), false);
+
+        struct fired_timer fired = { .wheel = &wheel };
+        struct timer_wheel_entry near, far;
+        timer_wheel_entry_init(&near, record_fired, &fired);
+        timer_wheel_entry_init(&far, record_fired, &fired);
+
+        timer_wheel_add(&wheel, &far, 10000);
+        asserteq(timer_wheel_next_expiry(&wheel, &next), true);
+        // the far timer gets cascaded before it expires
+        asserteq(next <= 10010, true);
+
+        timer_wheel_add(&wheel, &near, 30);
+        asserteq(timer_wheel_next_expiry(&wheel, &next), true);
+        asserteq(next, 40);
+
+        // advancing only to the computed ticks must not miss any timer
+        while (timer_wheel_next_expiry(&wheel, &next)) {
+            timer_wheel_advance(&wheel, next);
+        }
+        asserteq(fired.count, 2);
+        asserteq(fired.at, 10010);
+    };
+
+    it ("converts milliseconds to ticks rounding up") {
+        asserteq(timer_wheel_msec_to_ticks(0), 0);
+        asserteq(timer_wheel_msec_to_ticks(-5), 0);
+        asserteq(timer_wheel_msec_to_ticks(TIMER_WHEEL_TICK_MSEC), 1);
+        asserteq(timer_wheel_msec_to_ticks(TIMER_WHEEL_TICK_MSEC + 1), 2);
+        asserteq(timer_wheel_msec_to_ticks(TIMER_WHEEL_TICK_MSEC * 1000.0), 1000);
+    };
+};
+
+snow_main();